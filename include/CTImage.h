@@ -82,11 +82,30 @@ public:
   size_t get_NElements();
   size_t get_NFacets();
 
+  // The mesh arrays themselves, not a copy. They are reallocated by
+  // mesh(), trim_channels(), refine() and reorder().
+  std::vector<double> &get_xyz();
+  std::vector<int> &get_tets();
+  std::vector<int> &get_facets();
+  std::vector<int> &get_facet_ids();
+  double get_resolution();
+
   int read(std::string filename, const int offsets[], int slab_size);
   int read_nhdr(std::string filename, const int offsets[], int slab_size);
   int read_raw(std::string filename, const int offsets[], int slab_size);
   int create_hourglass(int size, int throat_width);
 
+  // Voxels with a value below the threshold (default 1) are pore space.
+  void set_threshold(int threshold);
+
+  // Binarise the image so that pore voxels are 1 and everything else
+  // is 0. read() already does this.
+  void segment();
+
+  // Remove the pore voxels that are not face connected to both sides of
+  // the image along axis (0, 1 or 2). Returns the number removed.
+  int prune(int axis=0);
+
   void mesh();
 
   void set_basename(std::string basename);
@@ -94,6 +113,12 @@ public:
 
   void trim_channels(int in_boundary, int out_boundary);
 
+  // Uniformly refine the mesh, splitting each element into 8.
+  void refine(int levels);
+
+  // Renumber the mesh to improve cache locality (rcm or hilbert).
+  int reorder(std::string method);
+
   // Write INR file.
   void write_inr(const char *filename=NULL);
 
@@ -103,18 +128,26 @@ public:
   // Write vox file.
   void write_vox(const char *filename=NULL);
 
-  // Write VTK unstructured grid file (*.vtu)
-  void write_vtu(const char *filename=NULL);
+  // Write VTK unstructured grid file (*.vtu), optionally with the
+  // elements and facets combined in one file.
+  void write_vtu(const char *filename=NULL, bool combined=false);
+
+  // Write GMSH file, ASCII or binary.
+  int write_gmsh(const char *filename=NULL, bool binary=false);
+
+  // Write the mesh as XDMF/HDF5 (needs HDF5).
+  int write_xdmf(const char *filename=NULL, int compression=0);
 
-  // Write GMSH file.
-  int write_gmsh(const char *filename=NULL);
+  // Write native binary mesh file (*.pfm).
+  int write_native(const char *filename=NULL);
+
+  // Write mesh quality and geometry statistics (JSON).
+  int write_statistics(const char *filename=NULL);
   
 private:
-  double volume(const double *x0, const double *x1, const double *x2, const double *x3) const;
-
   bool verbose;
   unsigned char *raw_image;
-  int image_size, dims[3];
+  int image_size, dims[3], threshold;
   double resolution;
   CGAL::Image_3 *image;
   Mesh_domain *domain;
@@ -41,15 +41,84 @@
 #include <string>
 #include <vector>
 
+// Create the element-element adjacency list, where EEList[i*4+j] is the
+// element sharing the facet opposite node j of element i, or -1 on the
+// boundary.
+void create_element_adjacency(size_t NNodes, const std::vector<int> &tets, std::vector<int> &EEList);
+
+// Merge nodes that are within tolerance of each other, e.g. duplicated
+// vertices in an imported mesh, and renumber the elements. Elements that
+// collapse are masked. Returns the number of nodes removed.
+int weld_vertices(double tolerance, std::vector<double> &xyz, std::vector<int> &tets);
+
+// Find the active domain: the elements connected to both faces of the
+// sample normal to axis. Elements outside it are masked (tets[i*4]=-1),
+// renumbering[i] is the new number of node i, or -1 if it is not used,
+// and the boundary facets are created in the new numbering. xyz and the
+// kept elements are left as they were, so that writers can stream the
+// trimmed mesh without a second copy. Returns the number of active nodes.
+int trim_domain(int axis, const std::vector<double> &xyz, std::vector<int> &tets, std::vector<int> &renumbering,
+                std::vector<int> &facets, std::vector<int> &facet_ids);
+
+// Dual-phase version of trim_domain for meshes of two materials
+// (phase[i] is 1 or 2), which share xyz, tets and one element adjacency.
+// For phase p+1, keep[p][i] is set for its active elements, renumbering[p]
+// maps its nodes and facets[p] and facet_ids[p] hold its boundary, where
+// the facets shared with the active part of the other phase are labelled
+// 8. interface holds those shared facets (untrimmed node numbers, facing
+// out of phase 1). Nothing is masked. Returns the number of phases with
+// an active domain.
+int trim_phases(int axis, const std::vector<double> &xyz, std::vector<int> &tets, const std::vector<char> &phase,
+                std::vector<char> keep[2], std::vector<int> renumbering[2], std::vector<int> facets[2],
+                std::vector<int> facet_ids[2], std::vector<int> &interface);
+
+// Apply the renumbering from trim_domain in place, dropping masked
+// elements and unused nodes.
+void compact_domain(const std::vector<int> &renumbering, std::vector<double> &xyz, std::vector<int> &tets);
+
+// Trim to the active domain (trim_domain followed by compact_domain).
 int create_domain(int axis, std::vector<double> &xyz, std::vector<int> &tets, std::vector<int> &facets, std::vector<int> &facet_ids);
 
 double read_resolution_from_nhdr(std::string filename);
 
-void read_tarantula_mesh_file(std::string filename, std::string nhdr_filename, bool toggle_material, std::vector<double> &xyz, std::vector<int> &tets);
+// Read a Tarantula .spm mesh. The file is memory mapped and the vertex,
+// element and material blocks are converted in parallel. Returns -1 if
+// the file cannot be read.
+int read_tarantula_mesh_file(std::string filename, std::string nhdr_filename, bool toggle_material, std::vector<double> &xyz, std::vector<int> &tets);
 
-void read_vtk_mesh_file(std::string filename, std::string nhdr_filename, std::vector<double> &xyz, std::vector<int> &tets);
+// As above, but keeping every element and setting phase[i] to 1 or 2 if
+// element i is in the mat1 or mat2 list (0 if in neither). Returns the
+// number of material lists, or -1 if the file cannot be read.
+int read_tarantula_mesh_file(std::string filename, std::string nhdr_filename, std::vector<double> &xyz, std::vector<int> &tets, std::vector<char> &phase);
+
+// Read a Cleaver mesh. Legacy VTK files (ASCII or binary, POLYDATA with
+// each element written as its four facets, or UNSTRUCTURED_GRID) are
+// parsed directly into xyz and tets; .vtu files are read through VTK.
+// Only tetrahedra are supported. Returns -1 if the file cannot be read.
+int read_vtk_mesh_file(std::string filename, std::string nhdr_filename, std::vector<double> &xyz, std::vector<int> &tets);
+
+// Read a native binary mesh file (see write_binary_mesh_file). The file
+// is memory mapped and the arrays copied out in parallel. If resolution
+// is not NULL it is set to the image resolution stored in the file.
+int read_binary_mesh_file(std::string filename, std::vector<double> &xyz, std::vector<int> &tets,
+                          std::vector<int> &facets, std::vector<int> &facet_ids, double *resolution=NULL);
 
 double volume(const double *x0, const double *x1, const double *x2, const double *x3);
+
+// Quality of a tetrahedron, 6*sqrt(2)*volume/l_rms^3, where l_rms is the
+// root mean square edge length. This is 1 for a regular tetrahedron and
+// <=0 for degenerate or inverted elements.
+double quality(const double *x0, const double *x1, const double *x2, const double *x3);
+
+// Create the node-element adjacency list in compressed row storage.
+// Masked elements (tets[i*4]==-1) are ignored.
+void create_node_element_adjacency(size_t NNodes, const std::vector<int> &tets,
+                                   std::vector<int> &NEList_offsets, std::vector<int> &NEList);
+
+// Create the node-node adjacency graph of a tetrahedral mesh in
+// compressed row storage. Masked elements (tets[i*4]==-1) are ignored.
+void create_node_adjacency(size_t NNodes, const std::vector<int> &tets,
+                           std::vector<int> &NNList_offsets, std::vector<int> &NNList);
  
 #endif
 
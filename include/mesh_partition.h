@@ -0,0 +1,74 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef MESH_PARTITION_H
+#define MESH_PARTITION_H
+
+#include <string>
+#include <vector>
+
+// Partition the elements of the mesh into nparts. Supported methods
+// are "rcb" (recursive coordinate bisection), "rib" (recursive
+// inertial bisection) and, if compiled with METIS, "metis" (multilevel
+// k-way partitioning of the dual graph EEList). On return epart holds
+// the partition of each element, or -1 for masked elements.
+int partition_mesh(std::string method, int nparts,
+                   const std::vector<double> &xyz,
+                   const std::vector<int> &tets,
+                   const std::vector<int> &EEList,
+                   std::vector<int> &epart);
+
+// Count the number of facets of the dual graph that are cut by the
+// partitioning.
+int partition_edge_cut(const std::vector<int> &EEList, const std::vector<int> &epart);
+
+// Write a GMSH file, basename_<p>.msh, for each partition together
+// with a halo map, basename_<p>.halo. Each partition holds its own
+// elements followed by one layer of ghost elements sharing a node with
+// them. The halo file lists the global id (zero-based) and owning
+// partition of every local node and element in the order they appear
+// in the GMSH file; owned entities come first. The GMSH files are
+// written in binary if binary is true.
+int write_partitioned_gmsh_files(std::string basename, int nparts,
+                                 const std::vector<int> &epart,
+                                 const std::vector<double> &xyz,
+                                 const std::vector<int> &tets,
+                                 const std::vector<int> &facets,
+                                 const std::vector<int> &facet_ids,
+                                 bool binary=false);
+
+#endif
@@ -0,0 +1,63 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef MESH_SMOOTH_H
+#define MESH_SMOOTH_H
+
+#include <vector>
+
+// Improve the element quality by moving nodes. Each iteration applies
+// a smart Laplacian sweep (a node moves towards the centroid of its
+// neighbours only if this improves the worst element around it)
+// followed by a perturbation of the nodes of slivers, elements with a
+// quality below sliver_quality, along the gradient of the worst element
+// quality. Nodes are processed one colour at a time so each colour can
+// be updated in parallel. Interior nodes move freely, nodes lying on a
+// single face of the sample slide within that face and all other
+// boundary nodes are fixed. Stops after max_iterations, once time_limit
+// seconds have passed (if positive), or when no node moves. Returns the
+// number of iterations.
+int smooth_mesh(int max_iterations, double time_limit, double sliver_quality,
+                std::vector<double> &xyz,
+                const std::vector<int> &tets,
+                const std::vector<int> &facets,
+                const std::vector<int> &facet_ids);
+
+// Lowest element quality in the mesh (see quality()).
+double worst_quality(const std::vector<double> &xyz, const std::vector<int> &tets);
+
+#endif
@@ -0,0 +1,85 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef MESH_STATISTICS_H
+#define MESH_STATISTICS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Number of bins in the dihedral angle (10 degrees each) and radius
+// ratio (0.1 each) histograms.
+const int DIHEDRAL_BINS = 18;
+const int RADIUS_RATIO_BINS = 10;
+
+struct MeshStatistics{
+  long NNodes, NElements, NFacets;
+
+  double bbox[6];
+  double volume;                   // Total (pore) volume of the mesh.
+  double mesh_porosity;            // volume / bounding box volume.
+  double image_porosity;           // Porosity of the source image, -1 if unknown.
+  std::map<int, double> area;      // Surface area per facet id.
+
+  double min_dihedral, max_dihedral; // Degrees.
+  long dihedral_histogram[DIHEDRAL_BINS];
+
+  // Radius ratio, 3*inradius/circumradius, which is 1 for a regular
+  // tetrahedron and 0 for a degenerate one.
+  double min_radius_ratio, mean_radius_ratio;
+  long radius_ratio_histogram[RADIUS_RATIO_BINS];
+
+  // Element size, the edge length of a regular tetrahedron of the same
+  // volume. The histogram has bins [2^(k/2), 2^((k+1)/2)) keyed by k.
+  double min_size, max_size, mean_size, std_size;
+  std::map<int, long> size_histogram;
+};
+
+// Calculate the statistics of a mesh in a single parallel pass over the
+// elements and facets. Masked elements (tets[i*4]==-1) are ignored.
+void mesh_statistics(const std::vector<double> &xyz,
+                     const std::vector<int> &tets,
+                     const std::vector<int> &facets,
+                     const std::vector<int> &facet_ids,
+                     double image_porosity,
+                     MeshStatistics &stats);
+
+// Write the statistics as a JSON document.
+int write_statistics_file(std::string filename, const MeshStatistics &stats);
+
+#endif
@@ -0,0 +1,139 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef RUN_REPORT_H
+#define RUN_REPORT_H
+
+#include <chrono>
+#include <string>
+
+// Run reports: the wall time, item count and memory use of each stage
+// of a run, written as JSON when the program exits. Nothing is recorded
+// unless start_run_report() has been called, so stages are all but free
+// otherwise. Stages opened inside a parallel region are ignored.
+//
+// {"command": ..., "threads": ..., "wall_time": ..., "rss_kb": ..., "peak_rss_kb": ...,
+//  "stages": [{"name": "trim/sweep", "depth": 1, "seconds": ..., "count": ...,
+//              "rss_begin_kb": ..., "rss_end_kb": ..., "peak_rss_kb": ...}, ...],
+//  "values": {"elements": ..., ...}}
+//
+// Stages are listed in the order they started; a nested stage is named
+// parent/name. peak_rss_kb is the high water mark of the process at the
+// end of the stage.
+void start_run_report(std::string filename, int argc, char **argv);
+bool run_report_enabled();
+
+// Current and peak resident set size of the process in kB (VmRSS and
+// VmHWM), -1 if unavailable.
+void memory_usage(long &rss, long &hwm);
+
+// Record a named value for the report, e.g. the number of elements.
+void report_value(std::string name, double value);
+
+// Timeline traces: begin and end times of the stages, and of each
+// thread's share of the parallel regions that open a ThreadSpan, written
+// in the Chrome trace event format (open in Perfetto or chrome://tracing)
+// when the program exits. Like reports, nothing is recorded unless
+// start_trace() has been called.
+void start_trace(std::string filename, int argc, char **argv);
+
+// Hardware counters (Linux perf events): cycles, instructions, last level
+// cache misses, data TLB misses and branch misses in user code, summed
+// over the threads of the OpenMP team. Once started, every stage of the
+// run report also has the counts, the instructions per cycle and, if it
+// has a count, the misses per item. Counters that cannot be opened (no
+// kernel support, perf_event_paranoid, containers or virtual machines)
+// are left out with a warning and reported as null. Returns the number
+// of counters opened. In the report each stage gets
+//
+//  "counters": {"cycles": ..., "instructions": ..., "llc_misses": ..., "dtlb_misses": ...,
+//               "branch_misses": ..., "ipc": ..., "llc_misses_per_item": ..., ...}
+enum HardwareCounter{COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_LLC_MISSES,
+                     COUNTER_DTLB_MISSES, COUNTER_BRANCH_MISSES, NCOUNTERS};
+int start_counters();
+bool counters_enabled();
+const char *counter_name(int counter);
+
+// Current value of each counter, -1 if it is not counted. Only call
+// this outside of parallel regions.
+void read_counters(long long counts[NCOUNTERS]);
+
+// A stage lasts from construction to destruction.
+class ScopedStage{
+public:
+  ScopedStage(const char *name);
+  ~ScopedStage();
+
+  // Number of items (nodes, elements, bytes...) the stage processed.
+  void set_count(long count);
+
+  // End the stage before it goes out of scope. Only the innermost open
+  // stage may be stopped.
+  void stop();
+
+private:
+  const char *name;
+  int index;
+  bool traced;
+  std::chrono::steady_clock::time_point start;
+};
+
+// The time one thread spends in a parallel region, for the trace. Open it
+// at the top of the region (before any barrier), e.g.
+//
+//   #pragma omp parallel
+//   {
+//     ThreadSpan span("adjacency");
+//   #pragma omp for nowait
+//     for(...)
+//   }
+//
+// so that it ends when the thread runs out of work. name must be a
+// string literal. Spans in nested parallel regions (e.g. a writer called
+// from write_partitioned_gmsh_files) are not recorded: their threads
+// all have thread number 0 and would share one event list.
+class ThreadSpan{
+public:
+  ThreadSpan(const char *name);
+  ~ThreadSpan();
+
+private:
+  const char *name;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif
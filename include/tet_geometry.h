@@ -0,0 +1,80 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef TET_GEOMETRY_H
+#define TET_GEOMETRY_H
+
+// Batched geometry kernels. Each kernel works on n consecutive elements
+// (tets) or facets and writes one result per entity. Internally the
+// coordinates are gathered into structure-of-arrays blocks of
+// GEOMETRY_BLOCK entities so that the arithmetic vectorises. The kernels
+// are serial; callers parallelise over blocks, e.g.
+//
+//   #pragma omp parallel for
+//   for(int b=0;b<NTetra;b+=GEOMETRY_BLOCK){
+//     double v[GEOMETRY_BLOCK];
+//     tet_volumes(xyz.data(), tets.data()+b*4, std::min(GEOMETRY_BLOCK, NTetra-b), v);
+//     ...
+//   }
+//
+// Masked elements (first node -1) are treated as having all their nodes
+// at the origin.
+
+const int GEOMETRY_BLOCK = 64;
+
+// Signed volume of each tetrahedron, volumes[i]. Same as volume().
+void tet_volumes(const double *xyz, const int *tets, int n, double *volumes);
+
+// Edge lengths of each tetrahedron, lengths[i*6+k], with edges ordered
+// (0,1), (0,2), (0,3), (1,2), (1,3), (2,3).
+void tet_edge_lengths(const double *xyz, const int *tets, int n, double *lengths);
+
+// Bounding box of each tetrahedron, bbox[i*6..i*6+5] = xmin, xmax, ymin,
+// ymax, zmin, zmax.
+void tet_bounding_boxes(const double *xyz, const int *tets, int n, double *bbox);
+
+// Centroid of each tetrahedron, centroids[i*3..i*3+2].
+void tet_centroids(const double *xyz, const int *tets, int n, double *centroids);
+
+// Centroid of each triangular facet, centroids[i*3..i*3+2].
+void facet_centroids(const double *xyz, const int *facets, int n, double *centroids);
+
+// Normal of each triangular facet, normals[i*3..i*3+2], following the
+// right hand rule. The length of the normal is the area of the facet.
+void facet_normals(const double *xyz, const int *facets, int n, double *normals);
+
+#endif
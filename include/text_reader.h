@@ -0,0 +1,94 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef TEXT_READER_H
+#define TEXT_READER_H
+
+#include <string>
+#include <vector>
+
+// Parse an integer or a double starting at p, skipping leading white
+// space. Neither allocates nor depends on the locale. Returns a pointer
+// just past the number, or NULL if there is no number before end.
+const char *parse_int(const char *p, const char *end, long &value);
+const char *parse_double(const char *p, const char *end, double &value);
+
+// Skip to the start of the next line; returns end if there is none.
+const char *next_line(const char *p, const char *end);
+
+// A read only memory map of a whole file.
+class MappedFile{
+public:
+  MappedFile(std::string filename);
+  ~MappedFile();
+
+  bool good() const;
+  const char *begin() const;
+  const char *end() const;
+  size_t size() const;
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+  const char *data;
+  size_t length;
+};
+
+// Find the start of any line of a text buffer without scanning it from
+// the beginning. Newlines are counted in parallel, in blocks of
+// LINE_BLOCK bytes, when the index is built; a lookup only scans the
+// block holding the line.
+class LineIndex{
+public:
+  LineIndex(const char *begin, const char *end);
+
+  // Number of lines, counting a last line without a newline.
+  size_t size() const;
+
+  // Start of line n (zero-based), or end if there are fewer lines.
+  const char *line(size_t n) const;
+
+private:
+  static const size_t LINE_BLOCK = 1<<20;
+
+  const char *first, *last;
+  // Number of newlines before each block.
+  std::vector<size_t> block_lines;
+};
+
+#endif
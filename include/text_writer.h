@@ -0,0 +1,123 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef TEXT_WRITER_H
+#define TEXT_WRITER_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "run_report.h"
+
+// Append an integer to buffer.
+void format_int(std::string &buffer, long value);
+
+// Append a double to buffer using the shortest representation (up to 17
+// significant digits) that reads back to exactly the same value.
+void format_double(std::string &buffer, double value);
+
+// Write text files with large sequential writes. Bulk data is written
+// as records (usually lines) which are formatted in parallel, in chunks
+// of RECORD_CHUNK records, into per-chunk buffers that are then written
+// out in order.
+class TextWriter{
+public:
+  TextWriter(std::string filename);
+  ~TextWriter();
+
+  bool good() const;
+
+  // Write text as is, e.g. a header.
+  void write(const std::string &text);
+
+  // Write records 0..n-1, where format(i, buffer) appends record i to
+  // buffer. format is called concurrently and must be thread safe.
+  template<typename F>
+  void write_records(size_t n, F format);
+
+  // Close the file; returns -1 if anything failed to be written.
+  int close();
+
+private:
+  static const size_t RECORD_CHUNK = 4096;
+
+  void write(const char *data, size_t size);
+
+  std::string filename;
+  int fd;
+  bool failed;
+};
+
+template<typename F>
+void TextWriter::write_records(size_t n, F format){
+  long nchunks = (n+RECORD_CHUNK-1)/RECORD_CHUNK;
+
+  // Format a few chunks per thread at a time to bound the memory used.
+  int nthreads = 1;
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  long round = 4*nthreads;
+  std::vector<std::string> buffers(std::min(round, nchunks));
+
+  for(long c0=0;c0<nchunks;c0+=round){
+    long c1 = std::min(nchunks, c0+round);
+
+#pragma omp parallel
+    {
+      ThreadSpan span("format records");
+#pragma omp for schedule(dynamic) nowait
+      for(long c=c0;c<c1;c++){
+        std::string &buffer = buffers[c-c0];
+        buffer.clear();
+        size_t end = std::min(n, (c+1)*RECORD_CHUNK);
+        for(size_t i=c*RECORD_CHUNK;i<end;i++)
+          format(i, buffer);
+      }
+    }
+
+    for(long c=c0;c<c1;c++)
+      write(buffers[c-c0].data(), buffers[c-c0].size());
+  }
+}
+
+#endif
@@ -47,11 +47,17 @@
 #include <string>
 #include <vector>
 
+// Write filename.vtu with the elements and filename_facets.vtu with the
+// facets, or, if combined is true, a single filename.vtu holding both.
+// The points are shared and passed to VTK without copying and the
+// cells are set up in bulk.
 int write_vtk_file(std::string filename,
                    std::vector<double> &xyz,
                    std::vector<int> &tets, 
                    std::vector<int> &facets,
-                   std::vector<int> &facet_ids);
+                   std::vector<int> &facet_ids,
+                   const std::vector<int> &colour=std::vector<int>(),
+                   bool combined=false);
 
 int write_triangle_file(std::string basename,
                         std::vector<double> &xyz,
@@ -59,10 +65,107 @@ int write_triangle_file(std::string basename,
                         std::vector<int> &facets,
                         std::vector<int> &facet_ids);
 
+// If colour is not empty it is written as the second (elementary
+// entity) tag of each tetrahedron.
 int write_gmsh_file(std::string basename,
 		    std::vector<double> &xyz,
 		    std::vector<int> &tets, 
 		    std::vector<int> &facets,
-		    std::vector<int> &facet_ids);
+		    std::vector<int> &facet_ids,
+		    const std::vector<int> &colour=std::vector<int>());
+
+// Write the mesh as binary GMSH (MSH 2.2, native byte order). The
+// section sizes are known up front so the file is presized, memory
+// mapped and the node and element blocks are filled in parallel.
+int write_gmsh_binary_file(std::string basename,
+                           const std::vector<double> &xyz,
+                           const std::vector<int> &tets,
+                           const std::vector<int> &facets,
+                           const std::vector<int> &facet_ids,
+                           const std::vector<int> &colour=std::vector<int>());
+
+// Write a mesh trimmed by trim_domain() as GMSH without compacting it:
+// nodes are streamed from xyz through renumbering, masked elements are
+// skipped and the rest numbered in order, so the file is the same as for
+// the compacted mesh.
+int write_trimmed_gmsh_file(std::string basename,
+                            const std::vector<double> &xyz,
+                            const std::vector<int> &tets,
+                            const std::vector<int> &renumbering,
+                            const std::vector<int> &facets,
+                            const std::vector<int> &facet_ids,
+                            bool binary=false);
+
+// As above, for one phase of a dual-phase mesh (see trim_phases): the
+// elements written are those for which keep is set.
+int write_trimmed_gmsh_file(std::string basename,
+                            const std::vector<double> &xyz,
+                            const std::vector<int> &tets,
+                            const std::vector<char> &keep,
+                            const std::vector<int> &renumbering,
+                            const std::vector<int> &facets,
+                            const std::vector<int> &facet_ids,
+                            bool binary=false);
+
+// Write the facets shared by the two phases of a dual-phase mesh to
+// basename_interface.txt: the number of facets, then one facet per line
+// as its three nodes in the phase 1 mesh followed by the same three nodes
+// in the phase 2 mesh (GMSH numbering, from 1).
+int write_interface_file(std::string basename,
+                         const std::vector<int> &interface,
+                         const std::vector<int> renumbering[2]);
+
+// Write the mesh as XDMF with the data in HDF5 (basename.h5):
+// basename.xdmf holds the mesh and basename_facets.xdmf the facets with
+// their ids as the "facet_tags" attribute. This is the layout DOLFIN
+// and DOLFINx read in parallel. The datasets are chunked and, if
+// compression is between 1 and 9, gzip compressed at that level.
+// Requires HDF5 (HAVE_HDF5).
+int write_xdmf_file(std::string basename,
+                    const std::vector<double> &xyz,
+                    const std::vector<int> &tets,
+                    const std::vector<int> &facets,
+                    const std::vector<int> &facet_ids,
+                    int compression=0);
+
+// Native binary mesh format (.pfm), meant to be memory mapped. A 128
+// byte header is followed by the xyz, tets, facets and facet_ids arrays,
+// each starting on a 64 byte boundary. All values are little endian:
+//
+//   offset  type      field
+//   0       char[8]   magic "PFMESH\0\0"
+//   8       uint32    version (1)
+//   12      uint32    0x01020304, to check the byte order
+//   16      int64     number of nodes
+//   24      int64     number of elements
+//   32      int64     number of facets
+//   40      float64   image resolution, -1 if unknown
+//   48      char[4]   dtype of xyz, "<f8"
+//   52      char[4]   dtype of tets, facets and facet_ids, "<i4"
+//   56      uint64    offset of xyz (nodes x 3)
+//   64      uint64    offset of tets (elements x 4)
+//   72      uint64    offset of facets (facets x 3)
+//   80      uint64    offset of facet_ids (facets)
+//   88      -         reserved, zero
+//
+// Node numbers are zero-based. Masked elements are not written.
+// See read_binary_mesh_file() and python/poreflow_mesh.py for readers.
+const int PFM_HEADER_SIZE = 128;
+const int PFM_ALIGNMENT = 64;
+
+int write_binary_mesh_file(std::string filename,
+                           const std::vector<double> &xyz,
+                           const std::vector<int> &tets,
+                           const std::vector<int> &facets,
+                           const std::vector<int> &facet_ids,
+                           double resolution=-1.0);
+
+// Write the colour->elements table (see create_colour_table) to
+// basename.colour. The first line holds the number of colours and
+// elements, followed by a line of offsets and a line of zero-based
+// element numbers.
+int write_colour_file(std::string basename,
+                      const std::vector<int> &offsets,
+                      const std::vector<int> &elements);
 
 #endif
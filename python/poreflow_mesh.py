@@ -0,0 +1,54 @@
+#!/usr/bin/python
+# Load a poreflow native binary mesh (.pfm) as numpy arrays. The arrays
+# are memory maps of the file, so nothing is read until it is used.
+#
+#   import poreflow_mesh
+#   mesh = poreflow_mesh.load("Berea.pfm")
+#   mesh.xyz, mesh.tets, mesh.facets, mesh.facet_ids, mesh.resolution
+#
+# The layout is documented in include/writers.h.
+import collections
+import sys
+
+import numpy
+
+HEADER = numpy.dtype([('magic', 'S8'),
+                      ('version', '<u4'),
+                      ('byte_order', '<u4'),
+                      ('nnodes', '<i8'),
+                      ('ntets', '<i8'),
+                      ('nfacets', '<i8'),
+                      ('resolution', '<f8'),
+                      ('real_type', 'S4'),
+                      ('index_type', 'S4'),
+                      ('xyz_offset', '<u8'),
+                      ('tets_offset', '<u8'),
+                      ('facets_offset', '<u8'),
+                      ('facet_ids_offset', '<u8'),
+                      ('reserved', 'V40')])
+
+Mesh = collections.namedtuple('Mesh', ['xyz', 'tets', 'facets', 'facet_ids', 'resolution'])
+
+def _array(filename, mode, dtype, offset, shape):
+	# numpy.memmap refuses zero length maps.
+	if shape[0] == 0:
+		return numpy.zeros(shape, dtype=dtype)
+	return numpy.memmap(filename, dtype=dtype, mode=mode, offset=int(offset), shape=shape)
+
+def load(filename, mode='r'):
+	header = numpy.fromfile(filename, dtype=HEADER, count=1)
+	if len(header) != 1 or header['magic'][0] != b'PFMESH' or header['version'][0] != 1 or header['byte_order'][0] != 0x01020304:
+		raise IOError("%s is not a native binary mesh file" % filename)
+	header = header[0]
+
+	real_type = numpy.dtype(header['real_type'].decode().rstrip('\0'))
+	index_type = numpy.dtype(header['index_type'].decode().rstrip('\0'))
+	return Mesh(_array(filename, mode, real_type, header['xyz_offset'], (int(header['nnodes']), 3)),
+	            _array(filename, mode, index_type, header['tets_offset'], (int(header['ntets']), 4)),
+	            _array(filename, mode, index_type, header['facets_offset'], (int(header['nfacets']), 3)),
+	            _array(filename, mode, index_type, header['facet_ids_offset'], (int(header['nfacets']),)),
+	            float(header['resolution']))
+
+if __name__ == "__main__":
+	mesh = load(sys.argv[1])
+	print("%d nodes, %d elements, %d facets, resolution %g" % (len(mesh.xyz), len(mesh.tets), len(mesh.facets), mesh.resolution))
@@ -0,0 +1,211 @@
+#!/usr/bin/python
+# Strong and weak scaling of the poreflow pipeline (read, segment, prune,
+# mesh, trim and write) over OpenMP threads, on synthetic hourglass
+# images written by create_hourglass. Every run of poreflow writes a
+# report (-J) and the wall time of each stage is taken from it.
+#
+#   python poreflow_scaling.py -b build/bin -s 64,128,256 -t 1,2,4,8
+#
+# writes scaling.csv (one row per run and stage) and scaling.txt, the
+# efficiency of each top level stage:
+#
+#   strong: T(size, 1)/(p*T(size, p)) for each image size,
+#   weak:   T(base, 1)/T(base*p^(1/3), p), i.e. the same number of voxels
+#           per thread.
+#
+# If the thread counts do not include 1 the smallest is used instead.
+# This is also what "make scaling" runs.
+import collections
+import getopt
+import json
+import multiprocessing
+import os
+import subprocess
+import sys
+
+def usage():
+	print(sys.argv[0]+""" [options]
+    options:
+      -h            Prints this help message.
+      -b directory  Directory holding the poreflow and create_hourglass executables (default: search PATH).
+      -s sizes      Comma separated image sizes for strong scaling (default 64,128,256,512,1024).
+      -t threads    Comma separated thread counts (default 1, 2, 4, ... up to the number of cores).
+      -w size       Image size at one thread for weak scaling (default the smallest of -s, 0 to skip).
+      -d directory  Where the images and meshes are written while running (default .).
+      -o name       Basename of the CSV and summary files (default scaling).
+      -a options    Extra options for poreflow, e.g. "-b -r rcm".
+      -k            Keep the images.""")
+
+def default_threads():
+	ncores = multiprocessing.cpu_count()
+	threads = [1]
+	while threads[-1]*2 <= ncores:
+		threads.append(threads[-1]*2)
+	if threads[-1] != ncores:
+		threads.append(ncores)
+	return threads
+
+def executable(directory, name):
+	if directory is None:
+		return name
+	return os.path.join(directory, name)
+
+def run(command, threads=None):
+	env = dict(os.environ)
+	if threads is not None:
+		env['OMP_NUM_THREADS'] = str(threads)
+	if subprocess.call(command, env=env) != 0:
+		raise RuntimeError("failed: " + " ".join(command))
+
+# Write a size^3 hourglass image; create_hourglass pads its width by a
+# voxel on each side.
+def create_image(bindir, workdir, size):
+	basename = os.path.join(workdir, "scaling_image_%d" % size)
+	run([executable(bindir, "create_hourglass"), "-s", str(size-2), "-t", str(max(size//5, 1)), "-c", "nhdr", "-o", basename])
+	return basename
+
+def remove_image(basename):
+	for extension in (".nhdr", ".raw"):
+		if os.path.exists(basename+extension):
+			os.remove(basename+extension)
+
+# Run the pipeline and return the stages in its report as a list of
+# (name, depth, seconds, peak_rss_kb), with the whole run as "total".
+def run_pipeline(bindir, workdir, image, threads, options):
+	output = os.path.join(workdir, "scaling_mesh")
+	report = os.path.join(workdir, "scaling_report.json")
+	run([executable(bindir, "poreflow"), "-o", output, "-J", report] + options + [image+".raw"], threads)
+
+	with open(report) as f:
+		data = json.load(f)
+	os.remove(report)
+	for name in os.listdir(workdir):
+		if name.startswith("scaling_mesh"):
+			os.remove(os.path.join(workdir, name))
+
+	stages = [(stage['name'], stage['depth'], stage['seconds'], stage['peak_rss_kb']) for stage in data['stages']]
+	stages.append(("total", 0, data['wall_time'], data['peak_rss_kb']))
+	return stages
+
+# Seconds spent in each top level stage, summing repeated stages.
+def stage_times(stages):
+	times = collections.OrderedDict()
+	for name, depth, seconds, peak_rss_kb in stages:
+		if depth == 0:
+			times[name] = times.get(name, 0.0) + seconds
+	return times
+
+def efficiency_table(title, threads, times, efficiency):
+	lines = [title, "%-24s" % "stage" + "".join("%8d" % p for p in threads)]
+	names = []
+	for p in threads:
+		for name in times[p]:
+			if name not in names:
+				names.append(name)
+	for name in names:
+		row = "%-24s" % name
+		for p in threads:
+			value = efficiency(name, p)
+			row += "%8s" % ("-" if value is None else "%.2f" % value)
+		lines.append(row)
+	return "\n".join(lines) + "\n"
+
+def main():
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], "hb:s:t:w:d:o:a:k")
+	except getopt.GetoptError as error:
+		print(str(error))
+		usage()
+		sys.exit(-1)
+
+	bindir = None
+	sizes = [64, 128, 256, 512, 1024]
+	threads = default_threads()
+	weak_base = None
+	workdir = "."
+	basename = "scaling"
+	options = []
+	keep = False
+	for opt, arg in opts:
+		if opt == '-h':
+			usage()
+			sys.exit(0)
+		elif opt == '-b':
+			bindir = arg
+		elif opt == '-s':
+			sizes = [int(s) for s in arg.replace(';', ',').split(',') if s]
+		elif opt == '-t':
+			threads = [int(t) for t in arg.replace(';', ',').split(',') if t]
+		elif opt == '-w':
+			weak_base = int(arg)
+		elif opt == '-d':
+			workdir = arg
+		elif opt == '-o':
+			basename = arg
+		elif opt == '-a':
+			options = arg.split()
+		elif opt == '-k':
+			keep = True
+
+	threads = sorted(set(threads))
+	if weak_base is None:
+		weak_base = min(sizes)
+	if not os.path.isdir(workdir):
+		os.makedirs(workdir)
+
+	csv = open(basename+".csv", "w")
+	csv.write("study,size,voxels,threads,stage,depth,seconds,peak_rss_kb\n")
+
+	def record(study, size, p, stages):
+		for name, depth, seconds, peak_rss_kb in stages:
+			csv.write("%s,%d,%d,%d,%s,%d,%g,%d\n" % (study, size, size**3, p, name, depth, seconds, peak_rss_kb))
+		csv.flush()
+
+	summary = ""
+	p0 = threads[0]
+
+	# Strong scaling: each image at every thread count.
+	for size in sizes:
+		image = create_image(bindir, workdir, size)
+		times = {}
+		for p in threads:
+			print("INFO: strong scaling, %d^3 voxels, %d threads" % (size, p))
+			stages = run_pipeline(bindir, workdir, image, p, options)
+			record("strong", size, p, stages)
+			times[p] = stage_times(stages)
+		if not keep:
+			remove_image(image)
+
+		def strong(name, p):
+			if name not in times[p] or name not in times[p0] or times[p][name] <= 0.0:
+				return None
+			return times[p0][name]*p0/(p*times[p][name])
+		summary += efficiency_table("Strong scaling efficiency, %d^3 voxels" % size, threads, times, strong) + "\n"
+
+	# Weak scaling: the same number of voxels per thread.
+	if weak_base > 0:
+		times = {}
+		for p in threads:
+			size = int(round(weak_base*(float(p)/p0)**(1.0/3.0)))
+			image = create_image(bindir, workdir, size)
+			print("INFO: weak scaling, %d^3 voxels, %d threads" % (size, p))
+			stages = run_pipeline(bindir, workdir, image, p, options)
+			record("weak", size, p, stages)
+			times[p] = stage_times(stages)
+			if not keep:
+				remove_image(image)
+
+		def weak(name, p):
+			if name not in times[p] or name not in times[p0] or times[p][name] <= 0.0:
+				return None
+			return times[p0][name]/times[p][name]
+		summary += efficiency_table("Weak scaling efficiency, %d^3 voxels per %d thread(s)" % (weak_base, p0), threads, times, weak)
+
+	csv.close()
+
+	with open(basename+".txt", "w") as f:
+		f.write(summary)
+	print(summary)
+
+if __name__ == "__main__":
+	main()
@@ -12,7 +12,7 @@ import getopt
 import sys
 
 def usage():
-  print sys.argv[0]+""" [options] dolfin_mesh.xml
+  print sys.argv[0]+""" [options] dolfin_mesh.xml|dolfin_mesh.xdmf
     options:
       -a [xyz] Specifies the axis along which to apply the pressure gradient. By default it is applied along the x-axis.
       -h    Prints this help message.
@@ -116,7 +116,12 @@ parameters["std_out_all_processes"] = False
 args = fieldsplit_args
 parameters.parse(args)
 
-mesh = Mesh(filename)
+if filename.endswith(".xdmf"):
+  # Written by tarantula2gmsh/vtk2gmsh -H; read in parallel.
+  mesh = Mesh()
+  XDMFFile(mpi_comm_world(), filename).read(mesh)
+else:
+  mesh = Mesh(filename)
 
 n = FacetNormal(mesh)
 
@@ -151,7 +156,12 @@ elif element_pair == 4:
   Z = (P1+B)*Q
 
 # Boundary
-boundaries = MeshFunction('size_t', mesh, filename[0:-4] + "_facet_region.xml")
+if filename.endswith(".xdmf"):
+  mvc = MeshValueCollection('size_t', mesh, 2)
+  XDMFFile(mpi_comm_world(), filename[0:-5] + "_facets.xdmf").read(mvc, "facet_tags")
+  boundaries = MeshFunction('size_t', mesh, mvc)
+else:
+  boundaries = MeshFunction('size_t', mesh, filename[0:-4] + "_facet_region.xml")
 
 ds = Measure('ds')[boundaries]
 
@@ -9,7 +9,7 @@ import sys
 import os.path
 
 def usage():
-  print sys.argv[0]+""" [options] dolfin_mesh.xml
+  print sys.argv[0]+""" [options] dolfin_mesh.xml|dolfin_mesh.xdmf
     options:
       -h    Prints this help message.
       -d    Enable debugging mode.
@@ -54,7 +54,12 @@ axis = 0
 bc_in = 1
 bc_out = 2
 
-mesh = Mesh(filename)
+if filename.endswith(".xdmf"):
+  # Written by tarantula2gmsh/vtk2gmsh -H; read in parallel.
+  mesh = Mesh()
+  XDMFFile(mpi_comm_world(), filename).read(mesh)
+else:
+  mesh = Mesh(filename)
 
 n = FacetNormal(mesh)
 
@@ -89,7 +94,12 @@ elif element_pair == 4:
   W = (P1+B)*Q
 
 # Boundary
-boundaries = MeshFunction('size_t', mesh, filename[0:-4] + "_facet_region.xml")
+if filename.endswith(".xdmf"):
+  mvc = MeshValueCollection('size_t', mesh, 2)
+  XDMFFile(mpi_comm_world(), filename[0:-5] + "_facets.xdmf").read(mvc, "facet_tags")
+  boundaries = MeshFunction('size_t', mesh, mvc)
+else:
+  boundaries = MeshFunction('size_t', mesh, filename[0:-4] + "_facet_region.xml")
 
 ds = Measure('ds')[boundaries]
 
@@ -59,6 +59,13 @@
 #include <cstdlib>
 
 #include "CTImage.h"
+#include "writers.h"
+#include "text_writer.h"
+#include "mesh_reorder.h"
+#include "mesh_refine.h"
+#include "tet_geometry.h"
+#include "mesh_statistics.h"
+#include "run_report.h"
 
 // To avoid verbose function and named parameters call
 using namespace CGAL::parameters;
@@ -68,6 +75,7 @@ CTImage::CTImage(){
   for(int i=0;i<3;i++)
     dims[i] = -1;
   resolution=1.0;
+  threshold=1;
   image = NULL;
   raw_image = NULL;
   domain = NULL;
@@ -115,7 +123,29 @@ size_t CTImage::get_NFacets(){
   return NFacets;
 }
 
+std::vector<double> &CTImage::get_xyz(){
+  return xyz;
+}
+
+std::vector<int> &CTImage::get_tets(){
+  return tets;
+}
+
+std::vector<int> &CTImage::get_facets(){
+  return facets;
+}
+
+std::vector<int> &CTImage::get_facet_ids(){
+  return facet_ids;
+}
+
+double CTImage::get_resolution(){
+  return resolution;
+}
+
 int CTImage::read(std::string filename, const int offsets[], int slab_size){
+  ScopedStage stage("read");
+
   if(verbose)
     std::cout<<"int CTImage::read(std::string filename, int slab_size)"<<std::endl;
   
@@ -259,7 +289,7 @@ int CTImage::read_raw(std::string filename, const int offsets[], int slab_size){
   
   std::ifstream image_file;
   image_file.open(filename, std::ios::binary);
-  image_file>>raw_image;
+  image_file.read((char *)raw_image, image_size);
   image_file.close();
   
   if(slab_size>0){
@@ -282,13 +312,14 @@ int CTImage::read_raw(std::string filename, const int offsets[], int slab_size){
     image_size = image_size_new;
   }
   
-  for(int i=0;i<image_size;i++)
-    raw_image[i] = raw_image[i]?0:1;
+  segment();
 
   return image_size;
 }
 
 int CTImage::create_hourglass(int size, int throat_width){
+  ScopedStage stage("hourglass");
+
   for(int i=0;i<3;i++)
     dims[i] = size+2;
   
@@ -319,10 +350,86 @@ int CTImage::create_hourglass(int size, int throat_width){
   return 0;
 }
 
+void CTImage::set_threshold(int _threshold){
+  threshold = _threshold;
+}
+
+void CTImage::segment(){
+  if(verbose)
+    std::cout<<"void segment()"<<std::endl;
+
+  ScopedStage stage("segment");
+  stage.set_count(image_size);
+
+#pragma omp parallel
+  {
+    ThreadSpan span("segment");
+#pragma omp for nowait
+    for(int i=0;i<image_size;i++)
+      raw_image[i] = raw_image[i]<threshold?1:0;
+  }
+}
+
+int CTImage::prune(int axis){
+  if(verbose)
+    std::cout<<"int prune(int axis)"<<std::endl;
+
+  ScopedStage stage("prune");
+  stage.set_count(image_size);
+
+  // x varies fastest in the image.
+  int stride[] = {1, dims[0], dims[0]*dims[1]};
+
+  // Flood fill the pore space from the lower face (label 1), and then
+  // from the upper face through the voxels already reached (label 2).
+  std::vector<unsigned char> label(image_size, 0);
+  std::vector<int> front;
+  for(int pass=1;pass<=2;pass++){
+    int layer = pass==1?0:dims[axis]-1;
+    for(int i=0;i<image_size;i++){
+      if((i/stride[axis])%dims[axis]==layer && raw_image[i] && label[i]==pass-1){
+        label[i] = pass;
+        front.push_back(i);
+      }
+    }
+
+    while(!front.empty()){
+      int v = front.back();
+      front.pop_back();
+      for(int d=0;d<3;d++){
+        int c = (v/stride[d])%dims[d];
+        if(c>0 && raw_image[v-stride[d]] && label[v-stride[d]]==pass-1){
+          label[v-stride[d]] = pass;
+          front.push_back(v-stride[d]);
+        }
+        if(c<dims[d]-1 && raw_image[v+stride[d]] && label[v+stride[d]]==pass-1){
+          label[v+stride[d]] = pass;
+          front.push_back(v+stride[d]);
+        }
+      }
+    }
+  }
+
+  int removed=0;
+  for(int i=0;i<image_size;i++){
+    if(raw_image[i] && label[i]!=2){
+      raw_image[i] = 0;
+      removed++;
+    }
+  }
+  if(verbose)
+    std::cout<<"Pruned "<<removed<<" isolated pore voxels"<<std::endl;
+
+  return removed;
+}
+
 void CTImage::mesh(){
   if(verbose)
     std::cout<<"void mesh()\n";
 
+  ScopedStage stage("mesh");
+  stage.set_count(image_size);
+
   // Create CGAL Image
   double spacing[] = {1,1,1};
   image = new CGAL::Image_3(_createImage(dims[0], dims[1], dims[2], 1,
@@ -346,22 +453,28 @@ void CTImage::mesh(){
   //Mesh_criteria criteria(facet_angle=30, facet_size=0.1, facet_distance=0.025,
   //                       cell_radius_edge_ratio=2, cell_size=5);
 
-  // Mesh generation and optimization in one call
+  // Mesh generation and optimization in several calls so that they can
+  // be timed separately. This is the sequence make_mesh_3 runs for
+  // lloyd(time_limit=60), exude(time_limit=60, sliver_bound=10).
+  ScopedStage generate_stage("generate");
   C3t3 c3t3 = CGAL::make_mesh_3<C3t3>(*domain, criteria,
-      lloyd(time_limit=60),
-      // odt(time_limit=60),
-      exude(time_limit=60, sliver_bound=10));
+      no_perturb(), no_exude());
+  generate_stage.stop();
 
-  // C3t3 c3t3 = CGAL::make_mesh_3<C3t3>(*domain, criteria);
+  ScopedStage optimise_stage("optimise");
+  CGAL::lloyd_optimize_mesh_3(c3t3, *domain, time_limit=60);
+  // CGAL::odt_optimize_mesh_3(c3t3, *domain, time_limit=60);
+  CGAL::perturb_mesh_3(c3t3, *domain);
+  CGAL::exude_mesh_3(c3t3, sliver_bound=10, time_limit=60);
+  optimise_stage.stop();
 
-  // Mesh generation and optimization in several call
-  // C3t3 c3t3 = CGAL::make_mesh_3<C3t3>(domain, criteria,
-  //                                     no_perturb(), no_exude());
+  // C3t3 c3t3 = CGAL::make_mesh_3<C3t3>(*domain, criteria);
 
   // Output
   //
 
   // Export points
+  ScopedStage extract_stage("extract");
   Tr t = c3t3.triangulation();  // get triangulation (needed below)
 
   size_t index = 0;
@@ -381,7 +494,10 @@ void CTImage::mesh(){
     tets.push_back(coordToId[it->vertex(3)->point()]);
   }
 
+  extract_stage.stop();
+
   // Find boundary facets
+  ScopedStage adjacency_stage("adjacency");
   size_t NNodes = get_NNodes();
   std::vector< std::set<int> > NEList(NNodes);
 
@@ -409,6 +525,9 @@ void CTImage::mesh(){
       }
     }
   }
+  adjacency_stage.stop();
+
+  ScopedStage facets_stage("facets");
   for(int i=0;i<NElements;i++){
     if(EEList[i*4]==-1){
       facets.push_back(tets[i*4+1]);
@@ -473,9 +592,22 @@ void CTImage::trim_channels(int in_boundary, int out_boundary){
   if(verbose)
     std::cout<<"void trim_channels(int in_boundary, int out_boundary)"<<std::endl;
 
+  ScopedStage stage("trim");
+
   // Create node-element adjancy list - delete invested elements as we go.
+  ScopedStage adjacency_stage("adjacency");
   size_t NNodes = get_NNodes();
   size_t NElements = get_NElements();
+  stage.set_count(NElements);
+
+  std::vector<double> v(NElements);
+#pragma omp parallel
+  {
+    ThreadSpan span("volumes");
+#pragma omp for nowait
+    for(int b=0;b<(int)NElements;b+=GEOMETRY_BLOCK)
+      tet_volumes(xyz.data(), tets.data()+b*4, std::min(GEOMETRY_BLOCK, (int)NElements-b), v.data()+b);
+  }
 
   std::vector< std::set<int> > NEList(NNodes);
   int count_positive=0, count_negative=0;
@@ -483,8 +615,7 @@ void CTImage::trim_channels(int in_boundary, int out_boundary){
     if(tets[i*4]==-1)
       continue;
 
-    double v = volume(&xyz[3*tets[i*4]], &xyz[3*tets[i*4+1]], &xyz[3*tets[i*4+2]], &xyz[3*tets[i*4+3]]);
-    if(v<0){
+    if(v[i]<0){
       tets[i*4] = -1;
       count_negative++;
       continue;
@@ -531,8 +662,11 @@ void CTImage::trim_channels(int in_boundary, int out_boundary){
     }
   }
 
+  adjacency_stage.stop();
+
   // Create full facet ID list. Also, create the initial fronts for
   // the active region detection.
+  ScopedStage sweep_stage("sweep");
   std::map< std::set<int>, int> facet_id_lut;
   int NFacets = facet_ids.size();
   for(int i=0;i<NFacets;i++){
@@ -618,7 +752,10 @@ void CTImage::trim_channels(int in_boundary, int out_boundary){
     }
   }
 
+  sweep_stage.stop();
+
   // Find active vertex set and create renumbering.
+  ScopedStage renumber_stage("renumber");
   std::map<int, int> renumbering;
   for(int i=0;i<NElements;i++){
     if(tets[i*4]==-1)
@@ -682,11 +819,35 @@ void CTImage::trim_channels(int in_boundary, int out_boundary){
   facet_ids.swap(facet_ids_new);
 }
 
+void CTImage::refine(int levels){
+  if(verbose)
+    std::cout<<"void refine(int levels)"<<std::endl;
+
+  for(int i=0;i<levels;i++)
+    refine_mesh(xyz, tets, facets, facet_ids);
+}
+
+int CTImage::reorder(std::string method){
+  if(verbose)
+    std::cout<<"int reorder(std::string method)"<<std::endl;
+
+  int bandwidth = mesh_bandwidth(tets);
+  if(reorder_mesh(method, xyz, tets, facets, facet_ids)<0)
+    return -1;
+
+  if(verbose)
+    std::cout<<"Mesh bandwidth before and after reordering = "<<bandwidth<<", "<<mesh_bandwidth(tets)<<std::endl;
+
+  return 0;
+}
+
 // Write INR file.
 void CTImage::write_inr(const char *filename){
   if(verbose)
     std::cout<<"void write_inr()"<<std::endl;
 
+  ScopedStage stage("write_inr");
+
   if(filename==NULL)
     _writeImage(image->image(), std::string(basename+".inr").c_str()); 
   else
@@ -698,6 +859,8 @@ void CTImage::write_nhdr(const char *filename){
   if(verbose)
     std::cout<<"void write_nhdr()"<<std::endl;
 
+  ScopedStage stage("write_nhdr");
+
   std::ofstream file;
   if(filename==NULL)
     file.open(std::string(basename+".nhdr").c_str());
@@ -734,152 +897,82 @@ void CTImage::write_vox(const char *filename){
   if(verbose)
     std::cout<<"void write_vox()"<<std::endl;
 
-  std::ofstream file;
-  if(filename==NULL)
-    file.open(std::string(basename+".vox").c_str());
-  else
-    file.open(filename);
+  ScopedStage stage("write_vox");
 
-  file<<dims[0]<<" "<<dims[1]<<" "<<dims[2]<<std::endl;
-  file<<resolution<<" "<<resolution<<" "<<resolution<<std::endl;
+  TextWriter file(filename==NULL?basename+".vox":std::string(filename));
 
-  for(size_t i=0;i<image_size;i++)
-    file<<(int)raw_image[i]<<" ";
-  file<<std::endl;
+  std::string header;
+  for(int i=0;i<3;i++){
+    format_int(header, dims[i]);
+    header.push_back(i<2?' ':'\n');
+  }
+  for(int i=0;i<3;i++){
+    format_double(header, resolution);
+    header.push_back(i<2?' ':'\n');
+  }
+  file.write(header);
+
+  file.write_records(image_size, [&](size_t i, std::string &buffer){
+      format_int(buffer, raw_image[i]);
+      buffer.push_back(' ');
+    });
+  file.write("\n");
   file.close();
 }
 
 // Write VTK unstructured grid file (*.vtu)
-void CTImage::write_vtu(const char *filename){
+void CTImage::write_vtu(const char *filename, bool combined){
   if(verbose)
     std::cout<<"void write_vtu(const char *filename)"<<std::endl;
 
-  std::ofstream file;
-  if(filename==NULL)
-    file.open(std::string(basename+".vtu").c_str());
-  else
-    file.open(filename);
+  std::string name = filename==NULL?basename:std::string(filename);
+  if(name.size()>4 && name.substr(name.size()-4)==".vtu")
+    name = name.substr(0, name.size()-4);
 
-  // Initalise the vtk mesh
-  vtkSmartPointer<vtkUnstructuredGrid> ug_tets = vtkSmartPointer<vtkUnstructuredGrid>::New();
+  write_vtk_file(name, xyz, tets, facets, facet_ids, std::vector<int>(), combined);
+}
 
-  // Write out points
-  size_t NNodes = get_NNodes();
-  vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
-  pts->SetNumberOfPoints(NNodes);
-  for(int i=0;i<NNodes;i++){
-    pts->SetPoint(i, &(xyz[i*3]));
-  }
-  ug_tets->SetPoints(pts);
+int CTImage::write_gmsh(const char *filename, bool binary){
+  if(verbose)
+    std::cout<<"int write_gmsh()"<<std::endl;
 
-  size_t NElements = get_NElements();
-  for(int i=0;i<NElements;i++){
-    vtkSmartPointer<vtkIdList> idlist = vtkSmartPointer<vtkIdList>::New();
-    for(int j=0;j<4;j++)
-      idlist->InsertNextId(tets[i*4+j]);
-    ug_tets->InsertNextCell(10, idlist);
-  }
+  std::string name = filename==NULL?basename:std::string(filename);
+  if(name.size()>4 && name.substr(name.size()-4)==".msh")
+    name = name.substr(0, name.size()-4);
 
-  vtkSmartPointer<vtkXMLUnstructuredGridWriter> tet_writer = vtkSmartPointer<vtkXMLUnstructuredGridWriter>::New();
-  if(filename==NULL)
-    tet_writer->SetFileName(std::string(basename+".vtu").c_str());
+  if(binary)
+    return write_gmsh_binary_file(name, xyz, tets, facets, facet_ids);
   else
-    tet_writer->SetFileName(filename);
-#if VTK_MAJOR_VERSION < 6
-  tet_writer->SetInput(ug_tets);
-#else
-  tet_writer->SetInputData(ug_tets);
-#endif
-  tet_writer->Write();
+    return write_gmsh_file(name, xyz, tets, facets, facet_ids);
+}
 
-  // Initalise the vtk mesh
-  vtkSmartPointer<vtkUnstructuredGrid> ug_tris = vtkSmartPointer<vtkUnstructuredGrid>::New();
-  ug_tris->SetPoints(pts);
+int CTImage::write_xdmf(const char *filename, int compression){
+  if(verbose)
+    std::cout<<"int write_xdmf()"<<std::endl;
 
-  // Write facet
-  size_t NFacets = get_NFacets();
-  for(int i=0;i<NFacets;i++){
-    vtkSmartPointer<vtkIdList> idlist = vtkSmartPointer<vtkIdList>::New();
-    for(int j=0;j<3;j++)
-      idlist->InsertNextId(facets[i*3+j]);
-    ug_tris->InsertNextCell(5, idlist);
-  }
+  std::string name = filename==NULL?basename:std::string(filename);
+  if(name.size()>5 && name.substr(name.size()-5)==".xdmf")
+    name = name.substr(0, name.size()-5);
 
-  // Write facet_ids
-  vtkSmartPointer<vtkIntArray> vtk_facet_ids = vtkSmartPointer<vtkIntArray>::New();
-  vtk_facet_ids->SetName("Boundary label");
-  vtk_facet_ids->SetNumberOfComponents(1);
-  vtk_facet_ids->SetNumberOfTuples(NFacets);
-  for(int i=0;i<NFacets;i++)
-    vtk_facet_ids->SetValue(i, facet_ids[i]);
-  ug_tris->GetCellData()->AddArray(vtk_facet_ids);
+  return write_xdmf_file(name, xyz, tets, facets, facet_ids, compression);
+}
 
-  vtkSmartPointer<vtkXMLUnstructuredGridWriter> tri_writer = vtkSmartPointer<vtkXMLUnstructuredGridWriter>::New();
-  if(filename==NULL)
-    tri_writer->SetFileName(std::string(basename+"_facets.vtu").c_str());
-  else
-    tri_writer->SetFileName((std::string(filename, strlen(filename)-4)+"_facets.vtu").c_str());
-#if VTK_MAJOR_VERSION < 6
-  tri_writer->SetInput(ug_tris);
-#else
-  tri_writer->SetInputData(ug_tris);
-#endif
-  tri_writer->Write();
+int CTImage::write_native(const char *filename){
+  if(verbose)
+    std::cout<<"int write_native()"<<std::endl;
 
+  return write_binary_mesh_file(filename==NULL?basename+".pfm":std::string(filename), xyz, tets, facets, facet_ids, resolution);
 }
 
-int CTImage::write_gmsh(const char *filename){
+int CTImage::write_statistics(const char *filename){
   if(verbose)
-    std::cout<<"int write_gmsh()"<<std::endl;
+    std::cout<<"int write_statistics()"<<std::endl;
 
-  int NNodes = get_NNodes();
-  int NElements = get_NElements();
-  int NFacets = get_NFacets();
+  MeshStatistics stats;
+  mesh_statistics(xyz, tets, facets, facet_ids, raw_image==NULL?-1.0:get_porosity(), stats);
 
-  ofstream file;
   if(filename==NULL)
-    file.open(std::string(basename+".msh").c_str());
+    return write_statistics_file(basename+"_stats.json", stats);
   else
-    file.open(filename);
-
-  file<<"$MeshFormat"<<std::endl
-    <<"2.2 0 8"<<std::endl
-    <<"$EndMeshFormat"<<std::endl
-    <<"$Nodes"<<std::endl
-    <<NNodes<<std::endl;
-  file<<std::setprecision(std::numeric_limits<double>::digits10+1);
-  for(size_t i=0;i<NNodes;i++){
-    file<<i+1<<" "<<xyz[i*3]<<" "<<xyz[i*3+1]<<" "<<xyz[i*3+2]<<std::endl;
-  }
-  file<<"$EndNodes"<<std::endl
-    <<"$Elements"<<std::endl
-    <<NElements+NFacets<<std::endl;
-  for(size_t i=0;i<NElements;i++){
-    file<<i+1<<" 4 1 1 "<<tets[i*4]+1<<" "<<tets[i*4+1]+1<<" "<<tets[i*4+2]+1<<" "<<tets[i*4+3]+1<<std::endl;
-  }
-  for(size_t i=0;i<NFacets;i++){
-    file<<i+NElements+1<<" 2 1 "<<facet_ids[i]<<" "<<facets[i*3]+1<<" "<<facets[i*3+1]+1<<" "<<facets[i*3+2]+1<<std::endl;
-  }
-  file<<"$EndElements"<<std::endl;
-  file.close();
-
-  return 0;
+    return write_statistics_file(filename, stats);
 }
-
-double CTImage::volume(const double *x0, const double *x1, const double *x2, const double *x3) const{
-
-  double x01 = (x0[0] - x1[0]);
-  double x02 = (x0[0] - x2[0]);
-  double x03 = (x0[0] - x3[0]);
-
-  double y01 = (x0[1] - x1[1]);
-  double y02 = (x0[1] - x2[1]);
-  double y03 = (x0[1] - x3[1]);
-
-  double z01 = (x0[2] - x1[2]);
-  double z02 = (x0[2] - x2[2]);
-  double z03 = (x0[2] - x3[2]);
-
-  return (-x03*(z02*y01 - z01*y02) + x02*(z03*y01 - z01*y03) - x01*(z03*y02 - z02*y03))/6;
-}
-
@@ -42,6 +42,7 @@
 #include <cstring>
 
 #include "CTImage.h"
+#include "run_report.h"
 
 void usage(char *cmd){
   std::cout<<"Usage: "<<cmd<<" CT-image [options]\n"
@@ -53,14 +54,18 @@ void usage(char *cmd){
            <<" -x offset, --xoffset offset\n\tSpecify the offset along the x-axis when extracting a sub-block.\n"
            <<" -y offset, --yoffset offset\n\tSpecify the offset along the y-axis when extracting a sub-block.\n"
            <<" -z offset, --zoffset offset\n\tSpecify the offset along the z-axis when extracting a sub-block.\n"
-           <<" -s width, --slab width\n\tExtract a square block of size 'width' from the data.\n";
+           <<" -s width, --slab width\n\tExtract a square block of size 'width' from the data.\n"
+           <<" -J file, --report file\n\tWrite a JSON report of the time and memory used by each stage of the run.\n"
+           <<" -E file, --trace file\n\tWrite a timeline of the stages and of each thread in the parallel regions (Chrome trace format, for Perfetto).\n"
+           <<" -K, --counters\n\tAlso count the cycles, instructions and cache, TLB and branch misses of each stage in the report (Linux perf events). Needs -J.\n";
   return;
 }
 
 int parse_arguments(int argc, char **argv,
-                    std::string &filename, bool &verbose, std::string &convert, int offsets[], int &slab_width, double &resolution){
+                    std::string &filename, bool &verbose, std::string &convert, int offsets[], int &slab_width, double &resolution, std::string &report, std::string &trace, bool &counters){
 
   // Set defaults
+  counters = false;
   verbose = false;
   slab_width = -1;
   resolution = -1;
@@ -81,13 +86,16 @@ int parse_arguments(int argc, char **argv,
     {"yoffset", optional_argument, 0, 'y'},
     {"zoffset", optional_argument, 0, 'z'},
     {"slab", optional_argument, 0, 's'},
+    {"report", required_argument, 0, 'J'},
+    {"trace", required_argument, 0, 'E'},
+    {"counters", 0, 0, 'K'},
     {0, 0, 0, 0}
   };
 
   int optionIndex = 0;
   int verbosity = 0;
   int c;
-  const char *shortopts = "hvc:r:s:x:y:z:";
+  const char *shortopts = "hvc:r:s:x:y:z:J:E:K";
 
   // Set opterr to nonzero to make getopt print error messages
   opterr=1;
@@ -121,6 +129,15 @@ int parse_arguments(int argc, char **argv,
     case 's':
       slab_width = atoi(optarg);
       break;
+    case 'J':
+      report = std::string(optarg);
+      break;
+    case 'E':
+      trace = std::string(optarg);
+      break;
+    case 'K':
+      counters = true;
+      break;
     case '?':
       // missing argument only returns ':' if the option string starts with ':'
       // but this seems to stop the printing of error messages by getopt?
@@ -140,6 +157,11 @@ int parse_arguments(int argc, char **argv,
 
   filename = std::string(argv[argc-1]);
 
+  if(counters && report.empty()){
+    std::cerr<<"ERROR: --counters adds the counts to the run report, so it needs --report.\n";
+    exit(-1);
+  }
+
   return 0;
 }
 
@@ -154,7 +176,15 @@ int main(int argc, char **argv){
   int offsets[3], slab_width;
   double resolution;
 
-  parse_arguments(argc, argv, filename, verbose, convert, offsets, slab_width, resolution);
+  std::string report, trace;
+  bool counters;
+  parse_arguments(argc, argv, filename, verbose, convert, offsets, slab_width, resolution, report, trace, counters);
+  if(!report.empty())
+    start_run_report(report, argc, argv);
+  if(!trace.empty())
+    start_trace(trace, argc, argv);
+  if(counters)
+    start_counters();
 
   CTImage image;
   if(verbose)
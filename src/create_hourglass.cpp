@@ -41,6 +41,7 @@
 #include <getopt.h>
 
 #include "CTImage.h"
+#include "run_report.h"
 
 void usage(char *cmd){
   std::cout<<"Usage: "<<cmd<<" [options]\n"
@@ -51,17 +52,25 @@ void usage(char *cmd){
            <<" -s width, --slab width\n\tImage width.\n"
            <<" -t width, --throat width\n\tWidth of throat.\n"
            <<" -m, --mesh\n\tGenerate meshing using CGAL\n"
-           <<" -o filename, --output filename\n\tName of outfile -- without the extension.\n";
+           <<" -b, --binary\n\tWrite a binary GMSH file (with -m).\n"
+           <<" -S, --stats\n\tWrite mesh quality and geometry statistics to a JSON file (with -m).\n"
+           <<" -o filename, --output filename\n\tName of outfile -- without the extension.\n"
+           <<" -J file, --report file\n\tWrite a JSON report of the time and memory used by each stage of the run.\n"
+           <<" -E file, --trace file\n\tWrite a timeline of the stages and of each thread in the parallel regions (Chrome trace format, for Perfetto).\n"
+           <<" -K, --counters\n\tAlso count the cycles, instructions and cache, TLB and branch misses of each stage in the report (Linux perf events). Needs -J.\n";
   return;
 }
 
 int parse_arguments(int argc, char **argv,
-                    std::string &filename, bool &verbose, bool &mesh, std::string &convert, int &slab_width, int &throat_width){
+                    std::string &filename, bool &verbose, bool &mesh, std::string &convert, int &slab_width, int &throat_width, bool &stats, bool &binary, std::string &report, std::string &trace, bool &counters){
 
   // Set defaults
+  counters = false;
   filename = std::string("hourglass.vox");
   verbose = false;
   mesh = false;
+  stats = false;
+  binary = false;
   convert = std::string("vox");
   slab_width = 100;
   throat_width = 10;
@@ -78,13 +87,18 @@ int parse_arguments(int argc, char **argv,
     {"slab",    optional_argument, 0, 's'},
     {"throat",  optional_argument, 0, 't'},
     {"mesh",    0,                 0, 'm'},
+    {"stats",   0,                 0, 'S'},
+    {"binary",  0,                 0, 'b'},
     {"output",  optional_argument, 0, 'o'},
+    {"report",  required_argument, 0, 'J'},
+    {"trace",   required_argument, 0, 'E'},
+    {"counters", 0,                0, 'K'},
     {0, 0, 0, 0}
   };
 
   int optionIndex = 0;
   int c;
-  const char *shortopts = "hvc:s:t:mo:";
+  const char *shortopts = "hvc:s:t:mo:SbJ:E:K";
 
   // Set opterr to nonzero to make getopt print error messages
   opterr=1;
@@ -115,6 +129,21 @@ int parse_arguments(int argc, char **argv,
     case 'm':
       mesh = true;
       break;
+    case 'S':
+      stats = true;
+      break;
+    case 'b':
+      binary = true;
+      break;
+    case 'J':
+      report = std::string(optarg);
+      break;
+    case 'E':
+      trace = std::string(optarg);
+      break;
+    case 'K':
+      counters = true;
+      break;
     case '?':
       // missing argument only returns ':' if the option string starts with ':'
       // but this seems to stop the printing of error messages by getopt?
@@ -132,6 +161,11 @@ int parse_arguments(int argc, char **argv,
     }
   }
 
+  if(counters && report.empty()){
+    std::cerr<<"ERROR: --counters adds the counts to the run report, so it needs --report.\n";
+    exit(-1);
+  }
+
   return 0;
 }
 
@@ -142,10 +176,18 @@ int main(int argc, char **argv){
   }
     
   std::string filename, convert;
-  bool verbose, mesh;
+  bool verbose, mesh, stats, binary;
   int slab_width, throat_width;
 
-  parse_arguments(argc, argv, filename, verbose, mesh, convert, slab_width, throat_width);
+  std::string report, trace;
+  bool counters;
+  parse_arguments(argc, argv, filename, verbose, mesh, convert, slab_width, throat_width, stats, binary, report, trace, counters);
+  if(!report.empty())
+    start_run_report(report, argc, argv);
+  if(!trace.empty())
+    start_trace(trace, argc, argv);
+  if(counters)
+    start_counters();
 
   CTImage image;
   if(verbose)
@@ -179,9 +221,15 @@ int main(int argc, char **argv){
 
   if(mesh){
     image.mesh();
-    image.write_gmsh();
+    if(image.write_gmsh(NULL, binary)<0)
+      exit(-1);
 
     image.write_vtu();
+
+    if(stats){
+      if(image.write_statistics()<0)
+        exit(-1);
+    }
   }
 
   return 0;
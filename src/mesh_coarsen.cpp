@@ -0,0 +1,354 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <cmath>
+
+#include "mesh_conversion.h"
+#include "mesh_coarsen.h"
+#include "run_report.h"
+
+// Node-facet adjacency in compressed row storage.
+static void create_node_facet_adjacency(size_t NNodes, const std::vector<int> &facets,
+                                        std::vector<int> &NFList_offsets, std::vector<int> &NFList){
+  int NFacets = facets.size()/3;
+
+  NFList_offsets.assign(NNodes+1, 0);
+  for(int i=0;i<NFacets*3;i++)
+    NFList_offsets[facets[i]+1]++;
+  for(size_t i=0;i<NNodes;i++)
+    NFList_offsets[i+1] += NFList_offsets[i];
+
+  NFList.resize(NFList_offsets[NNodes]);
+  std::vector<int> cursor(NFList_offsets.begin(), NFList_offsets.end()-1);
+  for(int i=0;i<NFacets*3;i++)
+    NFList[cursor[facets[i]]++] = i/3;
+}
+
+static void facet_normal(const double *x0, const double *x1, const double *x2, double n[]){
+  double u[] = {x1[0]-x0[0], x1[1]-x0[1], x1[2]-x0[2]};
+  double v[] = {x2[0]-x0[0], x2[1]-x0[1], x2[2]-x0[2]};
+  n[0] = u[1]*v[2]-u[2]*v[1];
+  n[1] = u[2]*v[0]-u[0]*v[2];
+  n[2] = u[0]*v[1]-u[1]*v[0];
+}
+
+struct Collapse{
+  Collapse(): target(-1), length(0.0), removed(0){}
+
+  bool operator<(const Collapse &other) const{
+    return length<other.length;
+  }
+
+  int target;
+  double length;
+  int removed;
+};
+
+int coarsen_mesh(int target_elements, double min_quality,
+                 std::vector<double> &xyz,
+                 std::vector<int> &tets,
+                 std::vector<int> &facets,
+                 std::vector<int> &facet_ids){
+  ScopedStage stage("coarsen");
+
+  int rounds = 0;
+  for(;;){
+    int NNodes = xyz.size()/3;
+    int NTetra = tets.size()/4;
+    int NFacets = facet_ids.size();
+
+    if(NTetra<=target_elements)
+      break;
+
+    std::vector<int> NNList_offsets, NNList, NEList_offsets, NEList, NFList_offsets, NFList;
+    create_node_adjacency(NNodes, tets, NNList_offsets, NNList);
+    create_node_element_adjacency(NNodes, tets, NEList_offsets, NEList);
+    create_node_facet_adjacency(NNodes, facets, NFList_offsets, NFList);
+
+    // Bit mask of the boundaries each node lies on.
+    std::vector<unsigned int> boundary(NNodes, 0);
+    for(int i=0;i<NFacets;i++){
+      for(int j=0;j<3;j++)
+        boundary[facets[i*3+j]] |= 1u<<facet_ids[i];
+    }
+
+    // Find the shortest valid collapse of each node.
+    std::vector<Collapse> collapse(NNodes);
+#pragma omp parallel
+    {
+      ThreadSpan span("find collapses");
+      std::vector< std::pair<double, int> > candidates;
+
+#pragma omp for schedule(dynamic, 256) nowait
+      for(int a=0;a<NNodes;a++){
+        candidates.clear();
+        for(int k=NNList_offsets[a];k<NNList_offsets[a+1];k++){
+          int b = NNList[k];
+
+          // A boundary node may only slide along the boundaries it lies on.
+          if((boundary[a]&boundary[b])!=boundary[a])
+            continue;
+
+          double l2 = 0.0;
+          for(int l=0;l<3;l++)
+            l2 += (xyz[a*3+l]-xyz[b*3+l])*(xyz[a*3+l]-xyz[b*3+l]);
+          candidates.push_back(std::pair<double, int>(l2, b));
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        // Worst element quality around a before the collapse.
+        double q_old = 1.0;
+        for(int k=NEList_offsets[a];k<NEList_offsets[a+1];k++){
+          const int *n = &(tets[NEList[k]*4]);
+          q_old = std::min(q_old, quality(&(xyz[n[0]*3]), &(xyz[n[1]*3]), &(xyz[n[2]*3]), &(xyz[n[3]*3])));
+        }
+        double q_min = std::min(min_quality, q_old);
+
+        for(size_t c=0;c<candidates.size();c++){
+          int b = candidates[c].second;
+          bool valid = true;
+
+          // The collapsed edge must lie on the boundary if a does.
+          if(boundary[a]){
+            bool boundary_edge = false;
+            for(int k=NFList_offsets[a];k<NFList_offsets[a+1] && !boundary_edge;k++){
+              const int *n = &(facets[NFList[k]*3]);
+              boundary_edge = (n[0]==b || n[1]==b || n[2]==b);
+            }
+            if(!boundary_edge)
+              continue;
+          }
+
+          // Topological checks: the nodes shared by a and b must be
+          // exactly those of the elements around the edge (the link
+          // condition), and none of them may be left without an element.
+          std::vector<int> edge_nodes;
+          for(int k=NEList_offsets[a];k<NEList_offsets[a+1];k++){
+            const int *n = &(tets[NEList[k]*4]);
+            if(n[0]==b || n[1]==b || n[2]==b || n[3]==b){
+              for(int l=0;l<4;l++){
+                if(n[l]!=a && n[l]!=b)
+                  edge_nodes.push_back(n[l]);
+              }
+            }
+          }
+          std::sort(edge_nodes.begin(), edge_nodes.end());
+          edge_nodes.erase(std::unique(edge_nodes.begin(), edge_nodes.end()), edge_nodes.end());
+
+          std::vector<int> common_nodes;
+          std::set_intersection(NNList.begin()+NNList_offsets[a], NNList.begin()+NNList_offsets[a+1],
+                                NNList.begin()+NNList_offsets[b], NNList.begin()+NNList_offsets[b+1],
+                                std::back_inserter(common_nodes));
+          if(common_nodes!=edge_nodes)
+            continue;
+
+          for(std::vector<int>::const_iterator it=edge_nodes.begin();it!=edge_nodes.end() && valid;++it){
+            bool survives = false;
+            for(int k=NEList_offsets[*it];k<NEList_offsets[*it+1] && !survives;k++){
+              const int *n = &(tets[NEList[k]*4]);
+              bool contains_a = false, contains_b = false;
+              for(int l=0;l<4;l++){
+                contains_a = contains_a || n[l]==a;
+                contains_b = contains_b || n[l]==b;
+              }
+              survives = !(contains_a && contains_b);
+            }
+            valid = survives;
+          }
+
+          // Elements that survive must not invert or become too poor.
+          int removed = 0;
+          for(int k=NEList_offsets[a];k<NEList_offsets[a+1] && valid;k++){
+            const int *n = &(tets[NEList[k]*4]);
+            const double *x[4];
+            bool contains_b = false;
+            for(int l=0;l<4;l++){
+              contains_b = contains_b || n[l]==b;
+              x[l] = &(xyz[(n[l]==a?b:n[l])*3]);
+            }
+            if(contains_b){
+              removed++;
+              continue;
+            }
+            valid = volume(x[0], x[1], x[2], x[3])>0 && quality(x[0], x[1], x[2], x[3])>=q_min;
+          }
+
+          // Facets that survive must not flip.
+          for(int k=NFList_offsets[a];k<NFList_offsets[a+1] && valid;k++){
+            const int *n = &(facets[NFList[k]*3]);
+            if(n[0]==b || n[1]==b || n[2]==b)
+              continue;
+
+            double n_old[3], n_new[3];
+            facet_normal(&(xyz[n[0]*3]), &(xyz[n[1]*3]), &(xyz[n[2]*3]), n_old);
+            facet_normal(&(xyz[(n[0]==a?b:n[0])*3]), &(xyz[(n[1]==a?b:n[1])*3]), &(xyz[(n[2]==a?b:n[2])*3]), n_new);
+            valid = (n_old[0]*n_new[0]+n_old[1]*n_new[1]+n_old[2]*n_new[2])>0;
+          }
+
+          if(valid){
+            collapse[a].target = b;
+            collapse[a].length = candidates[c].first;
+            collapse[a].removed = removed;
+            break;
+          }
+        }
+      }
+    }
+
+    // Select an independent set: a node collapses if its edge is shorter
+    // than that of all its neighbours that also want to collapse. As
+    // only the collapsing node moves, the checks above remain valid.
+    std::vector<int> selected;
+#pragma omp parallel
+    {
+      ThreadSpan span("select collapses");
+      std::vector<int> local_selected;
+
+#pragma omp for schedule(static) nowait
+      for(int a=0;a<NNodes;a++){
+        if(collapse[a].target==-1)
+          continue;
+
+        bool minimum = true;
+        for(int k=NNList_offsets[a];k<NNList_offsets[a+1] && minimum;k++){
+          int c = NNList[k];
+          if(collapse[c].target!=-1 &&
+             (collapse[c].length<collapse[a].length ||
+              (collapse[c].length==collapse[a].length && c<a)))
+            minimum = false;
+        }
+        if(minimum)
+          local_selected.push_back(a);
+      }
+
+#pragma omp critical
+      selected.insert(selected.end(), local_selected.begin(), local_selected.end());
+    }
+
+    if(selected.empty())
+      break;
+
+    // Do not overshoot the target by more than necessary.
+    std::sort(selected.begin(), selected.end(),
+              [&collapse](int a, int b){
+                return collapse[a].length<collapse[b].length ||
+                  (collapse[a].length==collapse[b].length && a<b);
+              });
+    int excess = NTetra-target_elements, nselected = 0;
+    for(;nselected<(int)selected.size() && excess>0;nselected++)
+      excess -= collapse[selected[nselected]].removed;
+
+    std::vector<int> target(NNodes, -1);
+    for(int i=0;i<nselected;i++)
+      target[selected[i]] = collapse[selected[i]].target;
+
+    // Apply the collapses, removing the elements and facets around the
+    // collapsed edges.
+    std::vector<int> tets_new, facets_new, facet_ids_new;
+    tets_new.reserve(tets.size());
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+
+      int n[4];
+      bool degenerate = false;
+      for(int j=0;j<4;j++)
+        n[j] = target[tets[i*4+j]]==-1?tets[i*4+j]:target[tets[i*4+j]];
+      for(int j=0;j<4;j++)
+        for(int k=j+1;k<4;k++)
+          degenerate = degenerate || n[j]==n[k];
+      if(!degenerate)
+        tets_new.insert(tets_new.end(), n, n+4);
+    }
+
+    // Compress out the collapsed nodes. Concurrent collapses can also
+    // leave a node shared by both without any element, so renumber only
+    // the nodes still in use.
+    std::vector<int> renumbering(NNodes, -1);
+    for(size_t i=0;i<tets_new.size();i++)
+      renumbering[tets_new[i]] = 0;
+    int cnt = 0;
+    for(int i=0;i<NNodes;i++){
+      if(renumbering[i]==0)
+        renumbering[i] = cnt++;
+    }
+
+    for(int i=0;i<NFacets;i++){
+      int n[3];
+      for(int j=0;j<3;j++)
+        n[j] = target[facets[i*3+j]]==-1?facets[i*3+j]:target[facets[i*3+j]];
+      if(n[0]!=n[1] && n[1]!=n[2] && n[2]!=n[0] &&
+         renumbering[n[0]]!=-1 && renumbering[n[1]]!=-1 && renumbering[n[2]]!=-1){
+        facets_new.insert(facets_new.end(), n, n+3);
+        facet_ids_new.push_back(facet_ids[i]);
+      }
+    }
+    std::vector<double> xyz_new(cnt*3);
+#pragma omp parallel
+    {
+      ThreadSpan span("renumber");
+#pragma omp for nowait
+      for(int i=0;i<NNodes;i++){
+        if(renumbering[i]!=-1){
+          for(int j=0;j<3;j++)
+            xyz_new[renumbering[i]*3+j] = xyz[i*3+j];
+        }
+      }
+#pragma omp for nowait
+      for(size_t i=0;i<tets_new.size();i++)
+        tets_new[i] = renumbering[tets_new[i]];
+#pragma omp for nowait
+      for(size_t i=0;i<facets_new.size();i++)
+        facets_new[i] = renumbering[facets_new[i]];
+    }
+
+    xyz.swap(xyz_new);
+    tets.swap(tets_new);
+    facets.swap(facets_new);
+    facet_ids.swap(facet_ids_new);
+
+    rounds++;
+  }
+
+  return rounds;
+}
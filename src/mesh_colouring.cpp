@@ -0,0 +1,200 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "mesh_conversion.h"
+#include "mesh_colouring.h"
+#include "run_report.h"
+
+// Parallel speculative greedy colouring (Gebremedhin and Manne, 2000).
+// All vertices in the worklist are given the lowest colour not used by
+// their neighbours concurrently; where this races, the higher numbered
+// vertex of each conflicting pair is put back on the worklist.
+// neighbours(i, visit) must call visit(j) for each neighbour j of i.
+template<typename Neighbours>
+static int speculative_colouring(std::vector<int> &worklist, const Neighbours &neighbours,
+                                 std::vector<int> &colour){
+  while(!worklist.empty()){
+    int nwork = worklist.size();
+
+#pragma omp parallel
+    {
+      ThreadSpan span("colour");
+      // forbidden[c]==i if colour c is used by a neighbour of i.
+      std::vector<int> forbidden;
+
+#pragma omp for schedule(static) nowait
+      for(int k=0;k<nwork;k++){
+        int i = worklist[k];
+        neighbours(i, [&](int j){
+            int c = colour[j];
+            if(j!=i && c>=0){
+              if(c>=(int)forbidden.size())
+                forbidden.resize(c+1, -1);
+              forbidden[c] = i;
+            }
+          });
+
+        int c = 0;
+        while(c<(int)forbidden.size() && forbidden[c]==i)
+          c++;
+        colour[i] = c;
+      }
+    }
+
+    // Detect conflicts.
+    std::vector<int> conflicts;
+#pragma omp parallel
+    {
+      ThreadSpan span("colour conflicts");
+      std::vector<int> local_conflicts;
+
+#pragma omp for schedule(static) nowait
+      for(int k=0;k<nwork;k++){
+        int i = worklist[k];
+        bool conflict = false;
+        neighbours(i, [&](int j){
+            if(j<i && colour[j]==colour[i])
+              conflict = true;
+          });
+        if(conflict)
+          local_conflicts.push_back(i);
+      }
+
+#pragma omp critical
+      conflicts.insert(conflicts.end(), local_conflicts.begin(), local_conflicts.end());
+    }
+
+    // Lower numbered vertices win, which guarantees progress.
+    for(std::vector<int>::const_iterator it=conflicts.begin();it!=conflicts.end();++it)
+      colour[*it] = -1;
+    std::sort(conflicts.begin(), conflicts.end());
+    worklist.swap(conflicts);
+  }
+
+  int ncolours = 0;
+  for(std::vector<int>::const_iterator it=colour.begin();it!=colour.end();++it)
+    ncolours = std::max(ncolours, *it+1);
+
+  return ncolours;
+}
+
+// Neighbours of a vertex in a graph stored in compressed row storage.
+struct GraphNeighbours{
+  GraphNeighbours(const std::vector<int> &_offsets, const std::vector<int> &_adjacency):
+    offsets(_offsets), adjacency(_adjacency){}
+
+  template<typename Visit>
+  void operator()(int i, Visit visit) const{
+    for(int k=offsets[i];k<offsets[i+1];k++)
+      visit(adjacency[k]);
+  }
+
+  const std::vector<int> &offsets, &adjacency;
+};
+
+// Elements sharing a node with an element.
+struct ElementNeighbours{
+  ElementNeighbours(const std::vector<int> &_tets,
+                    const std::vector<int> &_NEList_offsets, const std::vector<int> &_NEList):
+    tets(_tets), NEList_offsets(_NEList_offsets), NEList(_NEList){}
+
+  template<typename Visit>
+  void operator()(int i, Visit visit) const{
+    for(int j=0;j<4;j++){
+      int nid = tets[i*4+j];
+      for(int k=NEList_offsets[nid];k<NEList_offsets[nid+1];k++)
+        visit(NEList[k]);
+    }
+  }
+
+  const std::vector<int> &tets, &NEList_offsets, &NEList;
+};
+
+int colour_graph(const std::vector<int> &offsets, const std::vector<int> &adjacency,
+                 std::vector<int> &colour){
+  int NVertices = offsets.size()-1;
+  colour.assign(NVertices, -1);
+
+  std::vector<int> worklist(NVertices);
+  for(int i=0;i<NVertices;i++)
+    worklist[i] = i;
+
+  return speculative_colouring(worklist, GraphNeighbours(offsets, adjacency), colour);
+}
+
+int colour_elements(size_t NNodes, const std::vector<int> &tets, std::vector<int> &colour){
+  ScopedStage stage("colour");
+
+  int NTetra = tets.size()/4;
+
+  std::vector<int> NEList_offsets, NEList;
+  create_node_element_adjacency(NNodes, tets, NEList_offsets, NEList);
+
+  colour.assign(NTetra, -1);
+  std::vector<int> worklist;
+  worklist.reserve(NTetra);
+  for(int i=0;i<NTetra;i++){
+    if(tets[i*4]!=-1)
+      worklist.push_back(i);
+  }
+
+  // Elements conflict if they share a node.
+  return speculative_colouring(worklist, ElementNeighbours(tets, NEList_offsets, NEList), colour);
+}
+
+void create_colour_table(const std::vector<int> &colour, int ncolours,
+                         std::vector<int> &offsets, std::vector<int> &elements){
+  int NElements = colour.size();
+
+  offsets.assign(ncolours+1, 0);
+  for(int i=0;i<NElements;i++){
+    if(colour[i]>=0)
+      offsets[colour[i]+1]++;
+  }
+  for(int c=0;c<ncolours;c++)
+    offsets[c+1] += offsets[c];
+
+  elements.resize(offsets[ncolours]);
+  std::vector<int> cursor(offsets.begin(), offsets.end()-1);
+  for(int i=0;i<NElements;i++){
+    if(colour[i]>=0)
+      elements[cursor[colour[i]]++] = i;
+  }
+}
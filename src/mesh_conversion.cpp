@@ -46,47 +46,36 @@
 
 #include <cmath>
 #include <cassert>
+#include <cctype>
 #include <cstdlib>
+#include <cstring>
+#include <stdint.h>
 
-#include <vtkPolyDataReader.h>
-#include <vtkPolyData.h>
+#include <vtkXMLUnstructuredGridReader.h>
+#include <vtkUnstructuredGrid.h>
 #include <vtkSmartPointer.h>
+#include <vtkCellArray.h>
 #include <vtkCellType.h>
+#include <vtkDataArray.h>
 #include <vtkPoints.h>
-#include <vtkCell.h>
 
 #include "writers.h"
 #include "mesh_conversion.h"
+#include "tet_geometry.h"
+#include "text_reader.h"
+#include "run_report.h"
 
-int create_domain(int axis,
-		  std::vector<double> &xyz,
-                  std::vector<int> &tets, 
-                  std::vector<int> &facets,
-                  std::vector<int> &facet_ids){
-  
-  // Create node-element adjancy list.
-  size_t NNodes = xyz.size()/3;
+void create_element_adjacency(size_t NNodes, const std::vector<int> &tets, std::vector<int> &EEList){
+  ScopedStage stage("adjacency");
+  stage.set_count(tets.size()/4);
 
-  std::vector< std::unordered_set<int> > NEList(NNodes);
+  // Create node-element adjancy list. Compressed row storage takes a
+  // fraction of the memory of a set per node.
+  std::vector<int> NEList_offsets, NEList;
+  create_node_element_adjacency(NNodes, tets, NEList_offsets, NEList);
   int NTetra = tets.size()/4;
 
-  for(int i=0;i<NTetra;i++){
-    if(tets[i*4]==-1)
-      continue;
-    
-    double v = volume(xyz.data()+3*tets[i*4],
-     		      xyz.data()+3*tets[i*4+1], 
-		      xyz.data()+3*tets[i*4+2],
-		      xyz.data()+3*tets[i*4+3]);
-    if(v<0)
-      std::swap(tets[i*4+2], tets[i*4+3]);
-    
-    
-    for(int j=0;j<4;j++)
-      NEList[tets[i*4+j]].insert(i);
-  }
-
-  std::vector<int> EEList(NTetra*4);
+  EEList.resize(NTetra*4);
 #pragma omp parallel
   {
     // Initialise and ensure 1st touch placement.
@@ -94,51 +83,85 @@ int create_domain(int axis,
     for(int i=0;i<4*NTetra;i++)
       EEList[i] = -1;
 
-#pragma omp for
+    ThreadSpan span("adjacency");
+#pragma omp for nowait
     for(int i=0;i<NTetra;i++){
       if(tets[i*4]==-1)
         continue;
 
-      int n0 = tets[i*4];
-      int n1 = tets[i*4+1];
-      int n2 = tets[i*4+2];
-      int n3 = tets[i*4+3];
-
-      for(auto& e : NEList[n0]){
-        if(e!=i){
-          if(NEList[n1].find(e)!=NEList[n1].end()){
-            if(EEList[i*4+3]==-1 && NEList[n2].find(e)!=NEList[n2].end()){
-              EEList[i*4+3] = e;
-            }else if(EEList[i*4+2]==-1 && NEList[n3].find(e)!=NEList[n3].end()){
-              EEList[i*4+2] = e;
-            }
+      // The neighbour opposite node j is the other element that all
+      // three nodes of facet j belong to. Rows are sorted.
+      for(int j=0;j<4;j++){
+        int n0 = tets[i*4+(j+1)%4];
+        int n1 = tets[i*4+(j+2)%4];
+        int n2 = tets[i*4+(j+3)%4];
+        const int *row1 = NEList.data()+NEList_offsets[n1], *row1_end = NEList.data()+NEList_offsets[n1+1];
+        const int *row2 = NEList.data()+NEList_offsets[n2], *row2_end = NEList.data()+NEList_offsets[n2+1];
+        for(int k=NEList_offsets[n0];k<NEList_offsets[n0+1];k++){
+          int e = NEList[k];
+          if(e!=i && std::binary_search(row1, row1_end, e) && std::binary_search(row2, row2_end, e)){
+            EEList[i*4+j] = e;
+            break;
           }
         }
-        if(EEList[i*4+3]!=-1 && EEList[i*4+2]!=-1)
-          break;
       }
+    }
+  }
+}
 
-      for(auto& e : NEList[n2]){
-        if(e!=i){
-          if(NEList[n3].find(e)!=NEList[n3].end()){
-            if(EEList[i*4+1]==-1 && NEList[n0].find(e)!=NEList[n0].end()){
-              EEList[i*4+1] = e;
-            }else if(EEList[i*4]==-1 && NEList[n1].find(e)!=NEList[n1].end()){
-              EEList[i*4] = e;
-            }
-          }
-        }
-        if(EEList[i*4+1]!=-1 && EEList[i*4]!=-1)
-          break;
+// Nodes of facet j (the facet opposite node j) of element i, ordered so
+// that the normal points out of the element.
+static inline void element_facet(const std::vector<int> &tets, int i, int j, int facet[3]){
+  switch(j){
+  case 0:
+    facet[0] = tets[i*4+1];
+    facet[1] = tets[i*4+3];
+    facet[2] = tets[i*4+2];
+    break;
+  case 1:
+    facet[0] = tets[i*4+0];
+    facet[1] = tets[i*4+2];
+    facet[2] = tets[i*4+3];
+    break;
+  case 2:
+    facet[0] = tets[i*4+0];
+    facet[1] = tets[i*4+3];
+    facet[2] = tets[i*4+1];
+    break;
+  case 3:
+    facet[0] = tets[i*4+0];
+    facet[1] = tets[i*4+1];
+    facet[2] = tets[i*4+2];
+    break;
+  }
+}
+
+// Fix the orientation of the elements and find the bounding box and the
+// distance (a tenth of the mean element size) within which a facet is
+// taken to lie on a side of it.
+static void prepare_domain(const std::vector<double> &xyz, std::vector<int> &tets, double bbox[6], double &eta){
+  size_t NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+
+  // Fix the orientation of the elements.
+#pragma omp parallel
+  {
+    ThreadSpan span("orient");
+#pragma omp for nowait
+    for(int b=0;b<NTetra;b+=GEOMETRY_BLOCK){
+      int m = std::min(GEOMETRY_BLOCK, NTetra-b);
+      double v[GEOMETRY_BLOCK];
+      tet_volumes(xyz.data(), tets.data()+b*4, m, v);
+      for(int i=b;i<b+m;i++){
+        if(tets[i*4]!=-1 && v[i-b]<0)
+          std::swap(tets[i*4+2], tets[i*4+3]);
       }
     }
   }
-  NEList.clear();
 
   // Calculate the bounding box.
-  double bbox[] = {xyz[0], xyz[0],
-		   xyz[1], xyz[1],
-		   xyz[2], xyz[2]};
+  for(size_t j=0;j<3;j++)
+    bbox[j*2] = bbox[j*2+1] = xyz[j];
   for(size_t i=1;i<NNodes;i++){
     for(size_t j=0;j<3;j++){
       bbox[j*2  ] = std::min(bbox[j*2  ], xyz[i*3+j]);
@@ -148,90 +171,71 @@ int create_domain(int axis,
 
   // Calculate the a element size - use the l-infinity norm.
   size_t livecnt=0;
-  double eta=0.0;
-  for(size_t i=0;i<NTetra;i++){
-    if(tets[i*4]==-1)
-      continue;
+  eta=0.0;
+#pragma omp parallel reduction(+:livecnt, eta)
+  {
+    ThreadSpan span("element size");
+#pragma omp for nowait
+    for(int b=0;b<NTetra;b+=GEOMETRY_BLOCK){
+      int m = std::min(GEOMETRY_BLOCK, NTetra-b);
+      double lbbox[GEOMETRY_BLOCK*6];
+      tet_bounding_boxes(xyz.data(), tets.data()+b*4, m, lbbox);
+      for(int i=0;i<m;i++){
+        if(tets[(b+i)*4]==-1)
+          continue;
 
-    livecnt++;
-
-    int vid = tets[i*4];
-    double lbbox[] = {xyz[vid*3],   xyz[vid*3],
-		      xyz[vid*3+1], xyz[vid*3+1],
-		      xyz[vid*3+2], xyz[vid*3+2]};
-    for(size_t j=1;j<4;j++){
-      vid = tets[i*4+j];
-      for(size_t k=0;k<3;k++){
-	lbbox[k*2  ] = std::min(lbbox[k*2  ], xyz[vid*3+k]);
-	lbbox[k*2+1] = std::max(lbbox[k*2+1], xyz[vid*3+k]);
+        livecnt++;
+        eta += ((lbbox[i*6+1]-lbbox[i*6  ])+
+                (lbbox[i*6+3]-lbbox[i*6+2])+
+                (lbbox[i*6+5]-lbbox[i*6+4]));
       }
     }
-    eta += ((lbbox[1]-lbbox[0])+
-	    (lbbox[3]-lbbox[2])+
-	    (lbbox[5]-lbbox[4]));
   }
   eta/=(livecnt*3);   // i.e. the mean element size
   
   // Define what we mean by a "small" distance.
   eta*=0.1;
-  
-  // Calculate the facet list, facet id's and the initial forward and
-  // backward fronts.
-  std::set<int> front0, front1;
-  for(size_t i=0;i<NTetra;i++){
-    if(tets[i*4]==-1)
+}
+
+// Label the elements connected to both sides of the sample normal to
+// axis with 2. Only elements for which phase is select are visited, or
+// all live elements if phase is NULL.
+static void sweep_domain(int axis, const std::vector<double> &xyz, const std::vector<int> &tets,
+                         const std::vector<int> &EEList, const double bbox[6], double eta,
+                         const char *phase, char select, std::vector<char> &label){
+  int NTetra = tets.size()/4;
+
+  // Find the initial forward and backward fronts.
+  std::vector<int> front0, front1;
+  for(int i=0;i<NTetra;i++){
+    if(tets[i*4]==-1 || (phase!=NULL && phase[i]!=select))
       continue;
     
     for(size_t j=0;j<4;j++){
-      bool is_facet = false;
-      int facet[3];
       if(EEList[i*4+j]==-1){
-	is_facet=true;
-	switch(j){
-	case 0:
-	  facet[0] = tets[i*4+1];
-	  facet[1] = tets[i*4+3];
-	  facet[2] = tets[i*4+2];
-	  break;
-	case 1:
-	  facet[0] = tets[i*4+0];
-	  facet[1] = tets[i*4+2];
-	  facet[2] = tets[i*4+3];
-	  break;
-	case 2:
-	  facet[0] = tets[i*4+0];
-	  facet[1] = tets[i*4+3];
-	  facet[2] = tets[i*4+1];
-	  break;
-	case 3:
-	  facet[0] = tets[i*4+0];
-	  facet[1] = tets[i*4+1];
-	  facet[2] = tets[i*4+2];
-	  break;
-	}
-      }
-      
-      if(is_facet){
+	int facet[3];
+	element_facet(tets, i, j, facet);
+
 	// Decide boundary id.
 	double mean_x = (xyz[facet[0]*3+axis]+
 			 xyz[facet[1]*3+axis]+
 			 xyz[facet[2]*3+axis])/3.0;
 	
 	if(fabs(mean_x-bbox[axis*2])<eta){
-	  front0.insert(front0.end(), i);
+	  front0.push_back(i);
 	}else if(fabs(mean_x-bbox[axis*2+1])<eta){
-	  front1.insert(front1.end(), i);
+	  front1.push_back(i);
 	}
       }
     }
   }
   
-  // Advance front0
-  std::vector<int> label(NTetra, 0);
+  // Advance front0. The flood fill does not depend on the order elements
+  // are visited in, so plain stacks do instead of ordered sets.
+  label.assign(NTetra, 0);
   while(!front0.empty()){
-    // Get the next unprocessed element in the set.
-    int seed = *front0.begin();
-    front0.erase(front0.begin());
+    int seed = front0.back();
+    front0.pop_back();
     if(label[seed]==1)
       continue;
 
@@ -239,17 +243,17 @@ int create_domain(int axis,
 
     for(int i=0;i<4;i++){
       int eid = EEList[seed*4+i];
-      if(eid!=-1 && label[eid]!=1){
-        front0.insert(eid);
+      if(eid!=-1 && label[eid]!=1 && (phase==NULL || phase[eid]==select)){
+        front0.push_back(eid);
       }
     }
   }
+  std::vector<int>().swap(front0);
   
   // Advance back sweep using front1.
   while(!front1.empty()){
-    // Get the next unprocessed element in the set.
-    int seed = *front1.begin();
-    front1.erase(front1.begin());
+    int seed = front1.back();
+    front1.pop_back();
     
     if(label[seed]!=1) // i.e. was either never of interest or has been processed in the backsweep.
       continue;
@@ -258,106 +262,359 @@ int create_domain(int axis,
     for(int i=0;i<4;i++){
       int eid = EEList[seed*4+i];
       if(eid!=-1 && label[eid]==1){
-        front1.insert(eid);
+        front1.push_back(eid);
       }
     }
   }
+}
+
+// Create the facets of the elements labelled 2, numbered as the
+// untrimmed nodes. Facets shared with an element for which other is 2
+// (the other phase) are labelled 8 and, if interface is not NULL, also
+// appended to it.
+static void create_domain_facets(const std::vector<double> &xyz, const std::vector<int> &tets,
+                                 const std::vector<int> &EEList, const double bbox[6], double eta,
+                                 const std::vector<char> &label, const std::vector<char> *other,
+                                 std::vector<int> &facets, std::vector<int> &facet_ids,
+                                 std::vector<int> *interface){
+  int NTetra = tets.size()/4;
 
-  // Find active vertex set and create renumbering.
-  std::map<int, int> renumbering;
+  facets.clear();
+  facet_ids.clear();
+  for(int i=0;i<NTetra;i++){
+    if(label[i]!=2)
+      continue;
+    
+    for(size_t j=0;j<4;j++){
+      int eid = EEList[i*4+j];
+      if(eid!=-1 && label[eid]==2)
+        continue;
+
+      int facet[3];
+      element_facet(tets, i, j, facet);
+      for(int k=0;k<3;k++)
+        facets.push_back(facet[k]);
+
+      if(eid!=-1 && other!=NULL && (*other)[eid]==2){
+        facet_ids.push_back(8);
+        if(interface!=NULL)
+          interface->insert(interface->end(), facet, facet+3);
+        continue;
+      }
+	
+      // Decide boundary id.
+      double mean_xyz[3];
+      for(int k=0;k<3;k++)
+        mean_xyz[k] = (xyz[facet[0]*3+k]+xyz[facet[1]*3+k]+xyz[facet[2]*3+k])/3.0;
+	
+      if(fabs(mean_xyz[0]-bbox[0])<eta){
+        facet_ids.push_back(1);
+      }else if(fabs(mean_xyz[0]-bbox[1])<eta){
+        facet_ids.push_back(2);
+      }else if(fabs(mean_xyz[1]-bbox[2])<eta){
+        facet_ids.push_back(3);
+      }else if(fabs(mean_xyz[1]-bbox[3])<eta){
+        facet_ids.push_back(4);
+      }else if(fabs(mean_xyz[2]-bbox[4])<eta){
+        facet_ids.push_back(5);
+      }else if(fabs(mean_xyz[2]-bbox[5])<eta){
+        facet_ids.push_back(6);
+      }else{
+        facet_ids.push_back(7);
+      }
+    }
+  }
+}
+
+// Number the nodes of the elements labelled 2 in their original order
+// and apply the numbering to the facets. Returns the number of nodes.
+static int renumber_domain(size_t NNodes, const std::vector<int> &tets, const std::vector<char> &label,
+                           std::vector<int> &renumbering, std::vector<int> &facets){
+  int NTetra = tets.size()/4;
+
+  renumbering.assign(NNodes, -1);
   for(int i=0;i<NTetra;i++){
     if(label[i]==2){
       for(int j=0;j<4;j++)
-        renumbering.insert(std::pair<int, int>(tets[i*4+j], -1));
+        renumbering[tets[i*4+j]] = 0;
     }
   }
-
-  // Create new compressed mesh.
-  std::vector<double> xyz_new;
-  std::vector<int> tets_new;
   int cnt=0;
-  for(auto& it : renumbering){
-    it.second = cnt++;
-    
-    xyz_new.push_back(xyz[(it.first)*3]);
-    xyz_new.push_back(xyz[(it.first)*3+1]);
-    xyz_new.push_back(xyz[(it.first)*3+2]);
+  for(size_t i=0;i<NNodes;i++){
+    if(renumbering[i]==0)
+      renumbering[i] = cnt++;
+  }
+
+  for(size_t i=0;i<facets.size();i++)
+    facets[i] = renumbering[facets[i]];
+
+  return cnt;
+}
+
+int trim_domain(int axis,
+                const std::vector<double> &xyz,
+                std::vector<int> &tets,
+                std::vector<int> &renumbering,
+                std::vector<int> &facets,
+                std::vector<int> &facet_ids){
+  ScopedStage stage("trim");
+  
+  size_t NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  stage.set_count(NTetra);
+
+  double bbox[6], eta;
+  {
+    ScopedStage stage("prepare");
+    prepare_domain(xyz, tets, bbox, eta);
   }
+
+  std::vector<int> EEList;
+  create_element_adjacency(NNodes, tets, EEList);
+
+  std::vector<char> label;
+  {
+    ScopedStage stage("sweep");
+    sweep_domain(axis, xyz, tets, EEList, bbox, eta, NULL, 0, label);
+  }
+  {
+    ScopedStage stage("facets");
+    create_domain_facets(xyz, tets, EEList, bbox, eta, label, NULL, facets, facet_ids, NULL);
+  }
+  std::vector<int>().swap(EEList);
+
+  // Mask the elements that are not kept and number the active nodes in
+  // their original order.
+  ScopedStage renumber_stage("renumber");
+  int cnt = renumber_domain(NNodes, tets, label, renumbering, facets);
   for(int i=0;i<NTetra;i++){
-    if(label[i]==2){
-      for(int j=0;j<4;j++){
-        tets_new.push_back(renumbering[tets[i*4+j]]);
-      }
+    if(label[i]!=2)
+      tets[i*4] = -1;
+  }
+
+  return cnt;
+}
+
+int trim_phases(int axis,
+                const std::vector<double> &xyz,
+                std::vector<int> &tets,
+                const std::vector<char> &phase,
+                std::vector<char> keep[2],
+                std::vector<int> renumbering[2],
+                std::vector<int> facets[2],
+                std::vector<int> facet_ids[2],
+                std::vector<int> &interface){
+  ScopedStage stage("trim");
+
+  size_t NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  stage.set_count(NTetra);
+
+  double bbox[6], eta;
+  {
+    ScopedStage stage("prepare");
+    prepare_domain(xyz, tets, bbox, eta);
+  }
+
+  // One adjacency serves both phases.
+  std::vector<int> EEList;
+  create_element_adjacency(NNodes, tets, EEList);
+
+  {
+    ScopedStage stage("sweep");
+    for(int p=0;p<2;p++)
+      sweep_domain(axis, xyz, tets, EEList, bbox, eta, phase.data(), p+1, keep[p]);
+  }
+
+  interface.clear();
+  {
+    ScopedStage stage("facets");
+    for(int p=0;p<2;p++)
+      create_domain_facets(xyz, tets, EEList, bbox, eta, keep[p], &(keep[1-p]), facets[p], facet_ids[p],
+                           p==0?&interface:NULL);
+  }
+  std::vector<int>().swap(EEList);
+
+  ScopedStage renumber_stage("renumber");
+  int active = 0;
+  for(int p=0;p<2;p++){
+    if(renumber_domain(NNodes, tets, keep[p], renumbering[p], facets[p])>0)
+      active++;
+#pragma omp parallel
+    {
+      ThreadSpan span("split domains");
+#pragma omp for nowait
+      for(int i=0;i<NTetra;i++)
+        keep[p][i] = keep[p][i]==2;
     }
   }
 
-  // Re-create facets.
-  facets.clear();
-  facet_ids.clear();
+  return active;
+}
+
+void compact_domain(const std::vector<int> &renumbering, std::vector<double> &xyz, std::vector<int> &tets){
+  ScopedStage stage("compact");
+
+  // New numbers never exceed old ones, so both arrays are compacted in
+  // place from the front.
+  size_t NNodes = renumbering.size();
+  size_t cnt = 0;
+  for(size_t i=0;i<NNodes;i++){
+    int n = renumbering[i];
+    if(n<0)
+      continue;
+    for(int k=0;k<3;k++)
+      xyz[n*3+k] = xyz[i*3+k];
+    cnt++;
+  }
+  xyz.resize(cnt*3);
+  xyz.shrink_to_fit();
+
+  size_t NTetra = tets.size()/4;
+  cnt = 0;
   for(size_t i=0;i<NTetra;i++){
-    if(label[i]!=2)
+    if(tets[i*4]==-1)
       continue;
-    
-    for(size_t j=0;j<4;j++){
-      bool is_facet = false;
-      int facet[3];
-      if(EEList[i*4+j]==-1){
-	is_facet=true;
-	switch(j){
-	case 0:
-	  facet[0] = tets[i*4+1];
-	  facet[1] = tets[i*4+3];
-	  facet[2] = tets[i*4+2];
-	  break;
-	case 1:
-	  facet[0] = tets[i*4+0];
-	  facet[1] = tets[i*4+2];
-	  facet[2] = tets[i*4+3];
-	  break;
-	case 2:
-	  facet[0] = tets[i*4+0];
-	  facet[1] = tets[i*4+3];
-	  facet[2] = tets[i*4+1];
-	  break;
-	case 3:
-	  facet[0] = tets[i*4+0];
-	  facet[1] = tets[i*4+1];
-	  facet[2] = tets[i*4+2];
-	  break;
-	}
+    for(int j=0;j<4;j++)
+      tets[cnt*4+j] = renumbering[tets[i*4+j]];
+    cnt++;
+  }
+  tets.resize(cnt*4);
+  tets.shrink_to_fit();
+}
+
+// Key of a cell of the welding grid. The cell indices are hashed rather
+// than packed so that a small tolerance on a large sample cannot
+// overflow the key; a collision only adds candidates to check.
+static inline uint64_t weld_key(long ix, long iy, long iz){
+  uint64_t key = (uint64_t)ix*0x9E3779B97F4A7C15ULL;
+  key = (key^(key>>29))+(uint64_t)iy*0xBF58476D1CE4E5B9ULL;
+  key = (key^(key>>31))+(uint64_t)iz*0x94D049BB133111EBULL;
+  return key^(key>>32);
+}
+
+int weld_vertices(double tolerance, std::vector<double> &xyz, std::vector<int> &tets){
+  ScopedStage stage("weld");
+
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  if(NNodes==0 || tolerance<=0)
+    return 0;
+  double tol2 = tolerance*tolerance;
+
+  // Sort the nodes by the cell of a grid with the tolerance as spacing.
+  std::vector< std::pair<uint64_t, int> > keys(NNodes);
+#pragma omp parallel
+  {
+    ThreadSpan span("weld keys");
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++){
+      keys[i] = std::pair<uint64_t, int>(weld_key(floor(xyz[i*3]/tolerance),
+                                                  floor(xyz[i*3+1]/tolerance),
+                                                  floor(xyz[i*3+2]/tolerance)), i);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+
+  // Find the pairs of nodes closer than the tolerance. These can only be
+  // in the same or a neighbouring cell.
+  std::vector< std::pair<int, int> > pairs;
+#pragma omp parallel
+  {
+    ThreadSpan span("weld pairs");
+    std::vector< std::pair<int, int> > local_pairs;
+#pragma omp for schedule(static) nowait
+    for(int i=0;i<NNodes;i++){
+      long cell[3];
+      for(int k=0;k<3;k++)
+        cell[k] = floor(xyz[i*3+k]/tolerance);
+      for(int dx=-1;dx<=1;dx++){
+        for(int dy=-1;dy<=1;dy++){
+          for(int dz=-1;dz<=1;dz++){
+            uint64_t key = weld_key(cell[0]+dx, cell[1]+dy, cell[2]+dz);
+            std::vector< std::pair<uint64_t, int> >::const_iterator it =
+              std::lower_bound(keys.begin(), keys.end(), std::pair<uint64_t, int>(key, 0));
+            for(;it!=keys.end() && it->first==key;++it){
+              int j = it->second;
+              if(j<=i)
+                continue;
+              double d2 = 0.0;
+              for(int k=0;k<3;k++)
+                d2 += (xyz[i*3+k]-xyz[j*3+k])*(xyz[i*3+k]-xyz[j*3+k]);
+              if(d2<=tol2)
+                local_pairs.push_back(std::pair<int, int>(i, j));
+            }
+          }
+        }
       }
-      
-      if(is_facet){
-	// Insert new facet.
-	for(int k=0;k<3;k++)
-	  facets.push_back(renumbering[facet[k]]);
-	
-	// Decide boundary id.
-	double mean_xyz[3];
-	for(int k=0;k<3;k++)
-	  mean_xyz[k] = (xyz[facet[0]*3+k]+xyz[facet[1]*3+k]+xyz[facet[2]*3+k])/3.0;
-	
-	if(fabs(mean_xyz[0]-bbox[0])<eta){
-	  facet_ids.push_back(1);
-	}else if(fabs(mean_xyz[0]-bbox[1])<eta){
-	  facet_ids.push_back(2);
-	}else if(fabs(mean_xyz[1]-bbox[2])<eta){
-	  facet_ids.push_back(3);
-	}else if(fabs(mean_xyz[1]-bbox[3])<eta){
-	  facet_ids.push_back(4);
-	}else if(fabs(mean_xyz[2]-bbox[4])<eta){
-	  facet_ids.push_back(5);
-	}else if(fabs(mean_xyz[2]-bbox[5])<eta){
-	  facet_ids.push_back(6);
-	}else{
-	  facet_ids.push_back(7);
-	}
+    }
+#pragma omp critical
+    pairs.insert(pairs.end(), local_pairs.begin(), local_pairs.end());
+  }
+  if(pairs.empty())
+    return 0;
+  std::vector< std::pair<uint64_t, int> >().swap(keys);
+
+  // Each node is merged into the lowest numbered node it is (transitively)
+  // close to. There are few pairs, so propagate the minimum until stable.
+  std::vector<int> renumbering(NNodes);
+  for(int i=0;i<NNodes;i++)
+    renumbering[i] = i;
+  for(bool changed=true;changed;){
+    changed = false;
+    for(auto &p : pairs){
+      int m = std::min(renumbering[p.first], renumbering[p.second]);
+      if(renumbering[p.first]!=m || renumbering[p.second]!=m){
+        renumbering[p.first] = renumbering[p.second] = m;
+        changed = true;
+      }
+    }
+  }
+
+  // Number the remaining nodes in order and compact xyz in place.
+  int cnt = 0;
+  for(int i=0;i<NNodes;i++){
+    if(renumbering[i]==i){
+      for(int k=0;k<3;k++)
+        xyz[cnt*3+k] = xyz[i*3+k];
+      renumbering[i] = cnt++;
+    }else{
+      renumbering[i] = renumbering[renumbering[i]];
+    }
+  }
+  xyz.resize(cnt*3);
+
+  // Remap the elements, masking any that have collapsed.
+#pragma omp parallel
+  {
+    ThreadSpan span("weld remap");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+      int n[4];
+      for(int j=0;j<4;j++)
+        n[j] = renumbering[tets[i*4+j]];
+      if(n[0]==n[1] || n[0]==n[2] || n[0]==n[3] || n[1]==n[2] || n[1]==n[3] || n[2]==n[3]){
+        tets[i*4] = -1;
+      }else{
+        for(int j=0;j<4;j++)
+          tets[i*4+j] = n[j];
       }
     }
   }
 
-  xyz.swap(xyz_new);
-  tets.swap(tets_new);
+  return NNodes-cnt;
+}
+
+int create_domain(int axis,
+		  std::vector<double> &xyz,
+                  std::vector<int> &tets, 
+                  std::vector<int> &facets,
+                  std::vector<int> &facet_ids){
+  std::vector<int> renumbering;
+  trim_domain(axis, xyz, tets, renumbering, facets, facet_ids);
+  compact_domain(renumbering, xyz, tets);
 
   return 0;
 }
@@ -417,10 +674,46 @@ double read_resolution_from_nhdr(std::string filename){
 }
 
    
-void read_tarantula_mesh_file(std::string filename, std::string nhdr_filename,
-                              bool toggle_material,
-                              std::vector<double> &xyz,
-                              std::vector<int> &tets){
+static inline const char *parse_number(const char *p, const char *end, double &value){
+  return parse_double(p, end, value);
+}
+
+template<typename T>
+static inline const char *parse_number(const char *p, const char *end, T &value){
+  long v;
+  p = parse_int(p, end, v);
+  value = v;
+  return p;
+}
+
+// Parse n lines of count numbers each, starting at line first, into
+// values. Chunks of lines are converted in parallel. Returns false if a
+// number is missing or malformed.
+template<typename T>
+static bool parse_lines(const LineIndex &lines, const char *end, size_t first, size_t n, int count, T *values){
+  const size_t chunk = 1<<14;
+  long nchunks = (n+chunk-1)/chunk;
+  bool ok = true;
+#pragma omp parallel reduction(&&:ok)
+  {
+    ThreadSpan span("parse");
+#pragma omp for schedule(dynamic) nowait
+    for(long c=0;c<nchunks;c++){
+      const char *p = lines.line(first+c*chunk);
+      size_t chunk_end = std::min(n, (c+1)*chunk);
+      for(size_t i=c*chunk*count;i<chunk_end*count && p!=NULL;i++)
+        p = parse_number(p, end, values[i]);
+      ok = ok && p!=NULL;
+    }
+  }
+  return ok;
+}
+
+int read_tarantula_mesh_file(std::string filename, std::string nhdr_filename,
+                             std::vector<double> &xyz,
+                             std::vector<int> &tets,
+                             std::vector<char> &phase){
+  ScopedStage stage("read");
 
   double resolution = 1.0;
   
@@ -429,96 +722,312 @@ void read_tarantula_mesh_file(std::string filename, std::string nhdr_filename,
     resolution = read_resolution_from_nhdr(nhdr_filename);
   }
 
-  // Read Tarantuala file
-  std::ifstream infile;
-  infile.open(filename.c_str());
-  
-  // Read header
-  std::string throwaway;
-  std::getline(infile, throwaway); // line 1
-  std::getline(infile, throwaway); // line 2
-  int NNodes;
-  infile>>NNodes;
-  
+  // Map the Tarantula file and index its lines. The layout is two header
+  // lines, the number of vertices and one vertex per line, two more lines
+  // and the number of elements followed by one element per line, and
+  // then the mat1 and mat2 element lists.
+  MappedFile infile(filename);
+  if(!infile.good())
+    return -1;
+  const char *end = infile.end();
+  LineIndex lines(infile.begin(), end);
+
   // Read vertices
+  long NNodes;
+  if(parse_int(lines.line(2), end, NNodes)==NULL || NNodes<0){
+    std::cerr<<"ERROR: Cannot read the number of vertices from "<<filename<<std::endl;
+    return -1;
+  }
   xyz.resize(NNodes*3);
-  for(int i=0;i<NNodes;i++){
-    infile>>xyz[i*3];
-    infile>>xyz[i*3+1]; 
-    infile>>xyz[i*3+2];
+  if(!parse_lines(lines, end, 3, NNodes, 3, xyz.data())){
+    std::cerr<<"ERROR: Failed to read the vertices from "<<filename<<std::endl;
+    return -1;
   }
 
   // Rescale if necessary.
   if(resolution!=1.0){
-    for(int i=0;i<NNodes*3;i++){
-      xyz[i]*=resolution;
+#pragma omp parallel
+    {
+      ThreadSpan span("rescale");
+#pragma omp for nowait
+      for(long i=0;i<NNodes*3;i++){
+        xyz[i]*=resolution;
+      }
     }
   }
 
-  // throwaway trash
-  std::getline(infile, throwaway); 
-  std::getline(infile, throwaway); 
-  std::getline(infile, throwaway);
-
   // Read elements
-  int NTetra, nloc;
-  infile>>NTetra;
+  long NTetra;
+  size_t tets_line = NNodes+5;
+  if(parse_int(lines.line(tets_line), end, NTetra)==NULL || NTetra<0){
+    std::cerr<<"ERROR: Cannot read the number of elements from "<<filename<<std::endl;
+    return -1;
+  }
+  std::vector<int> elements(NTetra*5);
+  if(!parse_lines(lines, end, tets_line+1, NTetra, 5, elements.data())){
+    std::cerr<<"ERROR: Failed to read the elements from "<<filename<<std::endl;
+    return -1;
+  }
   tets.resize(NTetra*4);
-  for(int i=0;i<NTetra;i++){
-    infile>>nloc;
-    assert(nloc==4);
-    infile>>tets[i*4];
-    infile>>tets[i*4+1];
-    infile>>tets[i*4+2];
-    infile>>tets[i*4+3];
+#pragma omp parallel
+  {
+    ThreadSpan span("copy elements");
+#pragma omp for nowait
+    for(long i=0;i<NTetra;i++){
+      assert(elements[i*5]==4);
+      for(int j=0;j<4;j++)
+        tets[i*4+j] = elements[i*5+j+1];
+    }
   }
+  std::vector<int>().swap(elements);
 
   // Read materials
-  std::vector< std::vector<size_t> > materials;
-  while(infile.good()){
+  int nmaterials = 0;
+  phase.assign(NTetra, 0);
+  size_t line = tets_line+1+NTetra;
+  const char *p = lines.line(line);
+  while(p<end){
     // Stream through file until we find material data.
-    std::getline(infile, throwaway); 
-    if(throwaway.substr(0, 4)!="mat1" && throwaway.substr(0, 4)!="mat2")
+    if(end-p<4 || (strncmp(p, "mat1", 4)!=0 && strncmp(p, "mat2", 4)!=0)){
+      p = next_line(p, end);
+      line++;
       continue;
+    }
 
-    // Junk next line.
-    std::getline(infile, throwaway);
-    
-    // Get number of cells of this material
-    size_t cnt;
-    infile>>cnt;
+    // Junk next line and get number of cells of this material
+    long cnt;
+    if(parse_int(lines.line(line+2), end, cnt)==NULL || cnt<0){
+      std::cerr<<"ERROR: Cannot read the size of a material list from "<<filename<<std::endl;
+      return -1;
+    }
     std::vector<size_t> cells(cnt);
-    for(int i=0;i<cnt;i++)
-      infile>>cells[i];
-    materials.push_back(cells);
+    if(!parse_lines(lines, end, line+3, cnt, 1, cells.data())){
+      std::cerr<<"ERROR: Failed to read a material list from "<<filename<<std::endl;
+      return -1;
+    }
+    nmaterials++;
+#pragma omp parallel
+    {
+      ThreadSpan span("materials");
+#pragma omp for nowait
+      for(long i=0;i<cnt;i++){
+        if(cells[i]<(size_t)NTetra)
+          phase[cells[i]] = nmaterials;
+      }
+    }
+
+    line += 3+cnt;
+    p = lines.line(line);
   }
+  stage.set_count(tets.size()/4);
+
+  return nmaterials;
+}
 
-  // Junking the rest of the file.
-  infile.close();
+int read_tarantula_mesh_file(std::string filename, std::string nhdr_filename,
+                             bool toggle_material,
+                             std::vector<double> &xyz,
+                             std::vector<int> &tets){
+  std::vector<char> phase;
+  int nmaterials = read_tarantula_mesh_file(filename, nhdr_filename, xyz, tets, phase);
+  if(nmaterials<0)
+    return -1;
 
-  if(materials.size()>1){
-    assert(materials.size()==2);
-    size_t select=0;
+  if(nmaterials>1){
+    assert(nmaterials==2);
+    char select=1;
     if(toggle_material)
-      select = 1;
+      select = 2;
 
-    // Create the mask.
-    std::vector<bool> mask(NTetra, false);
-    for(std::vector<size_t>::const_iterator it=materials[select].begin();it!=materials[select].end();++it){
-      mask[*it] = true;
+    // Turn off masked tets.
+    int NTetra = tets.size()/4;
+#pragma omp parallel
+    {
+      ThreadSpan span("mask phase");
+#pragma omp for nowait
+      for(int i=0;i<NTetra;i++){
+        if(phase[i]==select)
+          tets[i*4] = -1;
+      }
     }
+  }
 
-    // Turn off masked tets.
-    for(size_t i=0;i<NTetra;i++){
-      if(mask[i])
-        tets[i*4] = -1;
+  return 0;
+}
+
+// Data types of legacy VTK arrays.
+enum LegacyType{LEGACY_UNKNOWN, LEGACY_FLOAT, LEGACY_DOUBLE, LEGACY_INT32, LEGACY_INT64, LEGACY_UINT8};
+
+static LegacyType legacy_type(const std::string &type){
+  if(type=="float")
+    return LEGACY_FLOAT;
+  else if(type=="double")
+    return LEGACY_DOUBLE;
+  else if(type=="int" || type=="unsigned_int" || type=="vtktypeint32")
+    return LEGACY_INT32;
+  else if(type=="long" || type=="unsigned_long" || type=="vtktypeint64" || type=="vtkIdType")
+    return LEGACY_INT64;
+  else if(type=="unsigned_char")
+    return LEGACY_UINT8;
+  return LEGACY_UNKNOWN;
+}
+
+// Read one value of a legacy VTK array, either as text or as big endian
+// binary. Returns NULL if the data ends early or is malformed.
+template<typename T>
+static const char *read_legacy_value(const char *p, const char *end, bool binary, LegacyType type, T &value){
+  if(!binary)
+    return parse_number(p, end, value);
+
+  int size = type==LEGACY_UINT8?1:(type==LEGACY_FLOAT || type==LEGACY_INT32)?4:8;
+  if(end-p<size)
+    return NULL;
+  unsigned char bytes[8];
+  for(int i=0;i<size;i++)
+    bytes[i] = p[size-1-i];
+
+  if(type==LEGACY_FLOAT){
+    float v;
+    memcpy(&v, bytes, 4);
+    value = v;
+  }else if(type==LEGACY_DOUBLE){
+    double v;
+    memcpy(&v, bytes, 8);
+    value = v;
+  }else if(type==LEGACY_INT32){
+    int32_t v;
+    memcpy(&v, bytes, 4);
+    value = v;
+  }else if(type==LEGACY_INT64){
+    int64_t v;
+    memcpy(&v, bytes, 8);
+    value = v;
+  }else{
+    value = bytes[0];
+  }
+
+  return p+size;
+}
+
+static const char *read_legacy_word(const char *p, const char *end, std::string &word){
+  while(p<end && isspace(*p))
+    p++;
+  const char *start = p;
+  while(p<end && !isspace(*p))
+    p++;
+  word.assign(start, p);
+  return p;
+}
+
+// Read the cells of a POLYGONS or CELLS section, either in the classic
+// layout (the number of points of each cell followed by its points) or
+// in the OFFSETS/CONNECTIVITY layout of file version 5. Each cell is
+// handed to visit(cell, npts, pts) as soon as it is read, so that the
+// connectivity is never held in memory. visit returns false to stop.
+template<typename F>
+static const char *read_legacy_cells(const char *p, const char *end, bool binary, F visit){
+  long n, size;
+  p = parse_int(p, end, n);
+  if(p!=NULL)
+    p = parse_int(p, end, size);
+  if(p==NULL || n<0)
+    return NULL;
+
+  long pts[8];
+  std::string word, type;
+  const char *q = read_legacy_word(p, end, word);
+  if(word=="OFFSETS"){
+    p = read_legacy_word(q, end, type);
+    LegacyType offsets_type = legacy_type(type);
+    if(offsets_type==LEGACY_UNKNOWN)
+      return NULL;
+    if(binary)
+      p = next_line(p, end);
+    std::vector<long> offsets(n);
+    for(long i=0;i<n && p!=NULL;i++)
+      p = read_legacy_value(p, end, binary, offsets_type, offsets[i]);
+    if(p==NULL)
+      return NULL;
+
+    p = read_legacy_word(p, end, word);
+    p = read_legacy_word(p, end, type);
+    LegacyType connectivity_type = legacy_type(type);
+    if(word!="CONNECTIVITY" || connectivity_type==LEGACY_UNKNOWN)
+      return NULL;
+    if(binary)
+      p = next_line(p, end);
+    for(long i=0;i+1<n && p!=NULL;i++){
+      long npts = offsets[i+1]-offsets[i];
+      if(npts<0 || npts>8)
+        return NULL;
+      for(long j=0;j<npts && p!=NULL;j++)
+        p = read_legacy_value(p, end, binary, connectivity_type, pts[j]);
+      if(p!=NULL && !visit(i, npts, pts))
+        return NULL;
+    }
+  }else{
+    if(binary)
+      p = next_line(p, end);
+    for(long i=0;i<n && p!=NULL;i++){
+      long npts;
+      p = read_legacy_value(p, end, binary, LEGACY_INT32, npts);
+      if(p==NULL || npts<0 || npts>8)
+        return NULL;
+      for(long j=0;j<npts && p!=NULL;j++)
+        p = read_legacy_value(p, end, binary, LEGACY_INT32, pts[j]);
+      if(p!=NULL && !visit(i, npts, pts))
+        return NULL;
+    }
+  }
+
+  return p;
+}
+
+// Read the tetrahedra of a VTK XML unstructured grid.
+static int read_vtu_mesh_file(std::string filename, std::vector<double> &xyz, std::vector<int> &tets){
+  vtkSmartPointer<vtkXMLUnstructuredGridReader> reader = vtkSmartPointer<vtkXMLUnstructuredGridReader>::New();
+  reader->SetFileName(filename.c_str());
+  reader->Update();
+  vtkUnstructuredGrid *ug = reader->GetOutput();
+
+  vtkIdType NNodes = ug->GetNumberOfPoints();
+  if(NNodes==0){
+    std::cerr<<"ERROR: Cannot read a mesh from "<<filename<<std::endl;
+    return -1;
+  }
+  vtkDataArray *points = ug->GetPoints()->GetData();
+  xyz.resize(NNodes*3);
+  for(vtkIdType i=0;i<NNodes;i++)
+    points->GetTuple(i, xyz.data()+i*3);
+
+  // Walk the connectivity directly rather than through vtkCell objects.
+  vtkCellArray *cells = ug->GetCells();
+  vtkIdType NCells = ug->GetNumberOfCells();
+  tets.resize(NCells*4);
+  vtkIdType npts;
+#if VTK_MAJOR_VERSION>=9
+  const vtkIdType *pts;
+#else
+  vtkIdType *pts;
+#endif
+  cells->InitTraversal();
+  for(vtkIdType i=0;cells->GetNextCell(npts, pts);i++){
+    int cell_type = ug->GetCellType(i);
+    if(cell_type!=VTK_TETRA){
+      std::cerr<<"ERROR("<<__FILE__<<"): unsupported element type.\n";
+      return -1;
     }
+    for(int j=0;j<4;j++)
+      tets[i*4+j] = pts[j];
   }
+
+  return 0;
 }
 
-void read_vtk_mesh_file(std::string filename, std::string nhdr_filename,
+int read_vtk_mesh_file(std::string filename, std::string nhdr_filename,
                        std::vector<double> &xyz,
                        std::vector<int> &tets){
+  ScopedStage stage("read");
 
   double resolution = 1.0;
   
@@ -527,49 +1036,190 @@ void read_vtk_mesh_file(std::string filename, std::string nhdr_filename,
     resolution = read_resolution_from_nhdr(nhdr_filename);
   } 
 
-  // Read VTK file
-  vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
-  reader->SetFileName(filename.c_str());
-  reader->Update();
+  xyz.clear();
+  tets.clear();
+  if(filename.size()>4 && filename.substr(filename.size()-4)==".vtu"){
+    if(read_vtu_mesh_file(filename, xyz, tets)<0)
+      return -1;
+  }else{
+    // Parse the legacy VTK file directly: the header is the version and
+    // title lines, ASCII or BINARY and the dataset type.
+    MappedFile infile(filename);
+    if(!infile.good())
+      return -1;
+    const char *end = infile.end();
+    const char *p = next_line(next_line(infile.begin(), end), end);
 
-  vtkSmartPointer<vtkPolyData> pd = vtkSmartPointer<vtkPolyData>::New();
-  pd->DeepCopy(reader->GetOutput());
+    std::string word, dataset;
+    p = read_legacy_word(p, end, word);
+    bool binary = word=="BINARY";
+    if(!binary && word!="ASCII"){
+      std::cerr<<"ERROR: "<<filename<<" is not a legacy VTK file."<<std::endl;
+      return -1;
+    }
+    p = read_legacy_word(p, end, word);
+    p = read_legacy_word(p, end, dataset);
+    if(word!="DATASET" || (dataset!="POLYDATA" && dataset!="UNSTRUCTURED_GRID")){
+      std::cerr<<"ERROR: Unsupported VTK dataset in "<<filename<<". Expected POLYDATA or UNSTRUCTURED_GRID."<<std::endl;
+      return -1;
+    }
 
-  // Read vertices
-  int NNodes = pd->GetNumberOfPoints();
-  xyz.resize(NNodes*3);
-  for(int i=0;i<NNodes;i++){
-    pd->GetPoints()->GetPoint(i, xyz.data()+i*3);
+    bool unsupported = false;
+    while(p!=NULL && p<end){
+      p = read_legacy_word(p, end, word);
+      if(word=="POINTS"){
+        long NNodes;
+        std::string type;
+        p = parse_int(p, end, NNodes);
+        p = p==NULL?NULL:read_legacy_word(p, end, type);
+        LegacyType points_type = legacy_type(type);
+        if(p==NULL || NNodes<0 || points_type==LEGACY_UNKNOWN){
+          p = NULL;
+          break;
+        }
+        if(binary)
+          p = next_line(p, end);
+        xyz.resize(NNodes*3);
+        for(long i=0;i<NNodes*3 && p!=NULL;i++)
+          p = read_legacy_value(p, end, binary, points_type, xyz[i]);
+      }else if(word=="POLYGONS" && dataset=="POLYDATA"){
+        // Cleaver writes out tetrahedra by writing 4 facets, the first
+        // two of which hold all four nodes.
+        p = read_legacy_cells(p, end, binary, [&](long i, long npts, const long *pts){
+            if(npts!=3){
+              unsupported = true;
+              return false;
+            }
+            if(i%4==0){
+              for(int j=0;j<3;j++)
+                tets.push_back(pts[j]);
+            }else if(i%4==1){
+              tets.push_back(pts[2]);
+            }
+            return true;
+          });
+      }else if(word=="CELLS" && dataset=="UNSTRUCTURED_GRID"){
+        p = read_legacy_cells(p, end, binary, [&](long i, long npts, const long *pts){
+            if(npts!=4){
+              unsupported = true;
+              return false;
+            }
+            for(int j=0;j<4;j++)
+              tets.push_back(pts[j]);
+            return true;
+          });
+      }else if(word=="CELL_TYPES"){
+        long NCells;
+        p = parse_int(p, end, NCells);
+        if(p!=NULL && binary)
+          p = next_line(p, end);
+        for(long i=0;i<NCells && p!=NULL;i++){
+          long type;
+          p = read_legacy_value(p, end, binary, LEGACY_INT32, type);
+          if(p!=NULL && type!=VTK_TETRA){
+            unsupported = true;
+            p = NULL;
+          }
+        }
+      }else if(word.empty() || word=="POINT_DATA" || word=="CELL_DATA" || word=="METADATA" || word=="FIELD"){
+        // Nothing more of interest.
+        break;
+      }else{
+        unsupported = true;
+        p = NULL;
+      }
+    }
+
+    if(unsupported){
+      std::cerr<<"ERROR("<<__FILE__<<"): unsupported element type.\n";
+      return -1;
+    }
+    if(p==NULL || tets.size()%4){
+      std::cerr<<"ERROR: Failed to read "<<filename<<std::endl;
+      return -1;
+    }
   }
 
   // Rescale if necessary.
   if(resolution!=1.0){
-    for(int i=0;i<NNodes*3;i++){
-      xyz[i]*=resolution;
+    size_t NNodes = xyz.size()/3;
+#pragma omp parallel
+    {
+      ThreadSpan span("rescale");
+#pragma omp for nowait
+      for(size_t i=0;i<NNodes*3;i++){
+        xyz[i]*=resolution;
+      }
     }
   }
+  stage.set_count(tets.size()/4);
 
-  // Read facets - cleaver writes out tetrahedra by writing 4 facets..
-  int nfacets = pd->GetNumberOfCells();
-  for(int i=0;i<nfacets;i+=4){
-    for(int j=0;j<4;j++){
-      int cell_type = pd->GetCell(i+j)->GetCellType();
-      if(cell_type!=VTK_TRIANGLE){
-        std::cerr<<"ERROR("<<__FILE__<<"): unsupported element type.\n";
-        exit(-1);
-      }
-    }
+  return 0;
+}
 
-    vtkCell *cell0 = pd->GetCell(i);
-    for(int j=0;j<3;j++){
-      tets.push_back(cell0->GetPointId(j));
-    }
-     
-    vtkCell *cell1 = pd->GetCell(i+1);
-    tets.push_back(cell1->GetPointId(2));
+// Copy a block of memory using all threads.
+static void parallel_copy(char *dest, const char *src, size_t size){
+  const size_t block = 1<<20;
+  long nblocks = (size+block-1)/block;
+#pragma omp parallel
+  {
+    ThreadSpan span("copy");
+#pragma omp for nowait
+    for(long i=0;i<nblocks;i++)
+      memcpy(dest+i*block, src+i*block, std::min(block, size-i*block));
   }
 }
 
+int read_binary_mesh_file(std::string filename, std::vector<double> &xyz, std::vector<int> &tets,
+                          std::vector<int> &facets, std::vector<int> &facet_ids, double *resolution){
+  ScopedStage stage("read");
+
+  MappedFile infile(filename);
+  if(!infile.good())
+    return -1;
+  const char *buffer = infile.begin();
+  size_t file_size = infile.size();
+  if(file_size<PFM_HEADER_SIZE){
+    std::cerr<<"ERROR: "<<filename<<" is not a native binary mesh file."<<std::endl;
+    return -1;
+  }
+
+  uint32_t version, byte_order;
+  int64_t NNodes, NTetra, NFacets;
+  uint64_t offsets[4];
+  memcpy(&version, buffer+8, 4);
+  memcpy(&byte_order, buffer+12, 4);
+  memcpy(&NNodes, buffer+16, 8);
+  memcpy(&NTetra, buffer+24, 8);
+  memcpy(&NFacets, buffer+32, 8);
+  memcpy(offsets, buffer+56, sizeof(offsets));
+
+  uint64_t sizes[] = {NNodes*3*sizeof(double), NTetra*4*sizeof(int), NFacets*3*sizeof(int), NFacets*sizeof(int)};
+  bool valid = memcmp(buffer, "PFMESH\0\0", 8)==0 && version==1 && byte_order==0x01020304 &&
+    memcmp(buffer+48, "<f8", 3)==0 && memcmp(buffer+52, "<i4", 3)==0;
+  for(int i=0;i<4 && valid;i++)
+    valid = offsets[i]+sizes[i]<=file_size;
+  if(!valid){
+    std::cerr<<"ERROR: "<<filename<<" is not a valid native binary mesh file for this machine."<<std::endl;
+    return -1;
+  }
+
+  if(resolution!=NULL)
+    memcpy(resolution, buffer+40, 8);
+
+  xyz.resize(NNodes*3);
+  tets.resize(NTetra*4);
+  facets.resize(NFacets*3);
+  facet_ids.resize(NFacets);
+  parallel_copy((char *)xyz.data(), buffer+offsets[0], sizes[0]);
+  parallel_copy((char *)tets.data(), buffer+offsets[1], sizes[1]);
+  parallel_copy((char *)facets.data(), buffer+offsets[2], sizes[2]);
+  parallel_copy((char *)facet_ids.data(), buffer+offsets[3], sizes[3]);
+  stage.set_count(NTetra);
+
+  return 0;
+}
+
 double volume(const double *x0, const double *x1, const double *x2, const double *x3){
 
   double x01 = (x0[0] - x1[0]);
@@ -588,3 +1238,122 @@ double volume(const double *x0, const double *x1, const double *x2, const double
 }
 
 
+
+double quality(const double *x0, const double *x1, const double *x2, const double *x3){
+  const double *x[] = {x0, x1, x2, x3};
+
+  double l2 = 0.0;
+  for(int i=0;i<4;i++){
+    for(int j=i+1;j<4;j++){
+      for(int k=0;k<3;k++){
+        double d = x[i][k]-x[j][k];
+        l2 += d*d;
+      }
+    }
+  }
+  double l_rms = sqrt(l2/6.0);
+  if(l_rms==0.0)
+    return 0.0;
+
+  return 6.0*sqrt(2.0)*volume(x0, x1, x2, x3)/(l_rms*l_rms*l_rms);
+}
+
+void create_node_adjacency(size_t NNodes, const std::vector<int> &tets,
+                           std::vector<int> &NNList_offsets, std::vector<int> &NNList){
+  int NTetra = tets.size()/4;
+
+  // Each node of a tetrahedron has 3 edges within that element. Count
+  // these (including duplicates) to size the rows.
+  std::vector<int> count(NNodes+1, 0);
+#pragma omp parallel
+  {
+    ThreadSpan span("count edges");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+
+      for(int j=0;j<4;j++){
+  #pragma omp atomic
+        count[tets[i*4+j]+1]+=3;
+      }
+    }
+  }
+  for(size_t i=0;i<NNodes;i++)
+    count[i+1] += count[i];
+
+  std::vector<int> cursor(count.begin(), count.end()-1);
+  std::vector<int> buffer(count[NNodes]);
+#pragma omp parallel
+  {
+    ThreadSpan span("fill edges");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+
+      for(int j=0;j<4;j++){
+        int pos;
+  #pragma omp atomic capture
+        {pos = cursor[tets[i*4+j]]; cursor[tets[i*4+j]]+=3;}
+
+        for(int k=1;k<4;k++)
+          buffer[pos+k-1] = tets[i*4+(j+k)%4];
+      }
+    }
+  }
+
+  // Sort each row and remove the duplicates.
+  std::vector<int> row_size(NNodes+1, 0);
+#pragma omp parallel
+  {
+    ThreadSpan span("sort edges");
+#pragma omp for schedule(static, 1024) nowait
+    for(size_t i=0;i<NNodes;i++){
+      std::vector<int>::iterator begin = buffer.begin()+count[i];
+      std::sort(begin, buffer.begin()+count[i+1]);
+      row_size[i+1] = std::unique(begin, buffer.begin()+count[i+1])-begin;
+    }
+  }
+
+  NNList_offsets.resize(NNodes+1);
+  NNList_offsets[0] = 0;
+  for(size_t i=0;i<NNodes;i++)
+    NNList_offsets[i+1] = NNList_offsets[i]+row_size[i+1];
+
+  NNList.resize(NNList_offsets[NNodes]);
+#pragma omp parallel
+  {
+    ThreadSpan span("copy edges");
+#pragma omp for schedule(static, 1024) nowait
+    for(size_t i=0;i<NNodes;i++){
+      std::copy(buffer.begin()+count[i], buffer.begin()+count[i]+row_size[i+1],
+                NNList.begin()+NNList_offsets[i]);
+    }
+  }
+}
+
+void create_node_element_adjacency(size_t NNodes, const std::vector<int> &tets,
+                                   std::vector<int> &NEList_offsets, std::vector<int> &NEList){
+  int NTetra = tets.size()/4;
+
+  NEList_offsets.assign(NNodes+1, 0);
+  for(int i=0;i<NTetra;i++){
+    if(tets[i*4]==-1)
+      continue;
+    for(int j=0;j<4;j++)
+      NEList_offsets[tets[i*4+j]+1]++;
+  }
+  for(size_t i=0;i<NNodes;i++)
+    NEList_offsets[i+1] += NEList_offsets[i];
+
+  // Filling in element order keeps each row sorted.
+  NEList.resize(NEList_offsets[NNodes]);
+  std::vector<int> cursor(NEList_offsets.begin(), NEList_offsets.end()-1);
+  for(int i=0;i<NTetra;i++){
+    if(tets[i*4]==-1)
+      continue;
+    for(int j=0;j<4;j++)
+      NEList[cursor[tets[i*4+j]]++] = i;
+  }
+}
@@ -41,22 +41,36 @@
 #include <getopt.h>
 
 #include "CTImage.h"
+#include "run_report.h"
 
 void usage(char *cmd){
   std::cout<<"Usage: "<<cmd<<" CT-image [options]\n"
            <<"\nOptions:\n"
            <<" -h, --help\n\tHelp! Prints this message.\n"
            <<" -v, --verbose\n\tVerbose output.\n"
-           <<" -s width, --slab width\n\tExtract a square block of size 'width' from the data.\n";
+           <<" -s width, --slab width\n\tExtract a square block of size 'width' from the data.\n"
+           <<" -r method, --reorder method\n\tRenumber the mesh to improve cache locality before it is written. Options are rcm, hilbert.\n"
+           <<" -R levels, --refine levels\n\tUniformly refine the mesh, splitting each element into 8, this many times.\n"
+           <<" -b, --binary\n\tWrite a binary GMSH file.\n"
+           <<" -u, --combined-vtu\n\tWith -v, write the elements and facets to a single VTU file.\n"
+           <<" -S, --stats\n\tWrite mesh quality and geometry statistics to a JSON file.\n"
+           <<" -J file, --report file\n\tWrite a JSON report of the time and memory used by each stage of the run.\n"
+           <<" -E file, --trace file\n\tWrite a timeline of the stages and of each thread in the parallel regions (Chrome trace format, for Perfetto).\n"
+           <<" -K, --counters\n\tAlso count the cycles, instructions and cache, TLB and branch misses of each stage in the report (Linux perf events). Needs -J.\n";
   return;
 }
 
 int parse_arguments(int argc, char **argv,
-                    std::string &filename, bool &verbose, int &slab_width){
+                    std::string &filename, bool &verbose, int &slab_width, std::string &reorder, int &refine, bool &stats, bool &binary, bool &combined_vtu, std::string &report, std::string &trace, bool &counters){
 
   // Set defaults
+  counters = false;
   verbose = false;
   slab_width = -1;
+  refine = 0;
+  stats = false;
+  binary = false;
+  combined_vtu = false;
 
   if(argc==1){
     usage(argv[0]);
@@ -67,13 +81,21 @@ int parse_arguments(int argc, char **argv,
     {"help",    0,                 0, 'h'},
     {"verbose", 0,                 0, 'v'},
     {"slab",    optional_argument, 0, 's'},
+    {"reorder", required_argument, 0, 'r'},
+    {"refine",  required_argument, 0, 'R'},
+    {"stats",   0,                 0, 'S'},
+    {"binary",  0,                 0, 'b'},
+    {"combined-vtu", 0,            0, 'u'},
+    {"report",  required_argument, 0, 'J'},
+    {"trace",   required_argument, 0, 'E'},
+    {"counters", 0,                0, 'K'},
     {0, 0, 0, 0}
   };
 
   int optionIndex = 0;
   int verbosity = 0;
   int c;
-  const char *shortopts = "hvs:";
+  const char *shortopts = "hvs:r:R:SbuJ:E:K";
 
   // Set opterr to nonzero to make getopt print error messages
   opterr=1;
@@ -92,6 +114,30 @@ int parse_arguments(int argc, char **argv,
     case 's':
       slab_width = atoi(optarg);
       break;    
+    case 'r':
+      reorder = std::string(optarg);
+      break;
+    case 'R':
+      refine = atoi(optarg);
+      break;
+    case 'S':
+      stats = true;
+      break;
+    case 'b':
+      binary = true;
+      break;
+    case 'u':
+      combined_vtu = true;
+      break;
+    case 'J':
+      report = std::string(optarg);
+      break;
+    case 'E':
+      trace = std::string(optarg);
+      break;
+    case 'K':
+      counters = true;
+      break;
     case '?':
       // missing argument only returns ':' if the option string starts with ':'
       // but this seems to stop the printing of error messages by getopt?
@@ -111,6 +157,11 @@ int parse_arguments(int argc, char **argv,
 
   filename = std::string(argv[argc-1]);
 
+  if(counters && report.empty()){
+    std::cerr<<"ERROR: --counters adds the counts to the run report, so it needs --report.\n";
+    exit(-1);
+  }
+
   return 0;
 }
 
@@ -120,11 +171,19 @@ int main(int argc, char **argv){
     exit(-1);
   }
     
-  std::string filename;
-  bool verbose;
-  int slab_width;
+  std::string filename, reorder;
+  bool verbose, stats, binary, combined_vtu;
+  int slab_width, refine;
   int offsets[] = {0,0,0};
-  parse_arguments(argc, argv, filename, verbose, slab_width);
+  std::string report, trace;
+  bool counters;
+  parse_arguments(argc, argv, filename, verbose, slab_width, reorder, refine, stats, binary, combined_vtu, report, trace, counters);
+  if(!report.empty())
+    start_run_report(report, argc, argv);
+  if(!trace.empty())
+    start_trace(trace, argc, argv);
+  if(counters)
+    start_counters();
 
   CTImage image;
   if(verbose)
@@ -144,17 +203,46 @@ int main(int argc, char **argv){
     std::cout<<"INFO: Trim disconnected regions.\n";
 
   image.trim_channels(1, 2);
+
+  if(refine>0){
+    if(verbose)
+      std::cout<<"INFO: Refine mesh.\n";
+
+    image.refine(refine);
+  }
+
+  if(!reorder.empty()){
+    if(verbose)
+      std::cout<<"INFO: Reorder mesh.\n";
+
+    if(image.reorder(reorder)<0)
+      exit(-1);
+  }
     
+  if(stats){
+    if(verbose)
+      std::cout<<"INFO: Write out mesh statistics.\n";
+
+    if(image.write_statistics()<0)
+      exit(-1);
+  }
+
   if(verbose){
     std::cout<<"INFO: Write out VTK file.\n";
 
-    image.write_vtu();
+    image.write_vtu(NULL, combined_vtu);
   }
 
+  report_value("porosity", image.get_porosity());
+  report_value("nodes", image.get_xyz().size()/3);
+  report_value("elements", image.get_tets().size()/4);
+  report_value("facets", image.get_facet_ids().size());
+
   if(verbose)
     std::cout<<"INFO: Write out GMSH file.\n";
 
-  image.write_gmsh();
+  if(image.write_gmsh(NULL, binary)<0)
+    exit(-1);
 
   return 0;
 }
@@ -0,0 +1,448 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cmath>
+
+#ifdef HAVE_METIS
+#include <metis.h>
+#endif
+
+#include "writers.h"
+#include "mesh_conversion.h"
+#include "mesh_partition.h"
+#include "run_report.h"
+
+// Calculate the direction along which to bisect a set of points. For
+// coordinate bisection this is the longest side of the bounding box,
+// for inertial bisection the principal axis of inertia.
+static void bisection_direction(bool inertial, const std::vector<double> &centroids,
+                                std::vector<int>::const_iterator begin,
+                                std::vector<int>::const_iterator end,
+                                double direction[]){
+  double bbox[] = {centroids[*begin*3],   centroids[*begin*3],
+                   centroids[*begin*3+1], centroids[*begin*3+1],
+                   centroids[*begin*3+2], centroids[*begin*3+2]};
+  double mean[] = {0.0, 0.0, 0.0};
+  for(std::vector<int>::const_iterator it=begin;it!=end;++it){
+    for(int j=0;j<3;j++){
+      bbox[j*2  ] = std::min(bbox[j*2  ], centroids[*it*3+j]);
+      bbox[j*2+1] = std::max(bbox[j*2+1], centroids[*it*3+j]);
+      mean[j] += centroids[*it*3+j];
+    }
+  }
+
+  int axis = 0;
+  for(int j=1;j<3;j++){
+    if(bbox[j*2+1]-bbox[j*2] > bbox[axis*2+1]-bbox[axis*2])
+      axis = j;
+  }
+  for(int j=0;j<3;j++)
+    direction[j] = (j==axis)?1.0:0.0;
+
+  if(!inertial)
+    return;
+
+  // Covariance of the centroids.
+  size_t n = end-begin;
+  for(int j=0;j<3;j++)
+    mean[j]/=n;
+
+  double I[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  for(std::vector<int>::const_iterator it=begin;it!=end;++it){
+    double d[3];
+    for(int j=0;j<3;j++)
+      d[j] = centroids[*it*3+j]-mean[j];
+    for(int j=0;j<3;j++)
+      for(int k=0;k<3;k++)
+        I[j*3+k] += d[j]*d[k];
+  }
+
+  // Power iteration for the principal eigenvector, starting from the
+  // longest axis of the bounding box.
+  for(int iter=0;iter<32;iter++){
+    double v[3];
+    for(int j=0;j<3;j++)
+      v[j] = I[j*3]*direction[0]+I[j*3+1]*direction[1]+I[j*3+2]*direction[2];
+    double norm = sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+    if(norm==0.0)
+      break;
+    for(int j=0;j<3;j++)
+      direction[j] = v[j]/norm;
+  }
+}
+
+// Recursively bisect the elements in [begin, end) into nparts
+// partitions numbered from part0.
+static void recursive_bisection(bool inertial, const std::vector<double> &centroids,
+                                std::vector<int>::iterator begin, std::vector<int>::iterator end,
+                                int part0, int nparts, std::vector<int> &epart){
+  if(nparts==1 || end-begin<2){
+    for(std::vector<int>::iterator it=begin;it!=end;++it)
+      epart[*it] = part0;
+    return;
+  }
+
+  double direction[3];
+  bisection_direction(inertial, centroids, begin, end, direction);
+
+  // Split in proportion to the number of partitions on either side.
+  int nleft = nparts/2;
+  std::vector<int>::iterator middle = begin+(size_t)((double)(end-begin)*nleft/nparts);
+  std::nth_element(begin, middle, end,
+                   [&centroids, &direction](int a, int b){
+                     return (centroids[a*3]*direction[0]+centroids[a*3+1]*direction[1]+centroids[a*3+2]*direction[2]) <
+                       (centroids[b*3]*direction[0]+centroids[b*3+1]*direction[1]+centroids[b*3+2]*direction[2]);
+                   });
+
+#pragma omp task default(shared) if(end-begin>10000)
+  recursive_bisection(inertial, centroids, begin, middle, part0, nleft, epart);
+  recursive_bisection(inertial, centroids, middle, end, part0+nleft, nparts-nleft, epart);
+#pragma omp taskwait
+}
+
+int partition_mesh(std::string method, int nparts,
+                   const std::vector<double> &xyz,
+                   const std::vector<int> &tets,
+                   const std::vector<int> &EEList,
+                   std::vector<int> &epart){
+  ScopedStage stage("partition");
+
+  int NTetra = tets.size()/4;
+  epart.assign(NTetra, -1);
+
+  if(nparts<1){
+    std::cerr<<"ERROR: Number of partitions must be positive."<<std::endl;
+    return -1;
+  }
+
+  std::vector<int> elements;
+  elements.reserve(NTetra);
+  for(int i=0;i<NTetra;i++){
+    if(tets[i*4]!=-1)
+      elements.push_back(i);
+  }
+
+  if(method=="rcb" || method=="rib"){
+    std::vector<double> centroids(NTetra*3);
+#pragma omp parallel
+    {
+      ThreadSpan span("centroids");
+#pragma omp for nowait
+      for(int i=0;i<NTetra;i++){
+        if(tets[i*4]==-1)
+          continue;
+        for(int j=0;j<3;j++)
+          centroids[i*3+j] = (xyz[tets[i*4]*3+j]+xyz[tets[i*4+1]*3+j]+
+                              xyz[tets[i*4+2]*3+j]+xyz[tets[i*4+3]*3+j])*0.25;
+      }
+    }
+
+#pragma omp parallel
+    {
+      ThreadSpan span("bisection");
+#pragma omp single
+      recursive_bisection(method=="rib", centroids, elements.begin(), elements.end(), 0, nparts, epart);
+    }
+  }else if(method=="metis"){
+#ifdef HAVE_METIS
+    if(nparts==1){
+      for(std::vector<int>::const_iterator it=elements.begin();it!=elements.end();++it)
+        epart[*it] = 0;
+      return 0;
+    }
+
+    // Compressed dual graph over the active elements.
+    std::vector<int> local(NTetra, -1);
+    for(size_t i=0;i<elements.size();i++)
+      local[elements[i]] = i;
+
+    std::vector<idx_t> xadj(1, 0), adjncy;
+    for(std::vector<int>::const_iterator it=elements.begin();it!=elements.end();++it){
+      for(int j=0;j<4;j++){
+        int eid = EEList[*it*4+j];
+        if(eid!=-1 && local[eid]!=-1)
+          adjncy.push_back(local[eid]);
+      }
+      xadj.push_back(adjncy.size());
+    }
+
+    idx_t nvtxs = elements.size(), ncon = 1, np = nparts, objval;
+    idx_t options[METIS_NOPTIONS];
+    METIS_SetDefaultOptions(options);
+    options[METIS_OPTION_NUMBERING] = 0;
+
+    std::vector<idx_t> part(elements.size());
+    if(METIS_PartGraphKway(&nvtxs, &ncon, xadj.data(), adjncy.data(), NULL, NULL, NULL,
+                           &np, NULL, NULL, options, &objval, part.data())!=METIS_OK){
+      std::cerr<<"ERROR: METIS failed to partition the mesh."<<std::endl;
+      return -1;
+    }
+
+    for(size_t i=0;i<elements.size();i++)
+      epart[elements[i]] = part[i];
+#else
+    std::cerr<<"ERROR: poreflow was compiled without METIS. Use either rcb or rib."<<std::endl;
+    return -1;
+#endif
+  }else{
+    std::cerr<<"ERROR: Unknown partitioning method: "<<method<<". Expecting rcb, rib or metis."<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+int partition_edge_cut(const std::vector<int> &EEList, const std::vector<int> &epart){
+  int NTetra = epart.size();
+  int cut = 0;
+#pragma omp parallel reduction(+:cut)
+  {
+    ThreadSpan span("edge cut");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(epart[i]==-1)
+        continue;
+
+      for(int j=0;j<4;j++){
+        int eid = EEList[i*4+j];
+        if(eid>i && epart[eid]!=-1 && epart[eid]!=epart[i])
+          cut++;
+      }
+    }
+  }
+
+  return cut;
+}
+
+int write_partitioned_gmsh_files(std::string basename, int nparts,
+                                 const std::vector<int> &epart,
+                                 const std::vector<double> &xyz,
+                                 const std::vector<int> &tets,
+                                 const std::vector<int> &facets,
+                                 const std::vector<int> &facet_ids,
+                                 bool binary){
+  ScopedStage stage("write_partitions");
+
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  int NFacets = facet_ids.size();
+
+  std::vector<int> NEList_offsets, NEList;
+  create_node_element_adjacency(NNodes, tets, NEList_offsets, NEList);
+
+  // A node is owned by the lowest numbered partition it touches.
+  std::vector<int> node_owner(NNodes, -1);
+#pragma omp parallel
+  {
+    ThreadSpan span("node owner");
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++){
+      for(int j=NEList_offsets[i];j<NEList_offsets[i+1];j++){
+        int p = epart[NEList[j]];
+        if(node_owner[i]==-1 || p<node_owner[i])
+          node_owner[i] = p;
+      }
+    }
+  }
+
+  // Each facet belongs to the element it bounds.
+  std::vector<int> facet_element(NFacets, -1);
+#pragma omp parallel
+  {
+    ThreadSpan span("facet element");
+#pragma omp for nowait
+    for(int i=0;i<NFacets;i++){
+      int n0 = facets[i*3];
+      for(int j=NEList_offsets[n0];j<NEList_offsets[n0+1] && facet_element[i]==-1;j++){
+        int eid = NEList[j];
+        int matches = 0;
+        for(int k=0;k<4;k++){
+          if(tets[eid*4+k]==facets[i*3+1] || tets[eid*4+k]==facets[i*3+2])
+            matches++;
+        }
+        if(matches==2)
+          facet_element[i] = eid;
+      }
+    }
+  }
+
+  // Bucket the facets by element once, so each partition only visits
+  // the facets of its own and ghost elements.
+  std::vector<int> element_facet_offsets(NTetra+1, 0);
+  for(int i=0;i<NFacets;i++){
+    if(facet_element[i]!=-1)
+      element_facet_offsets[facet_element[i]+1]++;
+  }
+  for(int i=0;i<NTetra;i++)
+    element_facet_offsets[i+1] += element_facet_offsets[i];
+  std::vector<int> element_facets(element_facet_offsets[NTetra]);
+  {
+    std::vector<int> cursor(element_facet_offsets.begin(), element_facet_offsets.end()-1);
+    for(int i=0;i<NFacets;i++){
+      if(facet_element[i]!=-1)
+        element_facets[cursor[facet_element[i]]++] = i;
+    }
+  }
+
+  std::vector< std::vector<int> > owned_elements(nparts);
+  for(int i=0;i<NTetra;i++){
+    if(epart[i]!=-1)
+      owned_elements[epart[i]].push_back(i);
+  }
+
+  int ierr = 0;
+#pragma omp parallel reduction(+:ierr)
+  {
+    ThreadSpan span("write partition");
+    // Work arrays, only allocated by the threads that get a partition.
+    std::vector<int> local_node, local_element;
+
+#pragma omp for schedule(dynamic) nowait
+    for(int p=0;p<nparts;p++){
+      if(local_node.empty()){
+        local_node.assign(NNodes, -1);
+        local_element.assign(NTetra, -1);
+      }
+
+      // Owned elements followed by the ghost elements that share a node with them.
+      std::vector<int> elements(owned_elements[p]);
+      for(std::vector<int>::const_iterator it=elements.begin();it!=elements.end();++it)
+        local_element[*it] = 1;
+      size_t NOwnedElements = elements.size();
+      for(size_t i=0;i<NOwnedElements;i++){
+        for(int j=0;j<4;j++){
+          int nid = tets[elements[i]*4+j];
+          for(int k=NEList_offsets[nid];k<NEList_offsets[nid+1];k++){
+            int eid = NEList[k];
+            if(local_element[eid]==-1){
+              local_element[eid] = 1;
+              elements.push_back(eid);
+            }
+          }
+        }
+      }
+      for(size_t i=0;i<elements.size();i++)
+        local_element[elements[i]] = i;
+
+      // Owned nodes first, then the halo.
+      std::vector<int> nodes;
+      for(int pass=0;pass<2;pass++){
+        for(std::vector<int>::const_iterator it=elements.begin();it!=elements.end();++it){
+          for(int j=0;j<4;j++){
+            int nid = tets[*it*4+j];
+            if(local_node[nid]==-1 && (node_owner[nid]==p)==(pass==0)){
+              local_node[nid] = nodes.size();
+              nodes.push_back(nid);
+            }
+          }
+        }
+      }
+      size_t NOwnedNodes = 0;
+      while(NOwnedNodes<nodes.size() && node_owner[nodes[NOwnedNodes]]==p)
+        NOwnedNodes++;
+
+      // Build the local mesh.
+      std::vector<double> lxyz(nodes.size()*3);
+      for(size_t i=0;i<nodes.size();i++)
+        for(int j=0;j<3;j++)
+          lxyz[i*3+j] = xyz[nodes[i]*3+j];
+
+      std::vector<int> ltets(elements.size()*4);
+      for(size_t i=0;i<elements.size();i++)
+        for(int j=0;j<4;j++)
+          ltets[i*4+j] = local_node[tets[elements[i]*4+j]];
+
+      // Keep the facets in their global order.
+      std::vector<int> partition_facets;
+      for(std::vector<int>::const_iterator it=elements.begin();it!=elements.end();++it)
+        partition_facets.insert(partition_facets.end(), element_facets.begin()+element_facet_offsets[*it],
+                                element_facets.begin()+element_facet_offsets[*it+1]);
+      std::sort(partition_facets.begin(), partition_facets.end());
+
+      std::vector<int> lfacets, lfacet_ids;
+      for(std::vector<int>::const_iterator it=partition_facets.begin();it!=partition_facets.end();++it){
+        for(int j=0;j<3;j++)
+          lfacets.push_back(local_node[facets[*it*3+j]]);
+        lfacet_ids.push_back(facet_ids[*it]);
+      }
+
+      std::ostringstream pbasename;
+      pbasename<<basename<<"_"<<p;
+      int werr;
+      if(binary)
+        werr = write_gmsh_binary_file(pbasename.str(), lxyz, ltets, lfacets, lfacet_ids);
+      else
+        werr = write_gmsh_file(pbasename.str(), lxyz, ltets, lfacets, lfacet_ids);
+      if(werr)
+        ierr++;
+
+      std::ofstream halo(std::string(pbasename.str()+".halo").c_str());
+      if(!halo.good()){
+        std::cerr<<"ERROR: Cannot write file: "<<pbasename.str()+".halo"<<std::endl;
+        ierr++;
+      }else{
+        halo<<nparts<<" "<<p<<"\n"
+            <<nodes.size()<<" "<<NOwnedNodes<<"\n";
+        for(size_t i=0;i<nodes.size();i++)
+          halo<<nodes[i]<<" "<<node_owner[nodes[i]]<<"\n";
+        halo<<elements.size()<<" "<<NOwnedElements<<"\n";
+        for(size_t i=0;i<elements.size();i++)
+          halo<<elements[i]<<" "<<epart[elements[i]]<<"\n";
+        halo.close();
+        if(halo.fail()){
+          std::cerr<<"ERROR: Failed to write file: "<<pbasename.str()+".halo"<<std::endl;
+          ierr++;
+        }
+      }
+
+      // Reset the work arrays for the next partition.
+      for(std::vector<int>::const_iterator it=nodes.begin();it!=nodes.end();++it)
+        local_node[*it] = -1;
+      for(std::vector<int>::const_iterator it=elements.begin();it!=elements.end();++it)
+        local_element[*it] = -1;
+    }
+  }
+
+  return ierr?-1:0;
+}
@@ -0,0 +1,199 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <cassert>
+
+#include "mesh_conversion.h"
+#include "mesh_refine.h"
+#include "run_report.h"
+
+// Each edge (a, b), a<b, is numbered by its position in the upper part
+// of row a of the node adjacency graph. As the rows are sorted this
+// gives every thread the same lookup without any locking.
+struct EdgeNumbering{
+  EdgeNumbering(size_t NNodes, const std::vector<int> &tets){
+    create_node_adjacency(NNodes, tets, NNList_offsets, NNList);
+
+    upper.resize(NNodes);
+    offsets.resize(NNodes+1);
+    offsets[0] = 0;
+    for(size_t i=0;i<NNodes;i++){
+      upper[i] = std::upper_bound(NNList.begin()+NNList_offsets[i], NNList.begin()+NNList_offsets[i+1], (int)i)-NNList.begin();
+      offsets[i+1] = offsets[i]+(NNList_offsets[i+1]-upper[i]);
+    }
+  }
+
+  int size() const{
+    return offsets.back();
+  }
+
+  int edge(int a, int b) const{
+    if(b<a)
+      std::swap(a, b);
+    std::vector<int>::const_iterator it = std::lower_bound(NNList.begin()+upper[a], NNList.begin()+NNList_offsets[a+1], b);
+    assert(it!=NNList.begin()+NNList_offsets[a+1] && *it==b);
+    return offsets[a]+(it-NNList.begin()-upper[a]);
+  }
+
+  std::vector<int> NNList_offsets, NNList, upper, offsets;
+};
+
+int refine_mesh(std::vector<double> &xyz,
+                std::vector<int> &tets,
+                std::vector<int> &facets,
+                std::vector<int> &facet_ids){
+  ScopedStage stage("refine");
+
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  int NFacets = facet_ids.size();
+
+  EdgeNumbering edges(NNodes, tets);
+  int NEdges = edges.size();
+
+  // Add a new node at the midpoint of every edge.
+  xyz.resize((NNodes+NEdges)*3);
+#pragma omp parallel
+  {
+    ThreadSpan span("refine nodes");
+#pragma omp for schedule(static, 1024) nowait
+    for(int i=0;i<NNodes;i++){
+      for(int k=edges.upper[i];k<edges.NNList_offsets[i+1];k++){
+        int j = edges.NNList[k];
+        int nid = NNodes+edges.offsets[i]+(k-edges.upper[i]);
+        for(int l=0;l<3;l++)
+          xyz[nid*3+l] = 0.5*(xyz[i*3+l]+xyz[j*3+l]);
+      }
+    }
+  }
+
+  // Number the child elements after compressing out masked elements.
+  std::vector<int> element_offsets(NTetra+1, 0);
+  for(int i=0;i<NTetra;i++)
+    element_offsets[i+1] = element_offsets[i]+(tets[i*4]==-1?0:8);
+
+  std::vector<int> tets_new(element_offsets[NTetra]*4);
+#pragma omp parallel
+  {
+    ThreadSpan span("refine elements");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+
+      const int *n = &(tets[i*4]);
+      int m01 = NNodes+edges.edge(n[0], n[1]);
+      int m02 = NNodes+edges.edge(n[0], n[2]);
+      int m03 = NNodes+edges.edge(n[0], n[3]);
+      int m12 = NNodes+edges.edge(n[1], n[2]);
+      int m13 = NNodes+edges.edge(n[1], n[3]);
+      int m23 = NNodes+edges.edge(n[2], n[3]);
+
+      // Split the inner octahedron along its shortest diagonal.
+      int diagonals[3][6] = {{m01, m23, m02, m12, m13, m03},
+                             {m02, m13, m01, m03, m23, m12},
+                             {m03, m12, m01, m02, m23, m13}};
+      int shortest = 0;
+      double shortest_length = -1;
+      for(int d=0;d<3;d++){
+        double length = 0;
+        for(int l=0;l<3;l++){
+          double dx = xyz[diagonals[d][0]*3+l]-xyz[diagonals[d][1]*3+l];
+          length += dx*dx;
+        }
+        if(shortest_length<0 || length<shortest_length){
+          shortest = d;
+          shortest_length = length;
+        }
+      }
+      const int *diagonal = diagonals[shortest];
+
+      int children[8][4] = {{n[0], m01, m02, m03},
+                            {m01, n[1], m12, m13},
+                            {m02, m12, n[2], m23},
+                            {m03, m13, m23, n[3]},
+                            {diagonal[0], diagonal[1], diagonal[2], diagonal[3]},
+                            {diagonal[0], diagonal[1], diagonal[3], diagonal[4]},
+                            {diagonal[0], diagonal[1], diagonal[4], diagonal[5]},
+                            {diagonal[0], diagonal[1], diagonal[5], diagonal[2]}};
+
+      int *child = &(tets_new[element_offsets[i]*4]);
+      for(int c=0;c<8;c++){
+        // The corner elements inherit the orientation of the parent but
+        // the inner elements need to be checked.
+        if(c>=4 && volume(&(xyz[children[c][0]*3]), &(xyz[children[c][1]*3]),
+                          &(xyz[children[c][2]*3]), &(xyz[children[c][3]*3]))<0)
+          std::swap(children[c][2], children[c][3]);
+        for(int l=0;l<4;l++)
+          child[c*4+l] = children[c][l];
+      }
+    }
+  }
+  tets.swap(tets_new);
+
+  // Split the facets, preserving their orientation and ids.
+  std::vector<int> facets_new(NFacets*12), facet_ids_new(NFacets*4);
+#pragma omp parallel
+  {
+    ThreadSpan span("refine facets");
+#pragma omp for nowait
+    for(int i=0;i<NFacets;i++){
+      const int *n = &(facets[i*3]);
+      int m01 = NNodes+edges.edge(n[0], n[1]);
+      int m12 = NNodes+edges.edge(n[1], n[2]);
+      int m20 = NNodes+edges.edge(n[2], n[0]);
+
+      int children[4][3] = {{n[0], m01, m20},
+                            {m01, n[1], m12},
+                            {m20, m12, n[2]},
+                            {m01, m12, m20}};
+      for(int c=0;c<4;c++){
+        for(int l=0;l<3;l++)
+          facets_new[(i*4+c)*3+l] = children[c][l];
+        facet_ids_new[i*4+c] = facet_ids[i];
+      }
+    }
+  }
+  facets.swap(facets_new);
+  facet_ids.swap(facet_ids_new);
+
+  return 0;
+}
@@ -0,0 +1,370 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+#include <stdint.h>
+
+#include "mesh_conversion.h"
+#include "mesh_reorder.h"
+#include "run_report.h"
+
+// Breadth first search from root. On return queue holds the nodes in
+// the order that they were visited and level their distance from
+// root. Returns the eccentricity of root.
+static int bfs(int root,
+               const std::vector<int> &NNList_offsets, const std::vector<int> &NNList,
+               std::vector<int> &queue, std::vector<int> &level){
+  queue.clear();
+  queue.push_back(root);
+  level[root] = 0;
+  for(size_t head=0;head<queue.size();head++){
+    int n = queue[head];
+    for(int i=NNList_offsets[n];i<NNList_offsets[n+1];i++){
+      int m = NNList[i];
+      if(level[m]==-1){
+        level[m] = level[n]+1;
+        queue.push_back(m);
+      }
+    }
+  }
+  return level[queue.back()];
+}
+
+// Find a pseudo-peripheral node of the connected component containing
+// seed using the George-Liu algorithm.
+static int pseudo_peripheral_node(int seed,
+                                  const std::vector<int> &NNList_offsets, const std::vector<int> &NNList,
+                                  std::vector<int> &queue, std::vector<int> &level){
+  int root = seed;
+  int eccentricity = bfs(root, NNList_offsets, NNList, queue, level);
+  for(;;){
+    // Pick the node with the lowest degree from the last level set.
+    int candidate = queue.back();
+    for(std::vector<int>::const_reverse_iterator it=queue.rbegin();it!=queue.rend();++it){
+      if(level[*it]!=eccentricity)
+        break;
+      if(NNList_offsets[*it+1]-NNList_offsets[*it] < NNList_offsets[candidate+1]-NNList_offsets[candidate])
+        candidate = *it;
+    }
+
+    for(std::vector<int>::const_iterator it=queue.begin();it!=queue.end();++it)
+      level[*it] = -1;
+
+    int candidate_eccentricity = bfs(candidate, NNList_offsets, NNList, queue, level);
+    for(std::vector<int>::const_iterator it=queue.begin();it!=queue.end();++it)
+      level[*it] = -1;
+
+    if(candidate_eccentricity<=eccentricity)
+      break;
+
+    root = candidate;
+    eccentricity = candidate_eccentricity;
+  }
+
+  return root;
+}
+
+// Reverse Cuthill-McKee ordering. On return order[new_id] = old_id.
+static void rcm_ordering(size_t NNodes, const std::vector<int> &tets, std::vector<int> &order){
+  std::vector<int> NNList_offsets, NNList;
+  create_node_adjacency(NNodes, tets, NNList_offsets, NNList);
+
+  std::vector<int> queue, level(NNodes, -1);
+  std::vector<bool> visited(NNodes, false);
+
+  order.clear();
+  order.reserve(NNodes);
+  for(size_t seed=0;seed<NNodes;seed++){
+    if(visited[seed])
+      continue;
+
+    int root = pseudo_peripheral_node(seed, NNList_offsets, NNList, queue, level);
+
+    size_t head = order.size();
+    order.push_back(root);
+    visited[root] = true;
+    while(head<order.size()){
+      int n = order[head++];
+
+      // Add unvisited neighbours in order of increasing degree.
+      size_t first = order.size();
+      for(int i=NNList_offsets[n];i<NNList_offsets[n+1];i++){
+        int m = NNList[i];
+        if(!visited[m]){
+          visited[m] = true;
+          order.push_back(m);
+        }
+      }
+      std::stable_sort(order.begin()+first, order.end(),
+                       [&NNList_offsets](int a, int b){
+                         return NNList_offsets[a+1]-NNList_offsets[a] < NNList_offsets[b+1]-NNList_offsets[b];
+                       });
+    }
+  }
+
+  std::reverse(order.begin(), order.end());
+}
+
+// Map a point on a 2^bits grid to its distance along the Hilbert
+// curve. This uses Skilling's transpose algorithm (AIP Conf. Proc. 707,
+// 2004).
+static uint64_t hilbert_key(uint32_t X[3], int bits){
+  uint32_t M = 1u<<(bits-1);
+
+  // Inverse undo excess work.
+  for(uint32_t Q=M;Q>1;Q>>=1){
+    uint32_t P = Q-1;
+    for(int i=0;i<3;i++){
+      if(X[i]&Q){
+        X[0] ^= P;
+      }else{
+        uint32_t t = (X[0]^X[i])&P;
+        X[0] ^= t;
+        X[i] ^= t;
+      }
+    }
+  }
+
+  // Gray encode.
+  for(int i=1;i<3;i++)
+    X[i] ^= X[i-1];
+  uint32_t t = 0;
+  for(uint32_t Q=M;Q>1;Q>>=1){
+    if(X[2]&Q)
+      t ^= Q-1;
+  }
+  for(int i=0;i<3;i++)
+    X[i] ^= t;
+
+  // Interleave the transposed bits.
+  uint64_t key = 0;
+  for(int b=bits-1;b>=0;b--){
+    for(int i=0;i<3;i++)
+      key = (key<<1)|((X[i]>>b)&1);
+  }
+
+  return key;
+}
+
+// Hilbert space-filling curve ordering. On return order[new_id] = old_id.
+static void hilbert_ordering(const std::vector<double> &xyz, std::vector<int> &order){
+  int NNodes = xyz.size()/3;
+  const int bits = 21;
+
+  double bbox[] = {xyz[0], xyz[0],
+                   xyz[1], xyz[1],
+                   xyz[2], xyz[2]};
+  for(int i=1;i<NNodes;i++){
+    for(int j=0;j<3;j++){
+      bbox[j*2  ] = std::min(bbox[j*2  ], xyz[i*3+j]);
+      bbox[j*2+1] = std::max(bbox[j*2+1], xyz[i*3+j]);
+    }
+  }
+
+  // Use the same scaling along each axis so the curve is not distorted.
+  double extent = std::max(bbox[1]-bbox[0], std::max(bbox[3]-bbox[2], bbox[5]-bbox[4]));
+  double scale = extent>0 ? ((1u<<bits)-1)/extent : 0.0;
+
+  std::vector< std::pair<uint64_t, int> > keys(NNodes);
+#pragma omp parallel
+  {
+    ThreadSpan span("hilbert keys");
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++){
+      uint32_t X[3];
+      for(int j=0;j<3;j++)
+        X[j] = (uint32_t)((xyz[i*3+j]-bbox[j*2])*scale);
+      keys[i] = std::pair<uint64_t, int>(hilbert_key(X, bits), i);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+
+  order.resize(NNodes);
+#pragma omp parallel
+  {
+    ThreadSpan span("hilbert order");
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++)
+      order[i] = keys[i].second;
+  }
+}
+
+// Sort elements (or facets) by their lowest node number. ids, if not
+// empty, is permuted along with the elements.
+static void sort_by_lowest_node(int nloc, std::vector<int> &elements, std::vector<int> &ids){
+  int NElements = elements.size()/nloc;
+
+  std::vector< std::pair<int, int> > keys(NElements);
+#pragma omp parallel
+  {
+    ThreadSpan span("sort keys");
+#pragma omp for nowait
+    for(int i=0;i<NElements;i++){
+      int lowest = std::numeric_limits<int>::max();
+      if(elements[i*nloc]!=-1){
+        for(int j=0;j<nloc;j++)
+          lowest = std::min(lowest, elements[i*nloc+j]);
+      }
+      keys[i] = std::pair<int, int>(lowest, i);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<int> elements_new(elements.size());
+#pragma omp parallel
+  {
+    ThreadSpan span("permute elements");
+#pragma omp for nowait
+    for(int i=0;i<NElements;i++){
+      for(int j=0;j<nloc;j++)
+        elements_new[i*nloc+j] = elements[keys[i].second*nloc+j];
+    }
+  }
+  elements.swap(elements_new);
+
+  if(!ids.empty()){
+    std::vector<int> ids_new(NElements);
+#pragma omp parallel
+    {
+      ThreadSpan span("permute ids");
+#pragma omp for nowait
+      for(int i=0;i<NElements;i++)
+        ids_new[i] = ids[keys[i].second];
+    }
+    ids.swap(ids_new);
+  }
+}
+
+int reorder_mesh(std::string method,
+                 std::vector<double> &xyz,
+                 std::vector<int> &tets,
+                 std::vector<int> &facets,
+                 std::vector<int> &facet_ids){
+  ScopedStage stage("reorder");
+
+  int NNodes = xyz.size()/3;
+  if(NNodes==0)
+    return 0;
+
+  std::vector<int> order;
+  if(method=="rcm"){
+    rcm_ordering(NNodes, tets, order);
+  }else if(method=="hilbert"){
+    hilbert_ordering(xyz, order);
+  }else{
+    std::cerr<<"ERROR: Unknown reordering method: "<<method<<". Expecting either rcm or hilbert."<<std::endl;
+    return -1;
+  }
+  assert((int)order.size()==NNodes);
+
+  // Renumber the nodes.
+  std::vector<int> renumbering(NNodes);
+  std::vector<double> xyz_new(NNodes*3);
+#pragma omp parallel
+  {
+    ThreadSpan span("renumber nodes");
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++)
+      renumbering[order[i]] = i;
+
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++){
+      for(int j=0;j<3;j++)
+        xyz_new[i*3+j] = xyz[order[i]*3+j];
+    }
+  }
+  xyz.swap(xyz_new);
+
+  int NTetra = tets.size()/4;
+#pragma omp parallel
+  {
+    ThreadSpan span("renumber elements");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+      for(int j=0;j<4;j++)
+        tets[i*4+j] = renumbering[tets[i*4+j]];
+    }
+  }
+
+  int NFacets = facets.size()/3;
+#pragma omp parallel
+  {
+    ThreadSpan span("renumber facets");
+#pragma omp for nowait
+    for(int i=0;i<NFacets*3;i++)
+      facets[i] = renumbering[facets[i]];
+  }
+
+  // Sweep the elements and facets in the same order as the nodes.
+  std::vector<int> no_ids;
+  sort_by_lowest_node(4, tets, no_ids);
+  sort_by_lowest_node(3, facets, facet_ids);
+
+  return 0;
+}
+
+int mesh_bandwidth(const std::vector<int> &tets){
+  int NTetra = tets.size()/4;
+  int bandwidth = 0;
+#pragma omp parallel reduction(max:bandwidth)
+  {
+    ThreadSpan span("bandwidth");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+
+      int lo=tets[i*4], hi=tets[i*4];
+      for(int j=1;j<4;j++){
+        lo = std::min(lo, tets[i*4+j]);
+        hi = std::max(hi, tets[i*4+j]);
+      }
+      bandwidth = std::max(bandwidth, hi-lo);
+    }
+  }
+
+  return bandwidth;
+}
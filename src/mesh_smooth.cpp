@@ -0,0 +1,252 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <cmath>
+
+#include "mesh_conversion.h"
+#include "mesh_colouring.h"
+#include "mesh_smooth.h"
+#include "run_report.h"
+
+// Worst quality of the elements around node n if it were at position x.
+static double local_quality(int n, const double *x,
+                            const std::vector<double> &xyz, const std::vector<int> &tets,
+                            const std::vector<int> &NEList_offsets, const std::vector<int> &NEList){
+  double q = 1.0;
+  for(int k=NEList_offsets[n];k<NEList_offsets[n+1];k++){
+    const int *e = &(tets[NEList[k]*4]);
+    const double *v[4];
+    for(int l=0;l<4;l++)
+      v[l] = e[l]==n?x:&(xyz[e[l]*3]);
+    q = std::min(q, quality(v[0], v[1], v[2], v[3]));
+  }
+  return q;
+}
+
+// Smart Laplacian: move towards the centroid of the neighbours, backing
+// off if that does not improve the worst element.
+static bool laplacian_move(int n, int fixed_axis,
+                           std::vector<double> &xyz, const std::vector<int> &tets,
+                           const std::vector<int> &NNList_offsets, const std::vector<int> &NNList,
+                           const std::vector<int> &NEList_offsets, const std::vector<int> &NEList){
+  double centroid[] = {0.0, 0.0, 0.0};
+  int nneighbours = NNList_offsets[n+1]-NNList_offsets[n];
+  for(int k=NNList_offsets[n];k<NNList_offsets[n+1];k++)
+    for(int l=0;l<3;l++)
+      centroid[l] += xyz[NNList[k]*3+l];
+  for(int l=0;l<3;l++)
+    centroid[l] /= nneighbours;
+  if(fixed_axis>=0)
+    centroid[fixed_axis] = xyz[n*3+fixed_axis];
+
+  double q_old = local_quality(n, &(xyz[n*3]), xyz, tets, NEList_offsets, NEList);
+  for(double relax=1.0;relax>0.2;relax*=0.5){
+    double x[3];
+    for(int l=0;l<3;l++)
+      x[l] = xyz[n*3+l]+relax*(centroid[l]-xyz[n*3+l]);
+
+    if(local_quality(n, x, xyz, tets, NEList_offsets, NEList)>q_old){
+      for(int l=0;l<3;l++)
+        xyz[n*3+l] = x[l];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Move a node along the (finite difference) gradient of the worst
+// element quality around it.
+static bool perturb_move(int n, int fixed_axis,
+                         std::vector<double> &xyz, const std::vector<int> &tets,
+                         const std::vector<int> &NNList_offsets, const std::vector<int> &NNList,
+                         const std::vector<int> &NEList_offsets, const std::vector<int> &NEList){
+  // Step size relative to the shortest edge at the node.
+  double h = -1.0;
+  for(int k=NNList_offsets[n];k<NNList_offsets[n+1];k++){
+    double l2 = 0.0;
+    for(int l=0;l<3;l++)
+      l2 += (xyz[NNList[k]*3+l]-xyz[n*3+l])*(xyz[NNList[k]*3+l]-xyz[n*3+l]);
+    if(h<0 || l2<h)
+      h = l2;
+  }
+  h = sqrt(h);
+
+  double q_old = local_quality(n, &(xyz[n*3]), xyz, tets, NEList_offsets, NEList);
+  double grad[3] = {0.0, 0.0, 0.0}, eps = 1.0e-3*h;
+  for(int l=0;l<3;l++){
+    if(l==fixed_axis)
+      continue;
+
+    double x[3] = {xyz[n*3], xyz[n*3+1], xyz[n*3+2]};
+    x[l] += eps;
+    double qp = local_quality(n, x, xyz, tets, NEList_offsets, NEList);
+    x[l] -= 2*eps;
+    double qm = local_quality(n, x, xyz, tets, NEList_offsets, NEList);
+    grad[l] = (qp-qm)/(2*eps);
+  }
+  double norm = sqrt(grad[0]*grad[0]+grad[1]*grad[1]+grad[2]*grad[2]);
+  if(norm==0.0)
+    return false;
+
+  for(double alpha=0.2;alpha>0.01;alpha*=0.5){
+    double x[3];
+    for(int l=0;l<3;l++)
+      x[l] = xyz[n*3+l]+alpha*h*grad[l]/norm;
+
+    if(local_quality(n, x, xyz, tets, NEList_offsets, NEList)>q_old){
+      for(int l=0;l<3;l++)
+        xyz[n*3+l] = x[l];
+      return true;
+    }
+  }
+  return false;
+}
+
+int smooth_mesh(int max_iterations, double time_limit, double sliver_quality,
+                std::vector<double> &xyz,
+                const std::vector<int> &tets,
+                const std::vector<int> &facets,
+                const std::vector<int> &facet_ids){
+  ScopedStage stage("smooth");
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  int NFacets = facet_ids.size();
+
+  std::vector<int> NNList_offsets, NNList, NEList_offsets, NEList;
+  create_node_adjacency(NNodes, tets, NNList_offsets, NNList);
+  create_node_element_adjacency(NNodes, tets, NEList_offsets, NEList);
+
+  // Work out which nodes can move. fixed_axis is -1 for interior nodes,
+  // the normal axis for nodes on a single face of the sample and 3 for
+  // fixed nodes.
+  std::vector<unsigned int> boundary(NNodes, 0);
+  for(int i=0;i<NFacets;i++){
+    for(int j=0;j<3;j++)
+      boundary[facets[i*3+j]] |= 1u<<facet_ids[i];
+  }
+  std::vector<int> fixed_axis(NNodes, -1);
+  for(int i=0;i<NNodes;i++){
+    if(boundary[i]==0)
+      continue;
+
+    fixed_axis[i] = 3;
+    for(int id=1;id<=6;id++){
+      if(boundary[i]==(1u<<id))
+        fixed_axis[i] = (id-1)/2;
+    }
+  }
+
+  std::vector<int> colour, colour_offsets, colour_nodes;
+  int ncolours = colour_graph(NNList_offsets, NNList, colour);
+  create_colour_table(colour, ncolours, colour_offsets, colour_nodes);
+
+  int iteration = 0;
+  while(iteration<max_iterations){
+    if(time_limit>0 &&
+       std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()>time_limit)
+      break;
+
+    // Nodes of slivers.
+    std::vector<char> sliver_node(NNodes, 0);
+#pragma omp parallel
+    {
+      ThreadSpan span("find slivers");
+#pragma omp for nowait
+      for(int i=0;i<NTetra;i++){
+        if(tets[i*4]==-1)
+          continue;
+
+        const int *e = &(tets[i*4]);
+        if(quality(&(xyz[e[0]*3]), &(xyz[e[1]*3]), &(xyz[e[2]*3]), &(xyz[e[3]*3]))<sliver_quality){
+          for(int l=0;l<4;l++)
+            sliver_node[e[l]] = 1;
+        }
+      }
+    }
+
+    int moved = 0;
+    for(int c=0;c<ncolours;c++){
+#pragma omp parallel reduction(+:moved)
+      {
+        ThreadSpan span("smooth colour");
+#pragma omp for schedule(dynamic, 64) nowait
+        for(int k=colour_offsets[c];k<colour_offsets[c+1];k++){
+          int n = colour_nodes[k];
+          if(fixed_axis[n]==3)
+            continue;
+
+          if(laplacian_move(n, fixed_axis[n], xyz, tets, NNList_offsets, NNList, NEList_offsets, NEList))
+            moved++;
+          if(sliver_node[n] && perturb_move(n, fixed_axis[n], xyz, tets, NNList_offsets, NNList, NEList_offsets, NEList))
+            moved++;
+        }
+      }
+    }
+
+    iteration++;
+    if(moved==0)
+      break;
+  }
+
+  return iteration;
+}
+
+double worst_quality(const std::vector<double> &xyz, const std::vector<int> &tets){
+  int NTetra = tets.size()/4;
+  double q = 1.0;
+#pragma omp parallel reduction(min:q)
+  {
+    ThreadSpan span("worst quality");
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+
+      const int *e = &(tets[i*4]);
+      q = std::min(q, quality(&(xyz[e[0]*3]), &(xyz[e[1]*3]), &(xyz[e[2]*3]), &(xyz[e[3]*3])));
+    }
+  }
+  return q;
+}
@@ -0,0 +1,316 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cmath>
+
+#include "mesh_statistics.h"
+#include "run_report.h"
+
+static inline void cross(const double *a, const double *b, double *c){
+  c[0] = a[1]*b[2]-a[2]*b[1];
+  c[1] = a[2]*b[0]-a[0]*b[2];
+  c[2] = a[0]*b[1]-a[1]*b[0];
+}
+
+static inline double dot(const double *a, const double *b){
+  return a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+}
+
+void mesh_statistics(const std::vector<double> &xyz,
+                     const std::vector<int> &tets,
+                     const std::vector<int> &facets,
+                     const std::vector<int> &facet_ids,
+                     double image_porosity,
+                     MeshStatistics &stats){
+  ScopedStage stage("statistics");
+
+  const double pi = 3.14159265358979323846;
+
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  int NFacets = facet_ids.size();
+
+  stats.NNodes = NNodes;
+  stats.NElements = 0;
+  stats.NFacets = NFacets;
+  stats.volume = 0.0;
+  stats.image_porosity = image_porosity;
+  stats.area.clear();
+  stats.min_dihedral = 180.0;
+  stats.max_dihedral = 0.0;
+  stats.min_radius_ratio = 1.0;
+  stats.mean_radius_ratio = 0.0;
+  stats.min_size = std::numeric_limits<double>::max();
+  stats.max_size = 0.0;
+  stats.size_histogram.clear();
+  for(int i=0;i<DIHEDRAL_BINS;i++)
+    stats.dihedral_histogram[i] = 0;
+  for(int i=0;i<RADIUS_RATIO_BINS;i++)
+    stats.radius_ratio_histogram[i] = 0;
+  for(int k=0;k<3;k++){
+    stats.bbox[k*2  ] = std::numeric_limits<double>::max();
+    stats.bbox[k*2+1] = -std::numeric_limits<double>::max();
+  }
+  double sum_size = 0.0, sum_size2 = 0.0;
+
+  // Each thread accumulates its own statistics which are merged at the end.
+#pragma omp parallel
+  {
+    ThreadSpan span("statistics");
+    long NElements = 0;
+    double bbox[6], volume = 0.0, min_dihedral = 180.0, max_dihedral = 0.0;
+    double min_radius_ratio = 1.0, sum_radius_ratio = 0.0;
+    double min_size = std::numeric_limits<double>::max(), max_size = 0.0, local_sum_size = 0.0, local_sum_size2 = 0.0;
+    long dihedral_histogram[DIHEDRAL_BINS], radius_ratio_histogram[RADIUS_RATIO_BINS];
+    std::map<int, long> size_histogram;
+    std::map<int, double> area;
+    for(int i=0;i<DIHEDRAL_BINS;i++)
+      dihedral_histogram[i] = 0;
+    for(int i=0;i<RADIUS_RATIO_BINS;i++)
+      radius_ratio_histogram[i] = 0;
+    for(int k=0;k<3;k++){
+      bbox[k*2  ] = std::numeric_limits<double>::max();
+      bbox[k*2+1] = -std::numeric_limits<double>::max();
+    }
+
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++){
+      for(int k=0;k<3;k++){
+        bbox[k*2  ] = std::min(bbox[k*2  ], xyz[i*3+k]);
+        bbox[k*2+1] = std::max(bbox[k*2+1], xyz[i*3+k]);
+      }
+    }
+
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      if(tets[i*4]==-1)
+        continue;
+
+      NElements++;
+
+      const double *x[4];
+      for(int j=0;j<4;j++)
+        x[j] = &(xyz[tets[i*4+j]*3]);
+
+      // Edge vectors and lengths, edge (j, k).
+      double l[4][4];
+      for(int j=0;j<4;j++)
+        for(int k=j+1;k<4;k++){
+          double d[] = {x[k][0]-x[j][0], x[k][1]-x[j][1], x[k][2]-x[j][2]};
+          l[j][k] = l[k][j] = sqrt(dot(d, d));
+        }
+
+      double e1[] = {x[1][0]-x[0][0], x[1][1]-x[0][1], x[1][2]-x[0][2]};
+      double e2[] = {x[2][0]-x[0][0], x[2][1]-x[0][1], x[2][2]-x[0][2]};
+      double e3[] = {x[3][0]-x[0][0], x[3][1]-x[0][1], x[3][2]-x[0][2]};
+      double c[3];
+      cross(e1, e2, c);
+      double v = dot(c, e3)/6.0;
+      volume += v;
+
+      // Face normals, face j being opposite node j. The normals all point
+      // the same way (in or out) relative to the element.
+      double n[4][3], face_area = 0.0;
+      for(int j=0;j<4;j++){
+        const double *p = x[(j+1)%4], *q = x[(j+2)%4], *r = x[(j+3)%4];
+        double a[] = {q[0]-p[0], q[1]-p[1], q[2]-p[2]};
+        double b[] = {r[0]-p[0], r[1]-p[1], r[2]-p[2]};
+        cross(a, b, n[j]);
+        if(j%2)
+          for(int k=0;k<3;k++)
+            n[j][k] = -n[j][k];
+        face_area += 0.5*sqrt(dot(n[j], n[j]));
+      }
+
+      // Dihedral angle along edge (j, k) is between the faces opposite
+      // the other two nodes.
+      for(int j=0;j<4;j++)
+        for(int k=j+1;k<4;k++){
+          int f0=-1, f1=-1;
+          for(int m=0;m<4;m++){
+            if(m==j || m==k)
+              continue;
+            if(f0<0)
+              f0 = m;
+            else
+              f1 = m;
+          }
+          double nn = sqrt(dot(n[f0], n[f0])*dot(n[f1], n[f1]));
+          double cosine = nn>0?dot(n[f0], n[f1])/nn:1.0;
+          double angle = 180.0-acos(std::max(-1.0, std::min(1.0, cosine)))*180.0/pi;
+          min_dihedral = std::min(min_dihedral, angle);
+          max_dihedral = std::max(max_dihedral, angle);
+          dihedral_histogram[std::min(DIHEDRAL_BINS-1, std::max(0, (int)(angle/10.0)))]++;
+        }
+
+      // Radius ratio.
+      double aA = l[0][1]*l[2][3], bB = l[0][2]*l[1][3], cC = l[0][3]*l[1][2];
+      double p = (aA+bB+cC)*(aA+bB-cC)*(aA-bB+cC)*(-aA+bB+cC);
+      double rho = 0.0;
+      if(v>0 && p>0 && face_area>0){
+        double inradius = 3.0*v/face_area;
+        double circumradius = sqrt(p)/(24.0*v);
+        rho = std::min(1.0, 3.0*inradius/circumradius);
+      }
+      min_radius_ratio = std::min(min_radius_ratio, rho);
+      sum_radius_ratio += rho;
+      radius_ratio_histogram[std::min(RADIUS_RATIO_BINS-1, (int)(rho*RADIUS_RATIO_BINS))]++;
+
+      // Element size.
+      double h = cbrt(6.0*sqrt(2.0)*fabs(v));
+      min_size = std::min(min_size, h);
+      max_size = std::max(max_size, h);
+      local_sum_size += h;
+      local_sum_size2 += h*h;
+      if(h>0)
+        size_histogram[(int)floor(2.0*log2(h))]++;
+    }
+
+#pragma omp for nowait
+    for(int i=0;i<NFacets;i++){
+      const double *p = &(xyz[facets[i*3]*3]), *q = &(xyz[facets[i*3+1]*3]), *r = &(xyz[facets[i*3+2]*3]);
+      double a[] = {q[0]-p[0], q[1]-p[1], q[2]-p[2]};
+      double b[] = {r[0]-p[0], r[1]-p[1], r[2]-p[2]};
+      double n[3];
+      cross(a, b, n);
+      area[facet_ids[i]] += 0.5*sqrt(dot(n, n));
+    }
+
+#pragma omp critical
+    {
+      stats.NElements += NElements;
+      stats.volume += volume;
+      for(int k=0;k<3;k++){
+        stats.bbox[k*2  ] = std::min(stats.bbox[k*2  ], bbox[k*2  ]);
+        stats.bbox[k*2+1] = std::max(stats.bbox[k*2+1], bbox[k*2+1]);
+      }
+      stats.min_dihedral = std::min(stats.min_dihedral, min_dihedral);
+      stats.max_dihedral = std::max(stats.max_dihedral, max_dihedral);
+      for(int i=0;i<DIHEDRAL_BINS;i++)
+        stats.dihedral_histogram[i] += dihedral_histogram[i];
+      stats.min_radius_ratio = std::min(stats.min_radius_ratio, min_radius_ratio);
+      stats.mean_radius_ratio += sum_radius_ratio;
+      for(int i=0;i<RADIUS_RATIO_BINS;i++)
+        stats.radius_ratio_histogram[i] += radius_ratio_histogram[i];
+      stats.min_size = std::min(stats.min_size, min_size);
+      stats.max_size = std::max(stats.max_size, max_size);
+      sum_size += local_sum_size;
+      sum_size2 += local_sum_size2;
+      for(std::map<int, long>::const_iterator it=size_histogram.begin();it!=size_histogram.end();++it)
+        stats.size_histogram[it->first] += it->second;
+      for(std::map<int, double>::const_iterator it=area.begin();it!=area.end();++it)
+        stats.area[it->first] += it->second;
+    }
+  }
+
+  if(stats.NElements>0){
+    stats.mean_radius_ratio /= stats.NElements;
+    stats.mean_size = sum_size/stats.NElements;
+    stats.std_size = sqrt(std::max(0.0, sum_size2/stats.NElements-stats.mean_size*stats.mean_size));
+  }else{
+    stats.min_dihedral = stats.min_radius_ratio = stats.min_size = 0.0;
+    stats.mean_size = stats.std_size = 0.0;
+  }
+
+  double bbox_volume = 1.0;
+  for(int k=0;k<3;k++)
+    bbox_volume *= std::max(0.0, stats.bbox[k*2+1]-stats.bbox[k*2]);
+  stats.mesh_porosity = bbox_volume>0?stats.volume/bbox_volume:0.0;
+}
+
+int write_statistics_file(std::string filename, const MeshStatistics &stats){
+  ScopedStage stage("write_statistics");
+
+  std::ofstream file;
+  file.open(filename.c_str());
+  if(!file.good()){
+    std::cerr<<"ERROR: Cannot write file: "<<filename<<std::endl;
+    return -1;
+  }
+  file<<std::setprecision(std::numeric_limits<double>::digits10+1);
+
+  file<<"{"<<std::endl
+      <<"  \"nodes\": "<<stats.NNodes<<","<<std::endl
+      <<"  \"elements\": "<<stats.NElements<<","<<std::endl
+      <<"  \"facets\": "<<stats.NFacets<<","<<std::endl
+      <<"  \"bounding_box\": ["<<stats.bbox[0];
+  for(int k=1;k<6;k++)
+    file<<", "<<stats.bbox[k];
+  file<<"],"<<std::endl
+      <<"  \"volume\": "<<stats.volume<<","<<std::endl
+      <<"  \"mesh_porosity\": "<<stats.mesh_porosity<<","<<std::endl
+      <<"  \"image_porosity\": ";
+  if(stats.image_porosity<0)
+    file<<"null";
+  else
+    file<<stats.image_porosity;
+  file<<","<<std::endl
+      <<"  \"area\": {";
+  for(std::map<int, double>::const_iterator it=stats.area.begin();it!=stats.area.end();++it)
+    file<<(it==stats.area.begin()?"":", ")<<"\""<<it->first<<"\": "<<it->second;
+  file<<"},"<<std::endl
+      <<"  \"dihedral_angle\": {\"min\": "<<stats.min_dihedral<<", \"max\": "<<stats.max_dihedral
+      <<", \"bin_width\": 10, \"histogram\": ["<<stats.dihedral_histogram[0];
+  for(int i=1;i<DIHEDRAL_BINS;i++)
+    file<<", "<<stats.dihedral_histogram[i];
+  file<<"]},"<<std::endl
+      <<"  \"radius_ratio\": {\"min\": "<<stats.min_radius_ratio<<", \"mean\": "<<stats.mean_radius_ratio
+      <<", \"bin_width\": "<<1.0/RADIUS_RATIO_BINS<<", \"histogram\": ["<<stats.radius_ratio_histogram[0];
+  for(int i=1;i<RADIUS_RATIO_BINS;i++)
+    file<<", "<<stats.radius_ratio_histogram[i];
+  file<<"]},"<<std::endl
+      <<"  \"element_size\": {\"min\": "<<stats.min_size<<", \"max\": "<<stats.max_size
+      <<", \"mean\": "<<stats.mean_size<<", \"std\": "<<stats.std_size<<", \"histogram\": [";
+  for(std::map<int, long>::const_iterator it=stats.size_histogram.begin();it!=stats.size_histogram.end();++it)
+    file<<(it==stats.size_histogram.begin()?"":", ")<<"{\"from\": "<<pow(2.0, it->first/2.0)
+        <<", \"to\": "<<pow(2.0, (it->first+1)/2.0)<<", \"count\": "<<it->second<<"}";
+  file<<"]}"<<std::endl
+      <<"}"<<std::endl;
+
+  file.close();
+
+  return 0;
+}
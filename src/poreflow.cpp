@@ -0,0 +1,392 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <getopt.h>
+
+#include "CTImage.h"
+#include "run_report.h"
+
+void usage(char *cmd){
+  std::cout<<"Usage: "<<cmd<<" CT-image [options]\n"
+           <<"       "<<cmd<<" -g size [options]\n"
+           <<"\nRead, segment, prune, mesh, trim, reorder and write in one go. The stages\n"
+           <<"pass their data in memory; intermediate results are only written when asked for.\n"
+           <<"\nOptions:\n"
+           <<" -h, --help\n\tHelp! Prints this message.\n"
+           <<" -v, --verbose\n\tVerbose output.\n"
+           <<" -g size, --hourglass size\n\tMesh a synthetic hourglass image of this size instead of reading a CT-image.\n"
+           <<" -t width, --throat width\n\tWidth of the hourglass throat (with -g).\n"
+           <<" -s width, --slab width\n\tExtract a square block of size 'width' from the data.\n"
+           <<" -x offset, --xoffset offset\n\tSpecify the offset along the x-axis when extracting a sub-block.\n"
+           <<" -y offset, --yoffset offset\n\tSpecify the offset along the y-axis when extracting a sub-block.\n"
+           <<" -z offset, --zoffset offset\n\tSpecify the offset along the z-axis when extracting a sub-block.\n"
+           <<" -T value, --threshold value\n\tVoxels with a value below this are pore space (default 1).\n"
+           <<" -R levels, --refine levels\n\tUniformly refine the mesh, splitting each element into 8, this many times.\n"
+           <<" -r method, --reorder method\n\tRenumber the mesh to improve cache locality before it is written. Options are rcm, hilbert.\n"
+           <<" -o basename, --output basename\n\tName of the output files -- without the extension.\n"
+           <<" -b, --binary\n\tWrite a binary GMSH file.\n"
+           <<" -H, --xdmf\n\tAlso write the mesh as XDMF/HDF5, which DOLFIN can read in parallel.\n"
+           <<" -Z level, --compress level\n\tGzip compress the HDF5 datasets at this level (1-9, with -H).\n"
+           <<" -N, --native\n\tAlso write the mesh as a native binary file (.pfm) that can be memory mapped.\n"
+           <<" -V, --vtu\n\tAlso write the mesh as VTK unstructured grid files.\n"
+           <<" -u, --combined-vtu\n\tWith -V, write the elements and facets to a single VTU file.\n"
+           <<" -I format, --image format\n\tAlso write the segmented and pruned image. Options are vox, nhdr.\n"
+           <<" -S, --stats\n\tWrite mesh quality and geometry statistics to a JSON file.\n"
+           <<" -J file, --report file\n\tWrite a JSON report of the time and memory used by each stage of the run.\n"
+           <<" -E file, --trace file\n\tWrite a timeline of the stages and of each thread in the parallel regions (Chrome trace format, for Perfetto).\n"
+           <<" -K, --counters\n\tAlso count the cycles, instructions and cache, TLB and branch misses of each stage in the report (Linux perf events). Needs -J.\n";
+  return;
+}
+
+int parse_arguments(int argc, char **argv,
+                    std::string &filename, bool &verbose, int &hourglass, int &throat_width, int &slab_width, int offsets[], int &threshold,
+                    int &refine, std::string &reorder, std::string &output, bool &binary, bool &xdmf, int &compression, bool &native,
+                    bool &vtu, bool &combined_vtu, std::string &image_format, bool &stats, std::string &report, std::string &trace, bool &counters){
+
+  // Set defaults
+  counters = false;
+  verbose = false;
+  hourglass = 0;
+  throat_width = 10;
+  slab_width = -1;
+  for(int i=0;i<3;i++)
+    offsets[i] = 0;
+  threshold = 1;
+  refine = 0;
+  binary = false;
+  xdmf = false;
+  compression = 0;
+  native = false;
+  vtu = false;
+  combined_vtu = false;
+  stats = false;
+
+  if(argc==1){
+    usage(argv[0]);
+    exit(0);
+  }
+
+  struct option longOptions[] = {
+    {"help",      0,                 0, 'h'},
+    {"verbose",   0,                 0, 'v'},
+    {"hourglass", required_argument, 0, 'g'},
+    {"throat",    required_argument, 0, 't'},
+    {"slab",      required_argument, 0, 's'},
+    {"xoffset",   required_argument, 0, 'x'},
+    {"yoffset",   required_argument, 0, 'y'},
+    {"zoffset",   required_argument, 0, 'z'},
+    {"threshold", required_argument, 0, 'T'},
+    {"refine",    required_argument, 0, 'R'},
+    {"reorder",   required_argument, 0, 'r'},
+    {"output",    required_argument, 0, 'o'},
+    {"binary",    0,                 0, 'b'},
+    {"xdmf",      0,                 0, 'H'},
+    {"compress",  required_argument, 0, 'Z'},
+    {"native",    0,                 0, 'N'},
+    {"vtu",       0,                 0, 'V'},
+    {"combined-vtu", 0,              0, 'u'},
+    {"image",     required_argument, 0, 'I'},
+    {"stats",     0,                 0, 'S'},
+    {"report",    required_argument, 0, 'J'},
+    {"trace",     required_argument, 0, 'E'},
+    {"counters",  0,                 0, 'K'},
+    {0, 0, 0, 0}
+  };
+
+  int optionIndex = 0;
+  int c;
+  const char *shortopts = "hvg:t:s:x:y:z:T:R:r:o:bHZ:NVuI:SJ:E:K";
+
+  // Set opterr to nonzero to make getopt print error messages
+  opterr=1;
+  while (true){
+    c = getopt_long(argc, argv, shortopts, longOptions, &optionIndex);
+
+    if (c == -1) break;
+
+    switch (c){
+    case 'h':
+      usage(argv[0]);
+      exit(0);
+    case 'v':
+      verbose = true;
+      break;
+    case 'g':
+      hourglass = atoi(optarg);
+      break;
+    case 't':
+      throat_width = atoi(optarg);
+      break;
+    case 's':
+      slab_width = atoi(optarg);
+      break;
+    case 'x':
+      offsets[0] = atoi(optarg);
+      break;
+    case 'y':
+      offsets[1] = atoi(optarg);
+      break;
+    case 'z':
+      offsets[2] = atoi(optarg);
+      break;
+    case 'T':
+      threshold = atoi(optarg);
+      break;
+    case 'R':
+      refine = atoi(optarg);
+      break;
+    case 'r':
+      reorder = std::string(optarg);
+      break;
+    case 'o':
+      output = std::string(optarg);
+      break;
+    case 'b':
+      binary = true;
+      break;
+    case 'H':
+      xdmf = true;
+      break;
+    case 'Z':
+      compression = atoi(optarg);
+      break;
+    case 'N':
+      native = true;
+      break;
+    case 'V':
+      vtu = true;
+      break;
+    case 'u':
+      combined_vtu = true;
+      break;
+    case 'I':
+      image_format = std::string(optarg);
+      break;
+    case 'S':
+      stats = true;
+      break;
+    case 'J':
+      report = std::string(optarg);
+      break;
+    case 'E':
+      trace = std::string(optarg);
+      break;
+    case 'K':
+      counters = true;
+      break;
+    case '?':
+      // missing argument only returns ':' if the option string starts with ':'
+      // but this seems to stop the printing of error messages by getopt?
+      std::cerr<<"ERROR: unknown option or missing argument\n";
+      usage(argv[0]);
+      exit(-1);
+    case ':':
+      std::cerr<<"ERROR: missing argument\n";
+      usage(argv[0]);
+      exit(-1);
+    default:
+      // unexpected:
+      std::cerr<<"ERROR: getopt returned unrecognized character code\n";
+      exit(-1);
+    }
+  }
+
+  if(hourglass==0){
+    if(optind!=argc-1){
+      std::cerr<<"ERROR: expecting a single CT-image, or -g for a synthetic image\n";
+      usage(argv[0]);
+      exit(-1);
+    }
+    filename = std::string(argv[argc-1]);
+  }
+
+  if(!image_format.empty() && image_format!="vox" && image_format!="nhdr"){
+    std::cerr<<"ERROR: unknown image format "<<image_format<<". Options are vox, nhdr.\n";
+    exit(-1);
+  }
+
+  if(counters && report.empty()){
+    std::cerr<<"ERROR: --counters adds the counts to the run report, so it needs --report.\n";
+    exit(-1);
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv){
+  if(argc==1){
+    usage(argv[0]);
+    exit(-1);
+  }
+
+  std::string filename, reorder, output, image_format;
+  bool verbose, binary, xdmf, native, vtu, combined_vtu, stats;
+  int hourglass, throat_width, slab_width, threshold, refine, compression;
+  int offsets[3];
+  std::string report, trace;
+  bool counters;
+  parse_arguments(argc, argv, filename, verbose, hourglass, throat_width, slab_width, offsets, threshold,
+                  refine, reorder, output, binary, xdmf, compression, native, vtu, combined_vtu, image_format, stats, report, trace, counters);
+  if(!report.empty())
+    start_run_report(report, argc, argv);
+  if(!trace.empty())
+    start_trace(trace, argc, argv);
+  if(counters)
+    start_counters();
+
+  CTImage image;
+  if(verbose)
+    image.verbose_on();
+
+  image.set_threshold(threshold);
+  if(hourglass>0){
+    if(verbose)
+      std::cout<<"INFO: Create hourglass image.\n";
+
+    image.set_basename("hourglass");
+    image.create_hourglass(hourglass, throat_width);
+
+    if(verbose)
+      std::cout<<"INFO: Segment image.\n";
+
+    image.segment();
+  }else{
+    if(verbose)
+      std::cout<<"INFO: Read and segment image.\n";
+
+    if(image.read(filename.c_str(), offsets, slab_width)<0){
+      std::cerr<<"ERROR: Failed to read file."<<std::endl;
+      exit(-1);
+    }
+  }
+
+  if(!output.empty())
+    image.set_basename(output);
+
+  if(verbose)
+    std::cout<<"INFO: Prune isolated pore space.\n";
+
+  image.prune(0);
+  if(image.get_porosity()==0.0){
+    std::cerr<<"ERROR: No pore space connects the two sides of the image along the x-axis."<<std::endl;
+    exit(-1);
+  }
+
+  if(image_format=="vox"){
+    if(verbose)
+      std::cout<<"INFO: Write VOX file.\n";
+
+    image.write_vox();
+  }else if(image_format=="nhdr"){
+    if(verbose)
+      std::cout<<"INFO: Write NHDR file.\n";
+
+    image.write_nhdr();
+  }
+
+  if(verbose)
+    std::cout<<"INFO: Generate mesh using CGAL.\n";
+
+  image.mesh();
+
+  if(verbose)
+    std::cout<<"INFO: Trim disconnected regions.\n";
+
+  image.trim_channels(1, 2);
+
+  if(refine>0){
+    if(verbose)
+      std::cout<<"INFO: Refine mesh.\n";
+
+    image.refine(refine);
+  }
+
+  if(!reorder.empty()){
+    if(verbose)
+      std::cout<<"INFO: Reorder mesh.\n";
+
+    if(image.reorder(reorder)<0)
+      exit(-1);
+  }
+
+  if(stats){
+    if(verbose)
+      std::cout<<"INFO: Write out mesh statistics.\n";
+
+    if(image.write_statistics()<0)
+      exit(-1);
+  }
+
+  if(vtu){
+    if(verbose)
+      std::cout<<"INFO: Write out VTK file.\n";
+
+    image.write_vtu(NULL, combined_vtu);
+  }
+
+  report_value("porosity", image.get_porosity());
+  report_value("nodes", image.get_xyz().size()/3);
+  report_value("elements", image.get_tets().size()/4);
+  report_value("facets", image.get_facet_ids().size());
+
+  if(verbose)
+    std::cout<<"INFO: Write out GMSH file.\n";
+
+  if(image.write_gmsh(NULL, binary)<0)
+    exit(-1);
+
+  if(xdmf){
+    if(verbose)
+      std::cout<<"INFO: Write out XDMF file.\n";
+
+    if(image.write_xdmf(NULL, compression)<0)
+      exit(-1);
+  }
+
+  if(native){
+    if(verbose)
+      std::cout<<"INFO: Write out native binary mesh file.\n";
+
+    if(image.write_native()<0)
+      exit(-1);
+  }
+
+  return 0;
+}
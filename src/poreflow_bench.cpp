@@ -0,0 +1,652 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cmath>
+#include <cstdlib>
+#include <getopt.h>
+
+#include <boost/filesystem.hpp>
+
+#include "CTImage.h"
+#include "mesh_conversion.h"
+#include "tet_geometry.h"
+#include "writers.h"
+#include "run_report.h"
+
+void usage(char *cmd){
+  std::cout<<"Microbenchmarks of the image, mesh and file kernels. The inputs are "
+    "generated so the runs are deterministic and need no data: an hourglass image "
+    "of size^3 voxels, and a cube of n^3 cells, each split into 6 tetrahedra, with "
+    "jittered and shuffled nodes. Each case is run several times and the best time "
+    "is reported as a throughput (voxels/s, tets/s or MB/s).\n"
+    "Usage: "<<cmd<<" [options ...]\n"
+           <<"\nOptions:\n"
+           <<" -h, --help\n\tHelp! Prints this message.\n"
+           <<" -n cells, --cells cells\n\tNumber of cells along each side of the cube (default 40).\n"
+           <<" -s size, --size size\n\tSize of the hourglass image (default 200).\n"
+           <<" -i repeats, --repeats repeats\n\tNumber of times each case is run (default 5).\n"
+           <<" -f name, --filter name\n\tOnly run the cases whose name contains this string.\n"
+           <<" -d directory, --directory directory\n\tWhere the files read and written are kept while running (default .).\n"
+           <<" -c file, --csv file\n\tWrite the results as CSV.\n"
+           <<" -g file, --baseline file\n\tCompare with the results in a CSV file written by -c, and fail if a case is slower.\n"
+           <<" -t tolerance, --tolerance tolerance\n\tFraction by which a case may fall below its baseline throughput (default 0.1).\n"
+           <<" -J file, --report file\n\tWrite a JSON report of the time and memory used by each stage of the run.\n"
+           <<" -E file, --trace file\n\tWrite a timeline of the stages and of each thread in the parallel regions (Chrome trace format, for Perfetto).\n"
+           <<" -K, --counters\n\tAlso count the cycles, instructions and cache, TLB and branch misses of each case (Linux perf events), and report the instructions per cycle and misses per item. Needs -J.\n";
+  return;
+}
+
+int parse_arguments(int argc, char **argv, int &ncells, int &size, int &repeats, std::string &filter, std::string &directory,
+                    std::string &csv, std::string &baseline, double &tolerance, std::string &report, std::string &trace,
+                    bool &counters){
+
+  // Set defaults
+  ncells = 40;
+  size = 200;
+  repeats = 5;
+  directory = ".";
+  tolerance = 0.1;
+  counters = false;
+
+  struct option longOptions[] = {
+    {"help", 0, 0, 'h'},
+    {"cells", required_argument, 0, 'n'},
+    {"size", required_argument, 0, 's'},
+    {"repeats", required_argument, 0, 'i'},
+    {"filter", required_argument, 0, 'f'},
+    {"directory", required_argument, 0, 'd'},
+    {"csv", required_argument, 0, 'c'},
+    {"baseline", required_argument, 0, 'g'},
+    {"tolerance", required_argument, 0, 't'},
+    {"report", required_argument, 0, 'J'},
+    {"trace", required_argument, 0, 'E'},
+    {"counters", 0, 0, 'K'},
+    {0, 0, 0, 0}
+  };
+
+  int optionIndex = 0;
+  int c;
+
+  const char *shortopts = "hn:s:i:f:d:c:g:t:J:E:K";
+
+  // Set opterr to nonzero to make getopt print error messages
+  opterr=1;
+  while (true){
+    c = getopt_long(argc, argv, shortopts, longOptions, &optionIndex);
+
+    if (c == -1) break;
+
+    switch (c){
+    case 'h':
+      usage(argv[0]);
+      exit(0);
+    case 'n':
+      ncells = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'i':
+      repeats = atoi(optarg);
+      break;
+    case 'f':
+      filter = std::string(optarg);
+      break;
+    case 'd':
+      directory = std::string(optarg);
+      break;
+    case 'c':
+      csv = std::string(optarg);
+      break;
+    case 'g':
+      baseline = std::string(optarg);
+      break;
+    case 't':
+      tolerance = atof(optarg);
+      break;
+    case 'J':
+      report = std::string(optarg);
+      break;
+    case 'E':
+      trace = std::string(optarg);
+      break;
+    case 'K':
+      counters = true;
+      break;
+    case '?':
+      std::cerr<<"ERROR: unknown option or missing argument\n";
+      usage(argv[0]);
+      exit(-1);
+    default:
+      // unexpected:
+      std::cerr<<"ERROR: getopt returned unrecognized character code\n";
+      exit(-1);
+    }
+  }
+
+  if(ncells<1 || size<4 || repeats<1){
+    std::cerr<<"ERROR: cells, size and repeats must be positive (size at least 4)\n";
+    exit(-1);
+  }
+
+  if(counters && report.empty()){
+    std::cerr<<"ERROR: --counters adds the counts to the run report, so it needs --report.\n";
+    exit(-1);
+  }
+
+  return 0;
+}
+
+// Structured cube mesh with jittered, randomly numbered nodes.
+void create_cube_mesh(int n, std::vector<double> &xyz, std::vector<int> &tets){
+  int NNodes = (n+1)*(n+1)*(n+1);
+
+  // Fixed seed linear congruential generator.
+  unsigned int seed = 1;
+  std::vector<int> perm(NNodes);
+  for(int i=0;i<NNodes;i++)
+    perm[i] = i;
+  for(int i=NNodes-1;i>0;i--){
+    seed = seed*1103515245u+12345u;
+    std::swap(perm[i], perm[seed%(i+1)]);
+  }
+
+  xyz.resize(NNodes*3);
+  for(int k=0;k<=n;k++)
+    for(int j=0;j<=n;j++)
+      for(int i=0;i<=n;i++){
+        int nid = perm[(k*(n+1)+j)*(n+1)+i];
+        int ijk[] = {i, j, k};
+        for(int l=0;l<3;l++){
+          seed = seed*1103515245u+12345u;
+          double jitter = (ijk[l]>0 && ijk[l]<n)?0.2*((seed>>8)/double(1<<24)-0.5):0.0;
+          xyz[nid*3+l] = ijk[l]+jitter;
+        }
+      }
+
+  const int kuhn[6][4] = {{0, 1, 3, 7}, {0, 1, 5, 7}, {0, 2, 3, 7}, {0, 2, 6, 7}, {0, 4, 5, 7}, {0, 4, 6, 7}};
+  tets.resize(n*n*n*6*4);
+  for(int k=0;k<n;k++)
+    for(int j=0;j<n;j++)
+      for(int i=0;i<n;i++){
+        int corner[8];
+        for(int c=0;c<8;c++)
+          corner[c] = perm[((k+((c>>2)&1))*(n+1)+j+((c>>1)&1))*(n+1)+i+(c&1)];
+
+        int cell = (k*n+j)*n+i;
+        for(int t=0;t<6;t++)
+          for(int l=0;l<4;l++)
+            tets[(cell*6+t)*4+l] = corner[kuhn[t][l]];
+      }
+}
+
+// Write a mesh in the Tarantula .spm layout read by read_tarantula_mesh_file,
+// with every element in the second material.
+void write_tarantula_file(std::string filename, const std::vector<double> &xyz, const std::vector<int> &tets){
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+
+  std::ofstream file(filename.c_str());
+  file<<"poreflow_bench\nvertices\n"<<NNodes<<"\n";
+  for(int i=0;i<NNodes;i++)
+    file<<xyz[i*3]<<" "<<xyz[i*3+1]<<" "<<xyz[i*3+2]<<"\n";
+  file<<"\ntetrahedra\n"<<NTetra<<"\n";
+  for(int i=0;i<NTetra;i++)
+    file<<"4 "<<tets[i*4]<<" "<<tets[i*4+1]<<" "<<tets[i*4+2]<<" "<<tets[i*4+3]<<"\n";
+  file<<"mat1\nmaterial\n0\nmat2\nmaterial\n"<<NTetra<<"\n";
+  for(int i=0;i<NTetra;i++)
+    file<<i<<"\n";
+  file.close();
+}
+
+double file_size(std::string filename){
+  boost::system::error_code error;
+  boost::uintmax_t size = boost::filesystem::file_size(filename, error);
+  return error?0.0:(double)size;
+}
+
+struct Result{
+  std::string name, unit;
+  double items, best, median;
+  double counts[NCOUNTERS];  // Hardware counts per run, -1 if not counted.
+};
+
+static std::vector<Result> results;
+static std::string filter;
+static int repeats;
+
+bool selected(std::string name){
+  return filter.empty() || name.find(filter)!=std::string::npos;
+}
+
+// Instructions per cycle and events per item processed, -1 if not counted.
+double ipc(const Result &result){
+  if(result.counts[COUNTER_CYCLES]<=0 || result.counts[COUNTER_INSTRUCTIONS]<0)
+    return -1.0;
+  return result.counts[COUNTER_INSTRUCTIONS]/result.counts[COUNTER_CYCLES];
+}
+
+double per_item(const Result &result, int counter){
+  if(result.counts[counter]<0 || result.items<=0.0)
+    return -1.0;
+  return result.counts[counter]/result.items;
+}
+
+// Run a case repeats times. setup() is not timed; kernel() is, and
+// returns the number of items it processed (voxels, elements or MB).
+// The best time is the one used for the throughput and for comparisons
+// with a baseline, the median shows how noisy the runs were. With -K the
+// hardware counters are read around each run of the kernel. name must
+// be a string literal.
+template<class S, class F>
+void run_case(const char *name, const char *unit, S setup, F kernel){
+  if(!selected(name))
+    return;
+
+  ScopedStage stage(name);
+
+  Result result;
+  for(int i=0;i<NCOUNTERS;i++)
+    result.counts[i] = 0.0;
+
+  std::vector<double> times(repeats);
+  double items = 0.0;
+  for(int r=0;r<repeats;r++){
+    setup();
+    long long before[NCOUNTERS], after[NCOUNTERS];
+    read_counters(before);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    items = kernel();
+    times[r] = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    read_counters(after);
+    for(int i=0;i<NCOUNTERS;i++)
+      result.counts[i] = (result.counts[i]<0 || before[i]<0 || after[i]<0)?-1.0:result.counts[i]+(after[i]-before[i])/(double)repeats;
+  }
+  std::sort(times.begin(), times.end());
+
+  result.name = name;
+  result.unit = unit;
+  result.items = items;
+  result.best = times[0];
+  result.median = times[repeats/2];
+  results.push_back(result);
+
+  std::cout<<name<<": "<<items/result.best<<" "<<unit<<" (best "<<result.best<<" s, median "<<result.median<<" s)"<<std::endl;
+  report_value(std::string(name)+" throughput", items/result.best);
+
+  // Only what could be counted.
+  std::string counts;
+  if(ipc(result)>=0.0){
+    std::stringstream stream;
+    stream<<"ipc "<<ipc(result);
+    counts = stream.str();
+    report_value(std::string(name)+" ipc", ipc(result));
+  }
+  const int misses[] = {COUNTER_LLC_MISSES, COUNTER_DTLB_MISSES, COUNTER_BRANCH_MISSES};
+  for(int i=0;i<3;i++){
+    if(per_item(result, misses[i])<0.0)
+      continue;
+    std::stringstream stream;
+    stream<<(counts.empty()?"":", ")<<counter_name(misses[i])<<" per item "<<per_item(result, misses[i]);
+    counts += stream.str();
+    report_value(std::string(name)+" "+counter_name(misses[i])+" per item", per_item(result, misses[i]));
+  }
+  if(!counts.empty())
+    std::cout<<name<<": "<<counts<<std::endl;
+}
+
+void no_setup(){}
+
+// Largest difference between the scalar and batched kernel results.
+void compare(const char *name, const std::vector<double> &a, const std::vector<double> &b, int n){
+  if(!selected(name))
+    return;
+
+  double error = 0.0;
+  for(int i=0;i<n;i++)
+    error = std::max(error, fabs(a[i]-b[i]));
+  std::cout<<name<<": max difference from scalar "<<error<<std::endl;
+}
+
+int write_csv(std::string filename){
+  std::ofstream file(filename.c_str());
+  if(!file.is_open()){
+    std::cerr<<"ERROR: Cannot write file: "<<filename<<std::endl;
+    return -1;
+  }
+
+  file<<"case,unit,items,best_seconds,median_seconds,throughput,ipc,llc_misses_per_item,dtlb_misses_per_item,branch_misses_per_item"<<std::endl;
+  file.precision(10);
+  for(size_t i=0;i<results.size();i++){
+    file<<results[i].name<<","<<results[i].unit<<","<<results[i].items<<","<<results[i].best<<","
+        <<results[i].median<<","<<results[i].items/results[i].best;
+
+    // Left empty if not counted.
+    double derived[] = {ipc(results[i]), per_item(results[i], COUNTER_LLC_MISSES),
+                        per_item(results[i], COUNTER_DTLB_MISSES), per_item(results[i], COUNTER_BRANCH_MISSES)};
+    for(int j=0;j<4;j++){
+      file<<",";
+      if(derived[j]>=0.0)
+        file<<derived[j];
+    }
+    file<<std::endl;
+  }
+  file.close();
+
+  return 0;
+}
+
+// Returns the number of cases whose throughput fell by more than the
+// tolerance, or -1 if the baseline cannot be read. Only cases in both
+// runs are compared; the throughputs depend on the sizes so the baseline
+// should be run with the same options.
+int compare_baseline(std::string filename, double tolerance){
+  std::ifstream file(filename.c_str());
+  if(!file.is_open()){
+    std::cerr<<"ERROR: Cannot open baseline file: "<<filename<<std::endl;
+    return -1;
+  }
+
+  std::map<std::string, double> baseline;
+  std::string line;
+  std::getline(file, line);
+  while(std::getline(file, line)){
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while(std::getline(stream, field, ','))
+      fields.push_back(field);
+    if(fields.size()>=6)
+      baseline[fields[0]] = atof(fields[5].c_str());
+  }
+
+  int regressions = 0;
+  for(size_t i=0;i<results.size();i++){
+    std::map<std::string, double>::const_iterator base = baseline.find(results[i].name);
+    if(base==baseline.end() || base->second<=0.0)
+      continue;
+
+    double ratio = results[i].items/results[i].best/base->second;
+    std::cout<<results[i].name<<": "<<ratio<<" of baseline";
+    if(ratio<1.0-tolerance){
+      std::cout<<" REGRESSION";
+      regressions++;
+    }
+    std::cout<<std::endl;
+  }
+
+  return regressions;
+}
+
+int main(int argc, char **argv){
+  int ncells, size;
+  double tolerance;
+  bool counters;
+  std::string directory, csv_filename, baseline_filename, report_filename, trace_filename;
+  parse_arguments(argc, argv, ncells, size, repeats, filter, directory, csv_filename, baseline_filename,
+                  tolerance, report_filename, trace_filename, counters);
+  if(!report_filename.empty())
+    start_run_report(report_filename, argc, argv);
+  if(!trace_filename.empty())
+    start_trace(trace_filename, argc, argv);
+  if(counters)
+    start_counters();
+
+  std::string basename = directory+"/poreflow_bench";
+
+  // Image kernels.
+  {
+    CTImage image;
+    image.create_hourglass(size, std::max(size/5, 1));
+    double NVoxels = pow(size+2.0, 3);
+    std::cout<<"INFO: "<<NVoxels<<" voxels, porosity "<<image.get_porosity()<<"."<<std::endl;
+
+    run_case("porosity", "voxels/s", no_setup, [&](){
+        volatile double porosity = image.get_porosity();
+        (void)porosity;
+        return NVoxels;
+      });
+
+    if(selected("read_raw")){
+      // The whole image is read and the central half cut out of it.
+      image.set_basename(basename);
+      image.write_nhdr();
+      std::string raw_filename = basename+".raw";
+      int offsets[] = {size/4, size/4, size/4};
+
+      run_case("read_raw", "voxels/s", no_setup, [&](){
+          CTImage slab;
+          slab.read(raw_filename, offsets, size/2);
+          return NVoxels;
+        });
+
+      boost::filesystem::remove(basename+".nhdr");
+      boost::filesystem::remove(raw_filename);
+    }
+  }
+
+  // Mesh kernels.
+  std::vector<double> xyz;
+  std::vector<int> tets;
+  create_cube_mesh(ncells, xyz, tets);
+  int NTetra = tets.size()/4;
+
+  std::cout<<"INFO: "<<xyz.size()/3<<" nodes, "<<NTetra<<" elements."<<std::endl;
+
+  std::vector<double> domain_xyz;
+  std::vector<int> domain_tets, domain_facets, domain_facet_ids;
+  run_case("create_domain", "tets/s", [&](){
+      domain_xyz = xyz;
+      domain_tets = tets;
+    }, [&](){
+      create_domain(0, domain_xyz, domain_tets, domain_facets, domain_facet_ids);
+      return (double)NTetra;
+    });
+  if(domain_tets.empty()){
+    domain_xyz = xyz;
+    domain_tets = tets;
+    create_domain(0, domain_xyz, domain_tets, domain_facets, domain_facet_ids);
+  }
+
+  CTImage image;
+  run_case("trim_channels", "tets/s", [&](){
+      image.get_xyz() = domain_xyz;
+      image.get_tets() = domain_tets;
+      image.get_facets() = domain_facets;
+      image.get_facet_ids() = domain_facet_ids;
+    }, [&](){
+      image.trim_channels(1, 2);
+      return (double)domain_tets.size()/4;
+    });
+
+  // Geometry kernels, scalar against batched.
+  std::vector<int> facets(NTetra*3);
+  for(int i=0;i<NTetra;i++)
+    for(int j=0;j<3;j++)
+      facets[i*3+j] = tets[i*4+j];
+
+  std::vector<double> a(NTetra*6), b(NTetra*6);
+
+  run_case("volume", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int i=0;i<NTetra;i++)
+        a[i] = volume(&(xyz[tets[i*4]*3]), &(xyz[tets[i*4+1]*3]), &(xyz[tets[i*4+2]*3]), &(xyz[tets[i*4+3]*3]));
+      return (double)NTetra;
+    });
+  run_case("volume_batched", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int k=0;k<NTetra;k+=GEOMETRY_BLOCK)
+        tet_volumes(xyz.data(), tets.data()+k*4, std::min(GEOMETRY_BLOCK, NTetra-k), b.data()+k);
+      return (double)NTetra;
+    });
+  compare("volume_batched", a, b, NTetra);
+
+  run_case("edge_lengths", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int i=0;i<NTetra;i++){
+        int l=0;
+        for(int j=0;j<4;j++)
+          for(int k=j+1;k<4;k++){
+            const double *x0 = &(xyz[tets[i*4+j]*3]), *x1 = &(xyz[tets[i*4+k]*3]);
+            a[i*6+l++] = sqrt((x0[0]-x1[0])*(x0[0]-x1[0])+(x0[1]-x1[1])*(x0[1]-x1[1])+(x0[2]-x1[2])*(x0[2]-x1[2]));
+          }
+      }
+      return (double)NTetra;
+    });
+  run_case("edge_lengths_batched", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int k=0;k<NTetra;k+=GEOMETRY_BLOCK)
+        tet_edge_lengths(xyz.data(), tets.data()+k*4, std::min(GEOMETRY_BLOCK, NTetra-k), b.data()+k*6);
+      return (double)NTetra;
+    });
+  compare("edge_lengths_batched", a, b, NTetra*6);
+
+  // Bounding box, as in the element size estimate of create_domain.
+  run_case("bounding_box", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int i=0;i<NTetra;i++){
+        int vid = tets[i*4];
+        double lbbox[] = {xyz[vid*3],   xyz[vid*3],
+                          xyz[vid*3+1], xyz[vid*3+1],
+                          xyz[vid*3+2], xyz[vid*3+2]};
+        for(int j=1;j<4;j++){
+          vid = tets[i*4+j];
+          for(int k=0;k<3;k++){
+            lbbox[k*2  ] = std::min(lbbox[k*2  ], xyz[vid*3+k]);
+            lbbox[k*2+1] = std::max(lbbox[k*2+1], xyz[vid*3+k]);
+          }
+        }
+        for(int k=0;k<6;k++)
+          a[i*6+k] = lbbox[k];
+      }
+      return (double)NTetra;
+    });
+  run_case("bounding_box_batched", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int k=0;k<NTetra;k+=GEOMETRY_BLOCK)
+        tet_bounding_boxes(xyz.data(), tets.data()+k*4, std::min(GEOMETRY_BLOCK, NTetra-k), b.data()+k*6);
+      return (double)NTetra;
+    });
+  compare("bounding_box_batched", a, b, NTetra*6);
+
+  run_case("centroid", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int i=0;i<NTetra;i++)
+        for(int k=0;k<3;k++)
+          a[i*3+k] = (xyz[tets[i*4]*3+k]+xyz[tets[i*4+1]*3+k]+xyz[tets[i*4+2]*3+k]+xyz[tets[i*4+3]*3+k])/4;
+      return (double)NTetra;
+    });
+  run_case("centroid_batched", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int k=0;k<NTetra;k+=GEOMETRY_BLOCK)
+        tet_centroids(xyz.data(), tets.data()+k*4, std::min(GEOMETRY_BLOCK, NTetra-k), b.data()+k*3);
+      return (double)NTetra;
+    });
+  compare("centroid_batched", a, b, NTetra*3);
+
+  // Facet normal, using the first three nodes of each element as facets.
+  run_case("facet_normal", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int i=0;i<NTetra;i++){
+        const double *x0 = &(xyz[facets[i*3]*3]), *x1 = &(xyz[facets[i*3+1]*3]), *x2 = &(xyz[facets[i*3+2]*3]);
+        double u[] = {x1[0]-x0[0], x1[1]-x0[1], x1[2]-x0[2]};
+        double v[] = {x2[0]-x0[0], x2[1]-x0[1], x2[2]-x0[2]};
+        a[i*3  ] = 0.5*(u[1]*v[2]-u[2]*v[1]);
+        a[i*3+1] = 0.5*(u[2]*v[0]-u[0]*v[2]);
+        a[i*3+2] = 0.5*(u[0]*v[1]-u[1]*v[0]);
+      }
+      return (double)NTetra;
+    });
+  run_case("facet_normal_batched", "tets/s", no_setup, [&](){
+#pragma omp parallel for
+      for(int k=0;k<NTetra;k+=GEOMETRY_BLOCK)
+        facet_normals(xyz.data(), facets.data()+k*3, std::min(GEOMETRY_BLOCK, NTetra-k), b.data()+k*3);
+      return (double)NTetra;
+    });
+  compare("facet_normal_batched", a, b, NTetra*3);
+
+  // File kernels, on the trimmed cube.
+  run_case("write_gmsh", "MB/s", no_setup, [&](){
+      write_gmsh_file(basename, domain_xyz, domain_tets, domain_facets, domain_facet_ids);
+      return file_size(basename+".msh")*1.0e-6;
+    });
+  boost::filesystem::remove(basename+".msh");
+
+  run_case("write_vtk", "MB/s", no_setup, [&](){
+      write_vtk_file(basename, domain_xyz, domain_tets, domain_facets, domain_facet_ids);
+      return (file_size(basename+".vtu")+file_size(basename+"_facets.vtu"))*1.0e-6;
+    });
+  boost::filesystem::remove(basename+".vtu");
+  boost::filesystem::remove(basename+"_facets.vtu");
+
+  if(selected("read_tarantula")){
+    std::string spm_filename = basename+".spm";
+    write_tarantula_file(spm_filename, xyz, tets);
+    double megabytes = file_size(spm_filename)*1.0e-6;
+
+    std::vector<double> spm_xyz;
+    std::vector<int> spm_tets;
+    run_case("read_tarantula", "MB/s", no_setup, [&](){
+        read_tarantula_mesh_file(spm_filename, "", false, spm_xyz, spm_tets);
+        return megabytes;
+      });
+    boost::filesystem::remove(spm_filename);
+  }
+
+  if(!csv_filename.empty())
+    write_csv(csv_filename);
+
+  if(!baseline_filename.empty()){
+    int regressions = compare_baseline(baseline_filename, tolerance);
+    if(regressions!=0){
+      if(regressions>0)
+        std::cerr<<"ERROR: "<<regressions<<" case(s) slower than the baseline"<<std::endl;
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,194 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+// Python bindings (pybind11). The mesh arrays are handed to numpy
+// without copying: CTImage arrays are views that keep the CTImage
+// alive, and the arrays returned by create_domain own their storage.
+// The methods that reallocate the mesh (mesh, trim_channels, refine,
+// reorder) raise RuntimeError while any view of it is still referenced.
+//
+//   import numpy, pyporeflow
+//   image = pyporeflow.CTImage()
+//   image.read("Berea.nhdr", slab=64)
+//   image.mesh()
+//   image.trim_channels(1, 2)
+//   xyz, tets = image.xyz, image.tets
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <array>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "CTImage.h"
+#include "mesh_conversion.h"
+
+namespace py = pybind11;
+
+// Shape (size/ncols, ncols), or (size,) if ncols is 1.
+template<typename T>
+py::array_t<T> array_view(std::vector<T> &v, size_t ncols, py::handle base){
+  if(ncols==1)
+    return py::array_t<T>({v.size()}, {sizeof(T)}, v.data(), base);
+  return py::array_t<T>({v.size()/ncols, ncols}, {ncols*sizeof(T), sizeof(T)}, v.data(), base);
+}
+
+// Move v onto the heap and let numpy free it with the array.
+template<typename T>
+py::array_t<T> array_take(std::vector<T> &v, size_t ncols){
+  std::vector<T> *owner = new std::vector<T>();
+  owner->swap(v);
+  py::capsule free_when_done(owner, [](void *p){delete reinterpret_cast<std::vector<T> *>(p);});
+  return array_view(*owner, ncols, free_when_done);
+}
+
+// Number of live numpy views of the mesh arrays of each CTImage. Only
+// touched with the GIL held.
+static std::map<const CTImage *, int> mesh_views;
+
+// The base object of a view: holds a reference to the CTImage and
+// counts the view until numpy (and every array derived from it) lets go.
+struct MeshView{
+  py::object owner;
+  const CTImage *image;
+};
+
+template<typename T>
+py::array_t<T> mesh_view(py::object self, std::vector<T> &v, size_t ncols){
+  MeshView *view = new MeshView{self, &self.cast<CTImage &>()};
+  mesh_views[view->image]++;
+  py::capsule base(view, [](void *p){
+      MeshView *view = reinterpret_cast<MeshView *>(p);
+      if(--mesh_views[view->image]==0)
+	mesh_views.erase(view->image);
+      delete view;
+    });
+  return array_view(v, ncols, base);
+}
+
+void check_no_mesh_views(const CTImage &self, const char *method){
+  if(mesh_views.count(&self))
+    throw std::runtime_error(std::string(method)+"() would reallocate the mesh while numpy arrays of xyz, tets, facets "
+			     "or facet_ids are still referenced; delete them, or copy them with numpy.array(), first");
+}
+
+template<typename T>
+std::vector<T> to_vector(py::array_t<T, py::array::c_style | py::array::forcecast> a){
+  return std::vector<T>(a.data(), a.data()+a.size());
+}
+
+PYBIND11_MODULE(pyporeflow, m){
+  m.doc() = "poreflow meshing of micro-CT images";
+
+  py::class_<CTImage>(m, "CTImage")
+    .def(py::init<>())
+    .def("verbose_on", &CTImage::verbose_on)
+    .def("read", [](CTImage &self, std::string filename, std::array<int, 3> offsets, int slab){
+	if(self.read(filename, offsets.data(), slab)<0)
+	  throw std::runtime_error("failed to read "+filename);
+      }, py::arg("filename"), py::arg("offsets")=std::array<int, 3>{{0, 0, 0}}, py::arg("slab")=-1)
+    .def("create_hourglass", &CTImage::create_hourglass, py::arg("size"), py::arg("throat_width"))
+    .def("set_threshold", &CTImage::set_threshold)
+    .def("segment", &CTImage::segment)
+    .def("prune", &CTImage::prune, py::arg("axis")=0)
+    .def("get_porosity", &CTImage::get_porosity)
+    .def("mesh", [](CTImage &self){
+	check_no_mesh_views(self, "mesh");
+	py::gil_scoped_release release;
+	self.mesh();
+      })
+    .def("set_basename", &CTImage::set_basename)
+    .def("set_resolution", &CTImage::set_resolution)
+    .def("trim_channels", [](CTImage &self, int in_boundary, int out_boundary){
+	check_no_mesh_views(self, "trim_channels");
+	self.trim_channels(in_boundary, out_boundary);
+      }, py::arg("in_boundary")=1, py::arg("out_boundary")=2)
+    .def("refine", [](CTImage &self, int levels){
+	check_no_mesh_views(self, "refine");
+	self.refine(levels);
+      }, py::arg("levels"))
+    .def("reorder", [](CTImage &self, std::string method){
+	check_no_mesh_views(self, "reorder");
+	return self.reorder(method);
+      }, py::arg("method"))
+    .def("write_gmsh", [](CTImage &self, std::string filename, bool binary){
+	return self.write_gmsh(filename.c_str(), binary);
+      }, py::arg("filename"), py::arg("binary")=false)
+    .def("write_vtu", [](CTImage &self, std::string filename, bool combined){
+	self.write_vtu(filename.c_str(), combined);
+      }, py::arg("filename"), py::arg("combined")=false)
+    .def("write_xdmf", [](CTImage &self, std::string filename, int compression){
+	return self.write_xdmf(filename.c_str(), compression);
+      }, py::arg("filename"), py::arg("compression")=0)
+    .def("write_native", [](CTImage &self, std::string filename){
+	return self.write_native(filename.c_str());
+      })
+    .def("write_statistics", [](CTImage &self, std::string filename){
+	return self.write_statistics(filename.c_str());
+      })
+    // Views of the mesh arrays; see mesh_view.
+    .def_property_readonly("xyz", [](py::object self){
+	return mesh_view(self, self.cast<CTImage &>().get_xyz(), 3);
+      })
+    .def_property_readonly("tets", [](py::object self){
+	return mesh_view(self, self.cast<CTImage &>().get_tets(), 4);
+      })
+    .def_property_readonly("facets", [](py::object self){
+	return mesh_view(self, self.cast<CTImage &>().get_facets(), 3);
+      })
+    .def_property_readonly("facet_ids", [](py::object self){
+	return mesh_view(self, self.cast<CTImage &>().get_facet_ids(), 1);
+      })
+    .def_property_readonly("resolution", &CTImage::get_resolution);
+
+  m.def("create_domain", [](int axis, py::array_t<double, py::array::c_style | py::array::forcecast> xyz_in,
+			    py::array_t<int, py::array::c_style | py::array::forcecast> tets_in){
+	  // create_domain works in place, so the input is copied once.
+	  std::vector<double> xyz = to_vector(xyz_in);
+	  std::vector<int> tets = to_vector(tets_in), facets, facet_ids;
+	  {
+	    py::gil_scoped_release release;
+	    create_domain(axis, xyz, tets, facets, facet_ids);
+	  }
+	  return py::make_tuple(array_take(xyz, 3), array_take(tets, 4), array_take(facets, 3), array_take(facet_ids, 1));
+	}, py::arg("axis"), py::arg("xyz"), py::arg("tets"),
+	"Trim a tetrahedral mesh to the region connected to both sides along axis and label its boundary. Returns (xyz, tets, facets, facet_ids).");
+}
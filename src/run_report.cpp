@@ -0,0 +1,549 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "run_report.h"
+
+struct StageRecord{
+  std::string name;
+  int depth;
+  double seconds;  // -1 while the stage is open.
+  long count;      // -1 if not set.
+  long rss_begin, rss_end, hwm;
+  long long counters[NCOUNTERS];  // Counts at the start while the stage is open.
+};
+
+static bool report_enabled = false;
+static std::string report_filename, report_command;
+static std::chrono::steady_clock::time_point report_start;
+static std::vector<StageRecord> report_stages;
+static std::vector<int> open_stages;
+static std::vector< std::pair<std::string, double> > report_values;
+
+struct TraceEvent{
+  const char *name, *category;
+  double begin, duration;  // Microseconds since start_trace().
+};
+
+// One list of events per thread, padded so that threads appending to
+// their own lists do not share cache lines.
+struct ThreadEvents{
+  std::vector<TraceEvent> events;
+  char padding[64];
+};
+
+static bool trace_enabled = false;
+static std::string trace_filename, trace_command;
+static std::chrono::steady_clock::time_point trace_start;
+static std::vector<ThreadEvents> trace_events;
+
+// One file descriptor per thread and counter, -1 if it is not open.
+static bool counters_on = false;
+static int counter_threads = 0;
+static std::vector<int> counter_fds;
+static bool counter_available[NCOUNTERS];
+
+static void add_trace_event(int thread, const char *name, const char *category,
+                            std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end){
+  TraceEvent event;
+  event.name = name;
+  event.category = category;
+  event.begin = std::chrono::duration<double, std::micro>(begin-trace_start).count();
+  event.duration = std::chrono::duration<double, std::micro>(end-begin).count();
+  trace_events[thread].events.push_back(event);
+}
+
+static void write_json_string(std::ofstream &file, const std::string &s){
+  file<<"\"";
+  for(size_t i=0;i<s.size();i++){
+    if(s[i]=='"' || s[i]=='\\')
+      file<<"\\"<<s[i];
+    else if((unsigned char)s[i]<0x20)
+      file<<" ";
+    else
+      file<<s[i];
+  }
+  file<<"\"";
+}
+
+static void write_kb(std::ofstream &file, long kb){
+  if(kb<0)
+    file<<"null";
+  else
+    file<<kb;
+}
+
+static void write_count(std::ofstream &file, double count){
+  if(count<0)
+    file<<"null";
+  else
+    file<<count;
+}
+
+static void write_counters(std::ofstream &file, const StageRecord &stage){
+  const long long *c = stage.counters;
+  file<<", \"counters\": {";
+  for(int i=0;i<NCOUNTERS;i++){
+    file<<(i==0?"":", ")<<"\""<<counter_name(i)<<"\": ";
+    write_count(file, c[i]);
+  }
+  file<<", \"ipc\": ";
+  write_count(file, (c[COUNTER_CYCLES]>0 && c[COUNTER_INSTRUCTIONS]>=0)?(double)c[COUNTER_INSTRUCTIONS]/c[COUNTER_CYCLES]:-1.0);
+  const int misses[] = {COUNTER_LLC_MISSES, COUNTER_DTLB_MISSES, COUNTER_BRANCH_MISSES};
+  for(int i=0;i<3;i++){
+    file<<", \""<<counter_name(misses[i])<<"_per_item\": ";
+    write_count(file, (stage.count>0 && c[misses[i]]>=0)?(double)c[misses[i]]/stage.count:-1.0);
+  }
+  file<<"}";
+}
+
+static void write_run_report(){
+  double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now()-report_start).count();
+
+  std::ofstream file;
+  file.open(report_filename.c_str());
+  if(!file.good()){
+    std::cerr<<"ERROR: Cannot write file: "<<report_filename<<std::endl;
+    return;
+  }
+  file<<std::setprecision(std::numeric_limits<double>::digits10+1);
+
+  long rss, hwm;
+  memory_usage(rss, hwm);
+
+  int threads = 1;
+#ifdef HAVE_OPENMP
+  threads = omp_get_max_threads();
+#endif
+
+  file<<"{"<<std::endl
+      <<"  \"command\": ";
+  write_json_string(file, report_command);
+  file<<","<<std::endl
+      <<"  \"threads\": "<<threads<<","<<std::endl
+      <<"  \"wall_time\": "<<wall_time<<","<<std::endl
+      <<"  \"rss_kb\": ";
+  write_kb(file, rss);
+  file<<","<<std::endl
+      <<"  \"peak_rss_kb\": ";
+  write_kb(file, hwm);
+  file<<","<<std::endl
+      <<"  \"stages\": [";
+  for(size_t i=0;i<report_stages.size();i++){
+    const StageRecord &stage = report_stages[i];
+    file<<(i==0?"":",")<<std::endl
+        <<"    {\"name\": ";
+    write_json_string(file, stage.name);
+    file<<", \"depth\": "<<stage.depth<<", \"seconds\": ";
+    if(stage.seconds<0)
+      file<<"null";
+    else
+      file<<stage.seconds;
+    file<<", \"count\": ";
+    if(stage.count<0)
+      file<<"null";
+    else
+      file<<stage.count;
+    file<<", \"rss_begin_kb\": ";
+    write_kb(file, stage.rss_begin);
+    file<<", \"rss_end_kb\": ";
+    write_kb(file, stage.rss_end);
+    file<<", \"peak_rss_kb\": ";
+    write_kb(file, stage.hwm);
+    if(counters_on && stage.seconds>=0)
+      write_counters(file, stage);
+    file<<"}";
+  }
+  file<<std::endl<<"  ],"<<std::endl
+      <<"  \"values\": {";
+  for(size_t i=0;i<report_values.size();i++){
+    file<<(i==0?"":", ");
+    write_json_string(file, report_values[i].first);
+    file<<": "<<report_values[i].second;
+  }
+  file<<"}"<<std::endl
+      <<"}"<<std::endl;
+
+  file.close();
+}
+
+static void write_trace(){
+  std::ofstream file;
+  file.open(trace_filename.c_str());
+  if(!file.good()){
+    std::cerr<<"ERROR: Cannot write file: "<<trace_filename<<std::endl;
+    return;
+  }
+  file<<std::fixed<<std::setprecision(3);
+
+  file<<"{\"displayTimeUnit\": \"ms\", \"traceEvents\": ["<<std::endl
+      <<"  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": ";
+  write_json_string(file, trace_command);
+  file<<"}}";
+  for(size_t t=0;t<trace_events.size();t++){
+    if(trace_events[t].events.empty())
+      continue;
+    file<<","<<std::endl
+        <<"  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "<<t
+        <<", \"args\": {\"name\": \"thread "<<t<<"\"}}";
+    for(size_t i=0;i<trace_events[t].events.size();i++){
+      const TraceEvent &event = trace_events[t].events[i];
+      file<<","<<std::endl
+          <<"  {\"name\": ";
+      write_json_string(file, event.name);
+      file<<", \"cat\": \""<<event.category<<"\", \"ph\": \"X\", \"ts\": "<<event.begin
+          <<", \"dur\": "<<event.duration<<", \"pid\": 1, \"tid\": "<<t<<"}";
+    }
+  }
+  file<<std::endl<<"]}"<<std::endl;
+
+  file.close();
+}
+
+void start_trace(std::string filename, int argc, char **argv){
+  if(trace_enabled)
+    return;
+
+  int threads = 1;
+#ifdef HAVE_OPENMP
+  threads = omp_get_max_threads();
+#endif
+  trace_events.resize(threads);
+
+  trace_enabled = true;
+  trace_filename = filename;
+  for(int i=0;i<argc;i++)
+    trace_command += (i==0?"":" ")+std::string(argv[i]);
+  trace_start = std::chrono::steady_clock::now();
+
+  atexit(write_trace);
+}
+
+void start_run_report(std::string filename, int argc, char **argv){
+  if(report_enabled)
+    return;
+
+  report_enabled = true;
+  report_filename = filename;
+  for(int i=0;i<argc;i++)
+    report_command += (i==0?"":" ")+std::string(argv[i]);
+  report_start = std::chrono::steady_clock::now();
+
+  // Written on exit so that every way out of main() is covered.
+  atexit(write_run_report);
+}
+
+bool run_report_enabled(){
+  return report_enabled;
+}
+
+void memory_usage(long &rss, long &hwm){
+  rss = -1;
+  hwm = -1;
+
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while(std::getline(status, line)){
+    if(line.compare(0, 6, "VmRSS:")==0)
+      rss = atol(line.c_str()+6);
+    else if(line.compare(0, 6, "VmHWM:")==0)
+      hwm = atol(line.c_str()+6);
+  }
+}
+
+void report_value(std::string name, double value){
+  if(!report_enabled)
+    return;
+
+  for(size_t i=0;i<report_values.size();i++){
+    if(report_values[i].first==name){
+      report_values[i].second = value;
+      return;
+    }
+  }
+  report_values.push_back(std::pair<std::string, double>(name, value));
+}
+
+const char *counter_name(int counter){
+  static const char *names[] = {"cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"};
+  return names[counter];
+}
+
+#ifdef __linux__
+// Count one event for the calling thread, in user space only so that
+// perf_event_paranoid=2 does not get in the way.
+static int open_counter(int counter){
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+  switch(counter){
+  case COUNTER_CYCLES:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case COUNTER_INSTRUCTIONS:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case COUNTER_LLC_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_LL|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+    break;
+  case COUNTER_DTLB_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+    break;
+  case COUNTER_BRANCH_MISSES:
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  }
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+int start_counters(){
+  if(counters_on)
+    return 0;
+
+  int threads = 1;
+#ifdef HAVE_OPENMP
+  threads = omp_get_max_threads();
+#endif
+  counter_threads = threads;
+  counter_fds.assign(threads*NCOUNTERS, -1);
+  std::vector<int> errors(threads*NCOUNTERS, 0);
+
+#ifdef __linux__
+  // Each thread of the team opens its own counters. The runtime keeps
+  // the same threads for later parallel regions.
+#pragma omp parallel num_threads(threads)
+  {
+    int thread = 0;
+#ifdef HAVE_OPENMP
+    thread = omp_get_thread_num();
+#endif
+    for(int i=0;i<NCOUNTERS;i++){
+      counter_fds[thread*NCOUNTERS+i] = open_counter(i);
+      if(counter_fds[thread*NCOUNTERS+i]<0)
+        errors[thread*NCOUNTERS+i] = errno;
+    }
+  }
+#else
+  for(size_t i=0;i<errors.size();i++)
+    errors[i] = ENOSYS;
+#endif
+
+  // A counter is only used if every thread has it.
+  int available = 0;
+  int error[NCOUNTERS];
+  for(int i=0;i<NCOUNTERS;i++){
+    counter_available[i] = true;
+    error[i] = 0;
+    for(int t=0;t<threads;t++){
+      if(counter_fds[t*NCOUNTERS+i]<0){
+        counter_available[i] = false;
+        error[i] = errors[t*NCOUNTERS+i];
+      }
+    }
+
+    if(counter_available[i]){
+      available++;
+    }else{
+#ifdef __linux__
+      for(int t=0;t<threads;t++){
+        if(counter_fds[t*NCOUNTERS+i]>=0)
+          close(counter_fds[t*NCOUNTERS+i]);
+        counter_fds[t*NCOUNTERS+i] = -1;
+      }
+#endif
+    }
+  }
+
+  if(available==0){
+    std::cerr<<"WARNING: Hardware counters are not available ("<<strerror(error[0])<<"), only times will be reported."<<std::endl;
+  }else{
+    for(int i=0;i<NCOUNTERS;i++){
+      if(!counter_available[i])
+        std::cerr<<"WARNING: Cannot count "<<counter_name(i)<<" ("<<strerror(error[i])<<")."<<std::endl;
+    }
+  }
+
+  counters_on = true;
+  return available;
+}
+
+bool counters_enabled(){
+  return counters_on;
+}
+
+void read_counters(long long counts[NCOUNTERS]){
+  for(int i=0;i<NCOUNTERS;i++){
+    counts[i] = -1;
+    if(!counters_on || !counter_available[i])
+      continue;
+
+#ifdef __linux__
+    // Scale up for the time the counter was not scheduled, when there
+    // are more events than hardware counters.
+    double total = 0.0;
+    for(int t=0;t<counter_threads;t++){
+      unsigned long long value[3];
+      if(read(counter_fds[t*NCOUNTERS+i], value, sizeof(value))!=sizeof(value)){
+        total = -1.0;
+        break;
+      }
+      if(value[2]>0)
+        total += (double)value[0]*value[1]/value[2];
+    }
+    counts[i] = (long long)total;
+#endif
+  }
+}
+
+ScopedStage::ScopedStage(const char *_name){
+  name = _name;
+  index = -1;
+  traced = false;
+  if(!report_enabled && !trace_enabled)
+    return;
+#ifdef HAVE_OPENMP
+  // Also with a team of one thread, so the stages do not depend on the
+  // number of threads.
+  if(omp_get_level()>0)
+    return;
+#endif
+
+  if(report_enabled){
+    StageRecord stage;
+    stage.name = open_stages.empty()?std::string(name):report_stages[open_stages.back()].name+"/"+name;
+    stage.depth = open_stages.size();
+    stage.seconds = -1;
+    stage.count = -1;
+    memory_usage(stage.rss_begin, stage.hwm);
+    stage.rss_end = -1;
+    read_counters(stage.counters);
+
+    index = report_stages.size();
+    report_stages.push_back(stage);
+    open_stages.push_back(index);
+  }
+  traced = trace_enabled;
+
+  start = std::chrono::steady_clock::now();
+}
+
+ScopedStage::~ScopedStage(){
+  stop();
+}
+
+void ScopedStage::stop(){
+  if(traced){
+    add_trace_event(0, name, "stage", start, std::chrono::steady_clock::now());
+    traced = false;
+  }
+
+  if(index<0)
+    return;
+
+  StageRecord &stage = report_stages[index];
+  stage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+  memory_usage(stage.rss_end, stage.hwm);
+  if(counters_on){
+    long long counts[NCOUNTERS];
+    read_counters(counts);
+    for(int i=0;i<NCOUNTERS;i++)
+      stage.counters[i] = (counts[i]<0 || stage.counters[i]<0)?-1:counts[i]-stage.counters[i];
+  }
+
+  open_stages.pop_back();
+  index = -1;
+}
+
+void ScopedStage::set_count(long count){
+  if(index>=0)
+    report_stages[index].count = count;
+}
+
+ThreadSpan::ThreadSpan(const char *_name){
+  name = NULL;
+  if(!trace_enabled)
+    return;
+#ifdef HAVE_OPENMP
+  if(omp_get_level()>1)
+    return;
+#endif
+
+  name = _name;
+  start = std::chrono::steady_clock::now();
+}
+
+ThreadSpan::~ThreadSpan(){
+  if(name==NULL)
+    return;
+
+  int thread = 0;
+#ifdef HAVE_OPENMP
+  thread = omp_get_thread_num();
+#endif
+  if(thread<(int)trace_events.size())
+    add_trace_event(thread, name, "parallel", start, std::chrono::steady_clock::now());
+}
@@ -35,10 +35,20 @@
  *  SUCH DAMAGE.
  */
 
+#include <algorithm>
+
 #include <getopt.h>
 
 #include "writers.h"
 #include "mesh_conversion.h"
+#include "mesh_reorder.h"
+#include "mesh_partition.h"
+#include "mesh_colouring.h"
+#include "mesh_refine.h"
+#include "mesh_coarsen.h"
+#include "mesh_smooth.h"
+#include "mesh_statistics.h"
+#include "run_report.h"
 
 
 void usage(char *cmd){
@@ -56,7 +66,26 @@ void usage(char *cmd){
 	   <<" -x, --x\n\tApply sweep align the x-axis (i.e. between the Y-Z parallel planes). This is the default.\n"
 	   <<" -y, --y\n\tApply sweep align the y-axis (i.e. between the X-Z parallel planes).\n"
 	   <<" -z, --z\n\tApply sweep align the z-axis (i.e. between the X-Y parallel planes).\n"
-           <<" -t, --toggle\n\tToggle the material selection for the mesh.\n";
+           <<" -C nelements, --coarsen nelements\n\tCoarsen the mesh by edge collapse until it has no more than nelements elements.\n"
+           <<" -O iterations, --smooth iterations\n\tOptimise the mesh with at most this many sweeps of smart Laplacian smoothing and sliver perturbation. Nodes on the boundary of the sample only move within their face.\n"
+           <<" -M seconds, --smooth-time seconds\n\tStop smoothing after this many seconds.\n"
+           <<" -R levels, --refine levels\n\tUniformly refine the mesh, splitting each element into 8, this many times.\n"
+           <<" -r method, --reorder method\n\tRenumber the mesh to improve cache locality before it is written. Options are rcm, hilbert.\n"
+           <<" -p nparts, --partition nparts\n\tAlso write the mesh split into nparts partitions, each with a halo map, so that it can be read in parallel.\n"
+           <<" -P method, --partitioner method\n\tPartitioning method. Options are rcb (default), rib, metis.\n"
+           <<" -H, --xdmf\n\tAlso write the mesh as XDMF/HDF5, which DOLFIN can read in parallel.\n"
+           <<" -Z level, --compress level\n\tCompress the HDF5 datasets with gzip at this level (1-9).\n"
+           <<" -u, --combined-vtu\n\tWith -v, write the elements and facets to a single VTU file.\n"
+           <<" -b, --binary\n\tWrite binary GMSH files.\n"
+           <<" -L, --low-memory\n\tWrite the trimmed mesh straight from the input without making a compacted copy, to cut the peak memory. Only the GMSH file is written, so this cannot be combined with the options that change or analyse the mesh.\n"
+           <<" -N, --native\n\tAlso write the mesh in the native binary format (.pfm), which can be memory mapped.\n"
+           <<" -S, --stats\n\tWrite mesh quality and geometry statistics to a JSON file.\n"
+           <<" -c, --colour\n\tColour the elements so that no two elements sharing a node have the same colour. The colour is written as the second element tag and the colour->elements table to a .colour file.\n"
+           <<" -t, --toggle\n\tToggle the material selection for the mesh.\n"
+           <<" -D, --dual\n\tMesh both materials in one pass: write basename_mat1.msh and basename_mat2.msh, where the facets shared by the two are labelled 8, and the shared facets to basename_interface.txt. Only -b and the axis options can be combined with this.\n"
+           <<" -J file, --report file\n\tWrite a JSON report of the time and memory used by each stage of the run.\n"
+           <<" -E file, --trace file\n\tWrite a timeline of the stages and of each thread in the parallel regions (Chrome trace format, for Perfetto).\n"
+           <<" -K, --counters\n\tAlso count the cycles, instructions and cache, TLB and branch misses of each stage in the report (Linux perf events). Needs -J.\n";
   return;
 }
 
@@ -65,12 +94,44 @@ int parse_arguments(int argc, char **argv,
 		    bool &verbose,
 		    bool &toggle_material,
 		    std::string &nhdr_filename,
-		    int &axis){
+		    int &axis,
+		    std::string &reorder,
+		    int &nparts,
+		    std::string &partitioner,
+		    bool &colour,
+		    int &refine,
+		    int &coarsen,
+		    int &smooth,
+		    double &smooth_time,
+		    bool &stats,
+		    bool &binary,
+		    bool &combined_vtu,
+		    bool &xdmf,
+		    int &compression,
+		    bool &native,
+		    bool &low_memory,
+		    bool &dual, std::string &report, std::string &trace, bool &counters){
 
   // Set defaults
+  counters = false;
   verbose = false;
   toggle_material = false;
   axis = 0;
+  nparts = 0;
+  partitioner = "rcb";
+  colour = false;
+  refine = 0;
+  coarsen = 0;
+  smooth = 0;
+  smooth_time = 0.0;
+  stats = false;
+  binary = false;
+  combined_vtu = false;
+  xdmf = false;
+  compression = 0;
+  native = false;
+  low_memory = false;
+  dual = false;
   
   if(argc==1){
     usage(argv[0]);
@@ -85,6 +146,25 @@ int parse_arguments(int argc, char **argv,
     {"x",  0, 0, 'x'},
     {"y",  0, 0, 'y'},
     {"z",  0, 0, 'z'},
+    {"reorder", required_argument, 0, 'r'},
+    {"partition", required_argument, 0, 'p'},
+    {"partitioner", required_argument, 0, 'P'},
+    {"colour", 0, 0, 'c'},
+    {"refine", required_argument, 0, 'R'},
+    {"coarsen", required_argument, 0, 'C'},
+    {"smooth", required_argument, 0, 'O'},
+    {"smooth-time", required_argument, 0, 'M'},
+    {"stats", 0, 0, 'S'},
+    {"binary", 0, 0, 'b'},
+    {"combined-vtu", 0, 0, 'u'},
+    {"xdmf", 0, 0, 'H'},
+    {"compress", required_argument, 0, 'Z'},
+    {"native", 0, 0, 'N'},
+    {"low-memory", 0, 0, 'L'},
+    {"dual", 0, 0, 'D'},
+    {"report", required_argument, 0, 'J'},
+    {"trace", required_argument, 0, 'E'},
+    {"counters", 0, 0, 'K'},
     {0, 0, 0, 0}
   };
 
@@ -92,7 +172,7 @@ int parse_arguments(int argc, char **argv,
   int verbosity = 0;
   int c;
 
-  const char *shortopts = "hn:vtxyz";
+  const char *shortopts = "hn:vtxyzr:p:P:cR:C:O:M:SbuHZ:NLDJ:E:K";
 
   // Set opterr to nonzero to make getopt print error messages
   opterr=1;
@@ -123,6 +203,63 @@ int parse_arguments(int argc, char **argv,
     case 'z':
       axis = 2;
       break;
+    case 'r':
+      reorder = std::string(optarg);
+      break;
+    case 'p':
+      nparts = atoi(optarg);
+      break;
+    case 'P':
+      partitioner = std::string(optarg);
+      break;
+    case 'c':
+      colour = true;
+      break;
+    case 'R':
+      refine = atoi(optarg);
+      break;
+    case 'C':
+      coarsen = atoi(optarg);
+      break;
+    case 'O':
+      smooth = atoi(optarg);
+      break;
+    case 'M':
+      smooth_time = atof(optarg);
+      break;
+    case 'S':
+      stats = true;
+      break;
+    case 'b':
+      binary = true;
+      break;
+    case 'u':
+      combined_vtu = true;
+      break;
+    case 'H':
+      xdmf = true;
+      break;
+    case 'Z':
+      compression = atoi(optarg);
+      break;
+    case 'N':
+      native = true;
+      break;
+    case 'L':
+      low_memory = true;
+      break;
+    case 'D':
+      dual = true;
+      break;
+    case 'J':
+      report = std::string(optarg);
+      break;
+    case 'E':
+      trace = std::string(optarg);
+      break;
+    case 'K':
+      counters = true;
+      break;
     case '?':
       // missing argument only returns ':' if the option string starts with ':'
       // but this seems to stop the printing of error messages by getopt?
@@ -149,13 +286,38 @@ int parse_arguments(int argc, char **argv,
     exit(0);
   }
 
+  if(dual && (low_memory || toggle_material || coarsen>0 || smooth>0 || smooth_time>0 || refine>0 || !reorder.empty() ||
+               colour || stats || xdmf || native || nparts>0)){
+    std::cerr<<"ERROR: --dual only writes the GMSH files of the two materials and cannot be combined with other options that change, analyse or write the mesh.\n";
+    exit(-1);
+  }
+
+  if(low_memory && (coarsen>0 || smooth>0 || smooth_time>0 || refine>0 || !reorder.empty() || colour ||
+                    stats || xdmf || native || nparts>0)){
+    std::cerr<<"ERROR: --low-memory only writes the GMSH file and cannot be combined with coarsening, smoothing, refinement, reordering, colouring, statistics, partitioning or other output formats.\n";
+    exit(-1);
+  }
+
+  if(counters && report.empty()){
+    std::cerr<<"ERROR: --counters adds the counts to the run report, so it needs --report.\n";
+    exit(-1);
+  }
 }
 
 int main(int argc, char **argv){
-  std::string filename, nhdr_filename;
-  bool verbose, toggle_material;
-  int axis = 0;
-  parse_arguments(argc, argv, filename, verbose, toggle_material, nhdr_filename, axis);
+  std::string filename, nhdr_filename, reorder, partitioner;
+  bool verbose, toggle_material, colour, stats, binary, combined_vtu, xdmf, native, low_memory, dual;
+  int axis = 0, nparts = 0, refine = 0, coarsen = 0, smooth = 0, compression = 0;
+  double smooth_time = 0.0;
+  std::string report, trace;
+  bool counters;
+  parse_arguments(argc, argv, filename, verbose, toggle_material, nhdr_filename, axis, reorder, nparts, partitioner, colour, refine, coarsen, smooth, smooth_time, stats, binary, combined_vtu, xdmf, compression, native, low_memory, dual, report, trace, counters);
+  if(!report.empty())
+    start_run_report(report, argc, argv);
+  if(!trace.empty())
+    start_trace(trace, argc, argv);
+  if(counters)
+    start_counters();
 
   std::string basename = filename.substr(0, filename.size()-4);
   
@@ -164,11 +326,65 @@ int main(int argc, char **argv){
 
   std::vector<double> xyz;
   std::vector<int> tets;
-  read_tarantula_mesh_file(filename, nhdr_filename, toggle_material, xyz, tets);
+  if(dual){
+    // Read and build the adjacency once, and write both materials from
+    // the same arrays.
+    std::vector<char> phase;
+    int nmaterials = read_tarantula_mesh_file(filename, nhdr_filename, xyz, tets, phase);
+    if(nmaterials<0)
+      return -1;
+    if(nmaterials!=2){
+      std::cerr<<"ERROR: --dual needs both the mat1 and mat2 lists in "<<filename<<std::endl;
+      return -1;
+    }
+    if(verbose)
+      std::cout<<"INFO: Finished reading "<<filename<<std::endl;
+
+    std::vector<char> keep[2];
+    std::vector<int> renumbering[2], facets[2], facet_ids[2], interface;
+    trim_phases(axis, xyz, tets, phase, keep, renumbering, facets, facet_ids, interface);
+    for(int p=0;p<2;p++){
+      std::string name = basename+(p==0?"_mat1":"_mat2");
+      if(renumbering[p].empty() || *std::max_element(renumbering[p].begin(), renumbering[p].end())<0){
+        std::cerr<<"WARNING: There is no active region in material "<<p+1<<", so "<<name<<".msh is not written."<<std::endl;
+        continue;
+      }
+      if(write_trimmed_gmsh_file(name, xyz, tets, keep[p], renumbering[p], facets[p], facet_ids[p], binary)<0)
+        return -1;
+    }
+    if(write_interface_file(basename, interface, renumbering)<0)
+      return -1;
+
+    if(verbose)
+      std::cout<<"INFO: Wrote both materials with "<<interface.size()/3<<" interface facets."<<std::endl;
+    return 0;
+  }
+
+  if(read_tarantula_mesh_file(filename, nhdr_filename, toggle_material, xyz, tets)<0)
+    return -1;
   
   if(verbose)
     std::cout<<"INFO: Finished reading "<<filename<<std::endl;
   
+  if(low_memory){
+    // Trim to a mask and renumbering only, and stream the output from
+    // the input arrays.
+    std::vector<int> renumbering, facets, facet_ids;
+    if(trim_domain(axis, xyz, tets, renumbering, facets, facet_ids)==0){
+      std::cerr<<"ERROR: There is no active region in the mesh."<<std::endl;
+      return -1;
+    }
+    if(verbose)
+      std::cout<<"INFO: Active domain created. Writing out mesh."<<std::endl;
+
+    if(write_trimmed_gmsh_file(basename, xyz, tets, renumbering, facets, facet_ids, binary)<0)
+      return -1;
+
+    if(verbose)
+      std::cout<<"INFO: Finished."<<std::endl;
+    return 0;
+  }
+
   // Generate facets and trim disconnnected parts of the domain.
   std::vector<int> facets, facet_ids;
   if(verbose){
@@ -191,13 +407,101 @@ int main(int argc, char **argv){
 
   if(verbose) 
     std::cout<<"INFO: Active domain created."<<std::endl;
+
+  if(coarsen>0){
+    int NTetra = tets.size()/4;
+    int rounds = coarsen_mesh(coarsen, 0.2, xyz, tets, facets, facet_ids);
+    if(verbose)
+      std::cout<<"INFO: Coarsened mesh from "<<NTetra<<" to "<<tets.size()/4<<" elements in "<<rounds<<" rounds."<<std::endl;
+  }
+
+  if(smooth>0 || smooth_time>0){
+    double q = worst_quality(xyz, tets);
+    int iterations = smooth_mesh(smooth>0?smooth:1000, smooth_time, 0.1, xyz, tets, facets, facet_ids);
+    if(verbose)
+      std::cout<<"INFO: Worst element quality before and after "<<iterations<<" smoothing iterations = "
+               <<q<<", "<<worst_quality(xyz, tets)<<std::endl;
+  }
+
+  for(int i=0;i<refine;i++){
+    refine_mesh(xyz, tets, facets, facet_ids);
+    if(verbose)
+      std::cout<<"INFO: Refinement level "<<i+1<<": "<<xyz.size()/3<<" nodes, "<<tets.size()/4<<" elements."<<std::endl;
+  }
+
+  if(!reorder.empty()){
+    int bandwidth = mesh_bandwidth(tets);
+    if(reorder_mesh(reorder, xyz, tets, facets, facet_ids)<0)
+      return -1;
+    std::cout<<"INFO: Mesh bandwidth before and after "<<reorder<<" reordering = "
+             <<bandwidth<<", "<<mesh_bandwidth(tets)<<std::endl;
+  }
   
+  std::vector<int> element_colour;
+  if(colour){
+    int ncolours = colour_elements(xyz.size()/3, tets, element_colour);
+    if(verbose)
+      std::cout<<"INFO: Number of element colours = "<<ncolours<<std::endl;
+
+    std::vector<int> colour_offsets, colour_table;
+    create_colour_table(element_colour, ncolours, colour_offsets, colour_table);
+    if(write_colour_file(basename, colour_offsets, colour_table)<0)
+      return -1;
+  }
+
+  if(stats){
+    MeshStatistics mesh_stats;
+    mesh_statistics(xyz, tets, facets, facet_ids, -1.0, mesh_stats);
+    if(write_statistics_file(basename+"_stats.json", mesh_stats)<0)
+      return -1;
+    if(verbose)
+      std::cout<<"INFO: Volume = "<<mesh_stats.volume<<", dihedral angles = ["<<mesh_stats.min_dihedral<<", "
+               <<mesh_stats.max_dihedral<<"], minimum radius ratio = "<<mesh_stats.min_radius_ratio<<std::endl;
+  }
+
+  report_value("nodes", xyz.size()/3);
+  report_value("elements", tets.size()/4);
+  report_value("facets", facet_ids.size());
+
   if(verbose){
     std::cout<<"INFO: Writing out mesh."<<std::endl;
-    write_vtk_file(basename, xyz, tets, facets, facet_ids);
+    write_vtk_file(basename, xyz, tets, facets, facet_ids, element_colour, combined_vtu);
+  }
+
+  if(binary){
+    if(write_gmsh_binary_file(basename, xyz, tets, facets, facet_ids, element_colour)<0)
+      return -1;
+  }else{
+    if(write_gmsh_file(basename, xyz, tets, facets, facet_ids, element_colour)<0)
+      return -1;
+  }
+
+  if(xdmf){
+    if(write_xdmf_file(basename, xyz, tets, facets, facet_ids, compression)<0)
+      return -1;
+  }
+
+  if(native){
+    double resolution = nhdr_filename.empty()?-1.0:read_resolution_from_nhdr(nhdr_filename);
+    if(write_binary_mesh_file(basename+".pfm", xyz, tets, facets, facet_ids, resolution)<0)
+      return -1;
   }
 
-  write_gmsh_file(basename, xyz, tets, facets, facet_ids);
+  if(nparts>0){
+    if(verbose)
+      std::cout<<"INFO: Partitioning mesh."<<std::endl;
+
+    std::vector<int> EEList, epart;
+    create_element_adjacency(xyz.size()/3, tets, EEList);
+    if(partition_mesh(partitioner, nparts, xyz, tets, EEList, epart)<0)
+      return -1;
+
+    if(verbose)
+      std::cout<<"INFO: Partition edge cut = "<<partition_edge_cut(EEList, epart)<<std::endl;
+
+    if(write_partitioned_gmsh_files(basename, nparts, epart, xyz, tets, facets, facet_ids, binary)<0)
+      return -1;
+  }
   if(verbose)
     std::cout<<"INFO: Finished."<<std::endl;
 
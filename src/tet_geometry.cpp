@@ -0,0 +1,170 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include <cmath>
+
+#include "tet_geometry.h"
+
+// Gather the coordinates of a block of m entities with NV nodes each
+// into structure-of-arrays form, c[v*3+k][i] being coordinate k of node
+// v of entity i.
+template<int NV>
+static inline void gather(const double *xyz, const int *elements, int m, double c[][GEOMETRY_BLOCK]){
+  static const double origin[] = {0.0, 0.0, 0.0};
+  for(int i=0;i<m;i++){
+    const int *e = elements+i*NV;
+    bool masked = e[0]==-1;
+    for(int v=0;v<NV;v++){
+      const double *x = masked?origin:xyz+e[v]*3;
+      c[v*3  ][i] = x[0];
+      c[v*3+1][i] = x[1];
+      c[v*3+2][i] = x[2];
+    }
+  }
+}
+
+void tet_volumes(const double *xyz, const int *tets, int n, double *volumes){
+  double c[12][GEOMETRY_BLOCK];
+  for(int b=0;b<n;b+=GEOMETRY_BLOCK){
+    int m = std::min(GEOMETRY_BLOCK, n-b);
+    gather<4>(xyz, tets+b*4, m, c);
+
+    double *v = volumes+b;
+#pragma omp simd
+    for(int i=0;i<m;i++){
+      double x01 = c[0][i]-c[3][i];
+      double x02 = c[0][i]-c[6][i];
+      double x03 = c[0][i]-c[9][i];
+
+      double y01 = c[1][i]-c[4][i];
+      double y02 = c[1][i]-c[7][i];
+      double y03 = c[1][i]-c[10][i];
+
+      double z01 = c[2][i]-c[5][i];
+      double z02 = c[2][i]-c[8][i];
+      double z03 = c[2][i]-c[11][i];
+
+      v[i] = (-x03*(z02*y01 - z01*y02) + x02*(z03*y01 - z01*y03) - x01*(z03*y02 - z02*y03))/6;
+    }
+  }
+}
+
+void tet_edge_lengths(const double *xyz, const int *tets, int n, double *lengths){
+  double c[12][GEOMETRY_BLOCK];
+  for(int b=0;b<n;b+=GEOMETRY_BLOCK){
+    int m = std::min(GEOMETRY_BLOCK, n-b);
+    gather<4>(xyz, tets+b*4, m, c);
+
+    double *l = lengths+b*6;
+#pragma omp simd
+    for(int i=0;i<m;i++){
+      int k = 0;
+      for(int p=0;p<4;p++)
+        for(int q=p+1;q<4;q++){
+          double dx = c[p*3][i]-c[q*3][i], dy = c[p*3+1][i]-c[q*3+1][i], dz = c[p*3+2][i]-c[q*3+2][i];
+          l[i*6+k++] = sqrt(dx*dx+dy*dy+dz*dz);
+        }
+    }
+  }
+}
+
+void tet_bounding_boxes(const double *xyz, const int *tets, int n, double *bbox){
+  double c[12][GEOMETRY_BLOCK];
+  for(int b=0;b<n;b+=GEOMETRY_BLOCK){
+    int m = std::min(GEOMETRY_BLOCK, n-b);
+    gather<4>(xyz, tets+b*4, m, c);
+
+    double *bb = bbox+b*6;
+#pragma omp simd
+    for(int i=0;i<m;i++){
+      for(int k=0;k<3;k++){
+        bb[i*6+k*2  ] = std::min(std::min(c[k][i], c[3+k][i]), std::min(c[6+k][i], c[9+k][i]));
+        bb[i*6+k*2+1] = std::max(std::max(c[k][i], c[3+k][i]), std::max(c[6+k][i], c[9+k][i]));
+      }
+    }
+  }
+}
+
+// Shared by tet_centroids and facet_centroids.
+template<int NV>
+static void centroids(const double *xyz, const int *elements, int n, double *centroids){
+  double c[NV*3][GEOMETRY_BLOCK];
+  for(int b=0;b<n;b+=GEOMETRY_BLOCK){
+    int m = std::min(GEOMETRY_BLOCK, n-b);
+    gather<NV>(xyz, elements+b*NV, m, c);
+
+    double *mean = centroids+b*3;
+#pragma omp simd
+    for(int i=0;i<m;i++){
+      for(int k=0;k<3;k++){
+        double sum = 0.0;
+        for(int v=0;v<NV;v++)
+          sum += c[v*3+k][i];
+        mean[i*3+k] = sum/NV;
+      }
+    }
+  }
+}
+
+void tet_centroids(const double *xyz, const int *tets, int n, double *centroids){
+  ::centroids<4>(xyz, tets, n, centroids);
+}
+
+void facet_centroids(const double *xyz, const int *facets, int n, double *centroids){
+  ::centroids<3>(xyz, facets, n, centroids);
+}
+
+void facet_normals(const double *xyz, const int *facets, int n, double *normals){
+  double c[9][GEOMETRY_BLOCK];
+  for(int b=0;b<n;b+=GEOMETRY_BLOCK){
+    int m = std::min(GEOMETRY_BLOCK, n-b);
+    gather<3>(xyz, facets+b*3, m, c);
+
+    double *nrm = normals+b*3;
+#pragma omp simd
+    for(int i=0;i<m;i++){
+      double ax = c[3][i]-c[0][i], ay = c[4][i]-c[1][i], az = c[5][i]-c[2][i];
+      double bx = c[6][i]-c[0][i], by = c[7][i]-c[1][i], bz = c[8][i]-c[2][i];
+
+      nrm[i*3  ] = 0.5*(ay*bz-az*by);
+      nrm[i*3+1] = 0.5*(az*bx-ax*bz);
+      nrm[i*3+2] = 0.5*(ax*by-ay*bx);
+    }
+  }
+}
@@ -0,0 +1,259 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "text_reader.h"
+#include "run_report.h"
+
+static inline bool is_space(char c){
+  return c==' ' || c=='\n' || c=='\t' || c=='\r' || c=='\f' || c=='\v';
+}
+
+static inline bool is_digit(char c){
+  return c>='0' && c<='9';
+}
+
+const char *parse_int(const char *p, const char *end, long &value){
+  while(p<end && is_space(*p))
+    p++;
+
+  bool negative = false;
+  if(p<end && (*p=='-' || *p=='+')){
+    negative = *p=='-';
+    p++;
+  }
+  if(p==end || !is_digit(*p))
+    return NULL;
+
+  unsigned long v = 0;
+  while(p<end && is_digit(*p))
+    v = v*10+(*p++-'0');
+  value = negative?-(long)v:(long)v;
+
+  return p;
+}
+
+const char *parse_double(const char *p, const char *end, double &value){
+  // Exact powers of ten.
+  static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  while(p<end && is_space(*p))
+    p++;
+  const char *start = p;
+
+  bool negative = false;
+  if(p<end && (*p=='-' || *p=='+')){
+    negative = *p=='-';
+    p++;
+  }
+
+  // Collect up to 19 significant digits.
+  uint64_t mantissa = 0;
+  int ndigits = 0, exponent = 0;
+  bool exact = true, any = false;
+  while(p<end && is_digit(*p)){
+    if(ndigits<19){
+      mantissa = mantissa*10+(*p-'0');
+      if(mantissa)
+        ndigits++;
+    }else{
+      exponent++;
+      exact = false;
+    }
+    any = true;
+    p++;
+  }
+  if(p<end && *p=='.'){
+    p++;
+    while(p<end && is_digit(*p)){
+      if(ndigits<19){
+        mantissa = mantissa*10+(*p-'0');
+        if(mantissa)
+          ndigits++;
+        exponent--;
+      }else{
+        exact = false;
+      }
+      any = true;
+      p++;
+    }
+  }
+  if(p+1<end && (*p=='e' || *p=='E') && any && !is_space(p[1])){
+    long e;
+    const char *q = parse_int(p+1, end, e);
+    if(q==NULL)
+      return NULL;
+    exponent += std::max(-100000L, std::min(100000L, e));
+    p = q;
+  }
+
+  // A product or quotient of two exactly representable values is
+  // correctly rounded (Clinger's fast path). Anything else, including
+  // inf and nan, is left to strtod in the C locale.
+  if(any && exact && mantissa<=(uint64_t(1)<<53) && exponent>=-22 && exponent<=22){
+    value = exponent<0?mantissa/powers[-exponent]:mantissa*powers[exponent];
+    if(negative)
+      value = -value;
+    return p;
+  }
+
+  // strtod needs a terminated string, which the end of a mapped file is
+  // not, so copy the token out first.
+  char token[64];
+  size_t len = 0;
+  p = start;
+  while(p<end && !is_space(*p) && len<sizeof(token)-1)
+    token[len++] = *p++;
+  token[len] = '\0';
+  char *stop;
+  value = strtod(token, &stop);
+  if(stop==token)
+    return NULL;
+
+  return start+(stop-token);
+}
+
+const char *next_line(const char *p, const char *end){
+  p = (const char *)memchr(p, '\n', end-p);
+  return p==NULL?end:p+1;
+}
+
+MappedFile::MappedFile(std::string filename){
+  data = NULL;
+  length = 0;
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd<0){
+    std::cerr<<"ERROR: Cannot read file: "<<filename<<std::endl;
+    return;
+  }
+
+  struct stat sb;
+  if(fstat(fd, &sb)==0 && sb.st_size>0){
+    void *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map==MAP_FAILED){
+      std::cerr<<"ERROR: Cannot map file: "<<filename<<std::endl;
+    }else{
+      data = (const char *)map;
+      length = sb.st_size;
+      madvise(map, length, MADV_SEQUENTIAL);
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile(){
+  if(data!=NULL)
+    munmap((void *)data, length);
+}
+
+bool MappedFile::good() const{
+  return data!=NULL;
+}
+
+const char *MappedFile::begin() const{
+  return data;
+}
+
+const char *MappedFile::end() const{
+  return data+length;
+}
+
+size_t MappedFile::size() const{
+  return length;
+}
+
+LineIndex::LineIndex(const char *begin, const char *end){
+  first = begin;
+  last = end;
+
+  long nblocks = (end-begin+LINE_BLOCK-1)/LINE_BLOCK;
+  block_lines.assign(nblocks+1, 0);
+#pragma omp parallel
+  {
+    ThreadSpan span("index lines");
+#pragma omp for nowait
+    for(long b=0;b<nblocks;b++){
+      const char *p = begin+b*LINE_BLOCK;
+      const char *block_end = std::min(end, p+LINE_BLOCK);
+      size_t cnt = 0;
+      while((p = (const char *)memchr(p, '\n', block_end-p))!=NULL){
+        cnt++;
+        p++;
+      }
+      block_lines[b+1] = cnt;
+    }
+  }
+  for(long b=0;b<nblocks;b++)
+    block_lines[b+1] += block_lines[b];
+}
+
+size_t LineIndex::size() const{
+  size_t n = block_lines.back();
+  if(last>first && last[-1]!='\n')
+    n++;
+  return n;
+}
+
+const char *LineIndex::line(size_t n) const{
+  if(n==0)
+    return first;
+  if(n>block_lines.back())
+    return last;
+
+  // Line n starts after the n-th newline.
+  size_t b = std::lower_bound(block_lines.begin(), block_lines.end(), n)-block_lines.begin()-1;
+  const char *p = first+b*LINE_BLOCK;
+  for(size_t cnt=block_lines[b];;cnt++){
+    p = (const char *)memchr(p, '\n', last-p)+1;
+    if(cnt+1==n)
+      return p;
+  }
+}
@@ -0,0 +1,423 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <string>
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "text_writer.h"
+
+void format_int(std::string &buffer, long value){
+  char digits[24];
+  int n = 0;
+  unsigned long v = value<0?-(unsigned long)value:value;
+  do{
+    digits[n++] = '0'+v%10;
+    v /= 10;
+  }while(v);
+  if(value<0)
+    buffer.push_back('-');
+  while(n)
+    buffer.push_back(digits[--n]);
+}
+
+// Shortest round trip conversion of doubles with the Grisu3 algorithm
+// (F. Loitsch, "Printing floating-point numbers quickly and accurately
+// with integers", PLDI 2010), using only 64 bit integer arithmetic. For
+// the few values (about 0.5%) where Grisu3 cannot prove its digits are
+// the shortest, printf is tried with increasing precision instead.
+namespace{
+
+// f*2^e
+struct DiyFp{
+  uint64_t f;
+  int e;
+  DiyFp(uint64_t _f, int _e) : f(_f), e(_e){}
+};
+
+// Upper 64 bits of the 128 bit product, rounded.
+DiyFp diyfp_mul(const DiyFp &x, const DiyFp &y){
+  uint64_t u_lo = x.f&0xFFFFFFFFu, u_hi = x.f>>32;
+  uint64_t v_lo = y.f&0xFFFFFFFFu, v_hi = y.f>>32;
+
+  uint64_t p0 = u_lo*v_lo, p1 = u_lo*v_hi, p2 = u_hi*v_lo, p3 = u_hi*v_hi;
+  uint64_t q = (p0>>32)+(p1&0xFFFFFFFFu)+(p2&0xFFFFFFFFu)+(uint64_t(1)<<31);
+
+  return DiyFp(p3+(p1>>32)+(p2>>32)+(q>>32), x.e+y.e+64);
+}
+
+DiyFp diyfp_normalize(DiyFp x){
+  while((x.f>>63)==0){
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+// value (positive and finite) and the boundaries m- and m+ half way to
+// its neighbours, all normalized to the same exponent.
+void diyfp_boundaries(double value, DiyFp &w, DiyFp &m_minus, DiyFp &m_plus){
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t F = bits&((uint64_t(1)<<52)-1);
+  int E = (bits>>52)&0x7FF;
+
+  DiyFp v = E==0?DiyFp(F, 1-1075):DiyFp(F+(uint64_t(1)<<52), E-1075);
+
+  // The gap below is half the size at powers of two.
+  bool lower_closer = F==0 && E>1;
+  m_plus = diyfp_normalize(DiyFp(2*v.f+1, v.e-1));
+  DiyFp lower = lower_closer?DiyFp(4*v.f-1, v.e-2):DiyFp(2*v.f-1, v.e-1);
+  m_minus = DiyFp(lower.f<<(lower.e-m_plus.e), m_plus.e);
+  w = DiyFp(v.f<<(v.e-m_plus.e), m_plus.e);
+}
+
+struct CachedPower{
+  uint64_t f;
+  int e, k;
+};
+
+// 10^k for k = -300, -292, ..., 324, normalized and rounded.
+const CachedPower cached_powers[] = {
+    {0xAB70FE17C79AC6CAULL, -1060, -300},
+    {0xFF77B1FCBEBCDC4FULL, -1034, -292},
+    {0xBE5691EF416BD60CULL, -1007, -284},
+    {0x8DD01FAD907FFC3CULL, -980, -276},
+    {0xD3515C2831559A83ULL, -954, -268},
+    {0x9D71AC8FADA6C9B5ULL, -927, -260},
+    {0xEA9C227723EE8BCBULL, -901, -252},
+    {0xAECC49914078536DULL, -874, -244},
+    {0x823C12795DB6CE57ULL, -847, -236},
+    {0xC21094364DFB5637ULL, -821, -228},
+    {0x9096EA6F3848984FULL, -794, -220},
+    {0xD77485CB25823AC7ULL, -768, -212},
+    {0xA086CFCD97BF97F4ULL, -741, -204},
+    {0xEF340A98172AACE5ULL, -715, -196},
+    {0xB23867FB2A35B28EULL, -688, -188},
+    {0x84C8D4DFD2C63F3BULL, -661, -180},
+    {0xC5DD44271AD3CDBAULL, -635, -172},
+    {0x936B9FCEBB25C996ULL, -608, -164},
+    {0xDBAC6C247D62A584ULL, -582, -156},
+    {0xA3AB66580D5FDAF6ULL, -555, -148},
+    {0xF3E2F893DEC3F126ULL, -529, -140},
+    {0xB5B5ADA8AAFF80B8ULL, -502, -132},
+    {0x87625F056C7C4A8BULL, -475, -124},
+    {0xC9BCFF6034C13053ULL, -449, -116},
+    {0x964E858C91BA2655ULL, -422, -108},
+    {0xDFF9772470297EBDULL, -396, -100},
+    {0xA6DFBD9FB8E5B88FULL, -369, -92},
+    {0xF8A95FCF88747D94ULL, -343, -84},
+    {0xB94470938FA89BCFULL, -316, -76},
+    {0x8A08F0F8BF0F156BULL, -289, -68},
+    {0xCDB02555653131B6ULL, -263, -60},
+    {0x993FE2C6D07B7FACULL, -236, -52},
+    {0xE45C10C42A2B3B06ULL, -210, -44},
+    {0xAA242499697392D3ULL, -183, -36},
+    {0xFD87B5F28300CA0EULL, -157, -28},
+    {0xBCE5086492111AEBULL, -130, -20},
+    {0x8CBCCC096F5088CCULL, -103, -12},
+    {0xD1B71758E219652CULL, -77, -4},
+    {0x9C40000000000000ULL, -50, 4},
+    {0xE8D4A51000000000ULL, -24, 12},
+    {0xAD78EBC5AC620000ULL, 3, 20},
+    {0x813F3978F8940984ULL, 30, 28},
+    {0xC097CE7BC90715B3ULL, 56, 36},
+    {0x8F7E32CE7BEA5C70ULL, 83, 44},
+    {0xD5D238A4ABE98068ULL, 109, 52},
+    {0x9F4F2726179A2245ULL, 136, 60},
+    {0xED63A231D4C4FB27ULL, 162, 68},
+    {0xB0DE65388CC8ADA8ULL, 189, 76},
+    {0x83C7088E1AAB65DBULL, 216, 84},
+    {0xC45D1DF942711D9AULL, 242, 92},
+    {0x924D692CA61BE758ULL, 269, 100},
+    {0xDA01EE641A708DEAULL, 295, 108},
+    {0xA26DA3999AEF774AULL, 322, 116},
+    {0xF209787BB47D6B85ULL, 348, 124},
+    {0xB454E4A179DD1877ULL, 375, 132},
+    {0x865B86925B9BC5C2ULL, 402, 140},
+    {0xC83553C5C8965D3DULL, 428, 148},
+    {0x952AB45CFA97A0B3ULL, 455, 156},
+    {0xDE469FBD99A05FE3ULL, 481, 164},
+    {0xA59BC234DB398C25ULL, 508, 172},
+    {0xF6C69A72A3989F5CULL, 534, 180},
+    {0xB7DCBF5354E9BECEULL, 561, 188},
+    {0x88FCF317F22241E2ULL, 588, 196},
+    {0xCC20CE9BD35C78A5ULL, 614, 204},
+    {0x98165AF37B2153DFULL, 641, 212},
+    {0xE2A0B5DC971F303AULL, 667, 220},
+    {0xA8D9D1535CE3B396ULL, 694, 228},
+    {0xFB9B7CD9A4A7443CULL, 720, 236},
+    {0xBB764C4CA7A44410ULL, 747, 244},
+    {0x8BAB8EEFB6409C1AULL, 774, 252},
+    {0xD01FEF10A657842CULL, 800, 260},
+    {0x9B10A4E5E9913129ULL, 827, 268},
+    {0xE7109BFBA19C0C9DULL, 853, 276},
+    {0xAC2820D9623BF429ULL, 880, 284},
+    {0x80444B5E7AA7CF85ULL, 907, 292},
+    {0xBF21E44003ACDD2DULL, 933, 300},
+    {0x8E679C2F5E44FF8FULL, 960, 308},
+    {0xD433179D9C8CB841ULL, 986, 316},
+    {0x9E19DB92B4E31BA9ULL, 1013, 324}
+};
+
+// A power 10^k so that the product with a number of binary exponent e
+// has a binary exponent in [-60, -32].
+const CachedPower &cached_power(int e){
+  int f = -60-e-1;
+  int k = (f*78913)/(1<<18)+(f>0);
+  return cached_powers[(300+k+7)/8];
+}
+
+// Move the last digit towards w while it stays inside the boundaries,
+// then check that the result is certainly the closest and certainly
+// inside them given the rounding errors (unit) of the scaling.
+bool grisu3_round(char *digits, int ndigits, uint64_t distance_too_high_w, uint64_t unsafe_interval,
+                  uint64_t rest, uint64_t ten_kappa, uint64_t unit){
+  uint64_t small_distance = distance_too_high_w-unit;
+  uint64_t big_distance = distance_too_high_w+unit;
+
+  while(rest<small_distance && unsafe_interval-rest>=ten_kappa &&
+        (rest+ten_kappa<small_distance || small_distance-rest>=rest+ten_kappa-small_distance)){
+    digits[ndigits-1]--;
+    rest += ten_kappa;
+  }
+
+  if(rest<big_distance && unsafe_interval-rest>=ten_kappa &&
+     (rest+ten_kappa<big_distance || big_distance-rest>rest+ten_kappa-big_distance))
+    return false;
+
+  return 2*unit<=rest && rest<=unsafe_interval-4*unit;
+}
+
+// Shortest digits with value = digits*10^exponent. Returns false if
+// they could not be found.
+bool grisu3(double value, char *digits, int &ndigits, int &exponent){
+  DiyFp w(0, 0), m_minus(0, 0), m_plus(0, 0);
+  diyfp_boundaries(value, w, m_minus, m_plus);
+
+  const CachedPower &c = cached_power(w.e);
+  DiyFp ten_mk(c.f, c.e);
+  DiyFp scaled_w = diyfp_mul(w, ten_mk);
+  DiyFp low = diyfp_mul(m_minus, ten_mk);
+  DiyFp high = diyfp_mul(m_plus, ten_mk);
+
+  // The products are each out by less than one unit.
+  uint64_t unit = 1;
+  DiyFp too_low(low.f-unit, low.e), too_high(high.f+unit, high.e);
+  uint64_t unsafe_interval = too_high.f-too_low.f;
+
+  DiyFp one(uint64_t(1)<<-scaled_w.e, scaled_w.e);
+  uint32_t integrals = too_high.f>>-one.e;
+  uint64_t fractionals = too_high.f&(one.f-1);
+
+  uint32_t divisor = 1;
+  int kappa = 1;
+  while(kappa<10 && integrals>=divisor*10){
+    divisor *= 10;
+    kappa++;
+  }
+
+  ndigits = 0;
+  while(kappa>0){
+    digits[ndigits++] = '0'+integrals/divisor;
+    integrals %= divisor;
+    kappa--;
+
+    uint64_t rest = (uint64_t(integrals)<<-one.e)+fractionals;
+    if(rest<unsafe_interval){
+      exponent = -c.k+kappa;
+      return grisu3_round(digits, ndigits, too_high.f-scaled_w.f, unsafe_interval, rest,
+                          uint64_t(divisor)<<-one.e, unit);
+    }
+    divisor /= 10;
+  }
+
+  while(true){
+    fractionals *= 10;
+    unit *= 10;
+    unsafe_interval *= 10;
+    digits[ndigits++] = '0'+(fractionals>>-one.e);
+    fractionals &= one.f-1;
+    kappa--;
+
+    if(fractionals<unsafe_interval){
+      exponent = -c.k+kappa;
+      return grisu3_round(digits, ndigits, (too_high.f-scaled_w.f)*unit, unsafe_interval, fractionals,
+                          one.f, unit);
+    }
+  }
+}
+
+// Digits and exponent from printf, increasing the precision until the
+// value reads back exactly.
+void printf_digits(double value, char *digits, int &ndigits, int &exponent){
+  char str[32];
+  for(int precision=1;precision<=17;precision++){
+    snprintf(str, sizeof(str), "%.*e", precision-1, value);
+    if(precision==17 || strtod(str, NULL)==value)
+      break;
+  }
+
+  // d.ddde[+-]xx
+  ndigits = 0;
+  const char *s = str;
+  for(;*s!='e';s++){
+    if(*s!='.')
+      digits[ndigits++] = *s;
+  }
+  while(ndigits>1 && digits[ndigits-1]=='0')
+    ndigits--;
+  exponent = atoi(s+1)-(ndigits-1);
+}
+
+}
+
+void format_double(std::string &buffer, double value){
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if(bits>>63){
+    buffer.push_back('-');
+    value = -value;
+  }
+
+  if(value==0.0){
+    buffer.push_back('0');
+    return;
+  }
+  if(value!=value){
+    buffer.append("nan");
+    return;
+  }
+  if(value>1.7976931348623157e308){
+    buffer.append("inf");
+    return;
+  }
+
+  char digits[24];
+  int ndigits, exponent;
+  if(!grisu3(value, digits, ndigits, exponent))
+    printf_digits(value, digits, ndigits, exponent);
+
+  // Laid out as printf's %.15g would (or %.16g or %.17g if more digits
+  // are needed): fixed notation unless the exponent is below -4 or at
+  // least the precision.
+  int x = ndigits+exponent-1;
+  if(x<-4 || x>=std::max(ndigits, 15)){
+    buffer.push_back(digits[0]);
+    if(ndigits>1){
+      buffer.push_back('.');
+      buffer.append(digits+1, ndigits-1);
+    }
+    buffer.push_back('e');
+    buffer.push_back(x<0?'-':'+');
+    if(x<0)
+      x = -x;
+    if(x<10)
+      buffer.push_back('0');
+    format_int(buffer, x);
+  }else if(exponent>=0){
+    buffer.append(digits, ndigits);
+    buffer.append(exponent, '0');
+  }else if(ndigits+exponent>0){
+    buffer.append(digits, ndigits+exponent);
+    buffer.push_back('.');
+    buffer.append(digits+ndigits+exponent, -exponent);
+  }else{
+    buffer.append("0.");
+    buffer.append(-(ndigits+exponent), '0');
+    buffer.append(digits, ndigits);
+  }
+}
+
+TextWriter::TextWriter(std::string _filename){
+  filename = _filename;
+  failed = false;
+  fd = open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if(fd<0)
+    std::cerr<<"ERROR: Cannot write file: "<<filename<<std::endl;
+}
+
+TextWriter::~TextWriter(){
+  close();
+}
+
+bool TextWriter::good() const{
+  return fd>=0 && !failed;
+}
+
+void TextWriter::write(const std::string &text){
+  write(text.data(), text.size());
+}
+
+void TextWriter::write(const char *data, size_t size){
+  if(!good())
+    return;
+
+  while(size>0){
+    ssize_t written = ::write(fd, data, size);
+    if(written<0){
+      if(errno==EINTR)
+        continue;
+      std::cerr<<"ERROR: Failed to write file: "<<filename<<std::endl;
+      failed = true;
+      return;
+    }
+    data += written;
+    size -= written;
+  }
+}
+
+int TextWriter::close(){
+  if(fd>=0){
+    if(::close(fd)<0)
+      failed = true;
+    fd = -1;
+    return failed?-1:0;
+  }
+  return -1;
+}
@@ -42,82 +42,214 @@
 #include <vtkIntArray.h>
 #include <vtkCellData.h>
 #include <vtkSmartPointer.h>
+#include <vtkCellArray.h>
+#include <vtkCellType.h>
+#include <vtkDoubleArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkUnsignedCharArray.h>
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <cassert>
+#include <cstring>
+#include <stdint.h>
 #include <limits>
 
+#ifdef HAVE_HDF5
+#include <hdf5.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "writers.h"
+#include "run_report.h"
+#include "text_writer.h"
+
+// Wrap the coordinates in vtkPoints without copying them; xyz must
+// outlive the points.
+static vtkSmartPointer<vtkPoints> wrap_points(std::vector<double> &xyz){
+  vtkSmartPointer<vtkDoubleArray> coords = vtkSmartPointer<vtkDoubleArray>::New();
+  coords->SetNumberOfComponents(3);
+  coords->SetArray(xyz.data(), xyz.size(), 1);
+
+  vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+  pts->SetData(coords);
+
+  return pts;
+}
+
+// Create an unstructured grid holding the tetrahedra listed in live
+// followed by all the facets. The cell arrays are filled in bulk.
+static vtkSmartPointer<vtkUnstructuredGrid> create_unstructured_grid(vtkPoints *pts,
+                                                                     const std::vector<int> &live,
+                                                                     const std::vector<int> &tets,
+                                                                     const std::vector<int> &facets){
+  vtkIdType NTetra = live.size();
+  vtkIdType NFacets = facets.size()/3;
+  vtkIdType NCells = NTetra+NFacets;
+
+  vtkSmartPointer<vtkUnsignedCharArray> types = vtkSmartPointer<vtkUnsignedCharArray>::New();
+  unsigned char *type = types->WritePointer(0, NCells);
+
+  vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
+  vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
+  ug->SetPoints(pts);
+
+#if VTK_MAJOR_VERSION >= 9
+  vtkSmartPointer<vtkIdTypeArray> offsets = vtkSmartPointer<vtkIdTypeArray>::New();
+  vtkSmartPointer<vtkIdTypeArray> connectivity = vtkSmartPointer<vtkIdTypeArray>::New();
+  vtkIdType *offset = offsets->WritePointer(0, NCells+1);
+  vtkIdType *conn = connectivity->WritePointer(0, NTetra*4+NFacets*3);
+
+#pragma omp parallel
+  {
+#pragma omp for nowait
+    for(vtkIdType i=0;i<NTetra;i++){
+      type[i] = VTK_TETRA;
+      offset[i] = i*4;
+      for(int j=0;j<4;j++)
+        conn[i*4+j] = tets[live[i]*4+j];
+    }
+#pragma omp for nowait
+    for(vtkIdType i=0;i<NFacets;i++){
+      type[NTetra+i] = VTK_TRIANGLE;
+      offset[NTetra+i] = NTetra*4+i*3;
+      for(int j=0;j<3;j++)
+        conn[NTetra*4+i*3+j] = facets[i*3+j];
+    }
+  }
+  offset[NCells] = NTetra*4+NFacets*3;
+
+  cells->SetData(offsets, connectivity);
+  ug->SetCells(types, cells);
+#else
+  // Legacy layout: each cell is stored as its size followed by its nodes.
+  vtkSmartPointer<vtkIdTypeArray> legacy = vtkSmartPointer<vtkIdTypeArray>::New();
+  vtkSmartPointer<vtkIdTypeArray> locations = vtkSmartPointer<vtkIdTypeArray>::New();
+  vtkIdType *conn = legacy->WritePointer(0, NTetra*5+NFacets*4);
+  vtkIdType *location = locations->WritePointer(0, NCells);
+
+#pragma omp parallel
+  {
+#pragma omp for nowait
+    for(vtkIdType i=0;i<NTetra;i++){
+      type[i] = VTK_TETRA;
+      location[i] = i*5;
+      conn[i*5] = 4;
+      for(int j=0;j<4;j++)
+        conn[i*5+1+j] = tets[live[i]*4+j];
+    }
+#pragma omp for nowait
+    for(vtkIdType i=0;i<NFacets;i++){
+      type[NTetra+i] = VTK_TRIANGLE;
+      location[NTetra+i] = NTetra*5+i*4;
+      conn[NTetra*5+i*4] = 3;
+      for(int j=0;j<3;j++)
+        conn[NTetra*5+i*4+1+j] = facets[i*3+j];
+    }
+  }
+
+  cells->SetCells(NCells, legacy);
+  ug->SetCells(types, locations, cells);
+#endif
+
+  return ug;
+}
+
+// Write an unstructured grid as VTU with raw appended binary data.
+static void write_unstructured_grid(std::string filename, vtkUnstructuredGrid *ug){
+  vtkSmartPointer<vtkXMLUnstructuredGridWriter> writer = vtkSmartPointer<vtkXMLUnstructuredGridWriter>::New();
+  writer->SetFileName(filename.c_str());
+  writer->SetDataModeToAppended();
+  writer->EncodeAppendedDataOff();
+#if VTK_MAJOR_VERSION < 6
+  writer->SetInput(ug);
+#else
+  writer->SetInputData(ug);
+#endif
+  writer->Write();
+}
 
 int write_vtk_file(std::string filename,
                    std::vector<double> &xyz,
                    std::vector<int> &tets, 
                    std::vector<int> &facets,
-                   std::vector<int> &facet_ids){
-  
-  // Write out points
-  int NNodes = xyz.size()/3;
-  vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
-  pts->SetNumberOfPoints(NNodes);
-  for(int i=0;i<NNodes;i++)
-    pts->SetPoint(i, &(xyz[i*3]));
-  
-  // Initalise the vtk mesh
-  vtkSmartPointer<vtkUnstructuredGrid> ug_tets = vtkSmartPointer<vtkUnstructuredGrid>::New();
-  ug_tets->SetPoints(pts);
+                   std::vector<int> &facet_ids,
+                   const std::vector<int> &colour,
+                   bool combined){
+  ScopedStage stage("write_vtk");
+
+  vtkSmartPointer<vtkPoints> pts = wrap_points(xyz);
 
   int NTetra = tets.size()/4;
+  int NFacets = facet_ids.size();
+  std::vector<int> live;
+  live.reserve(NTetra);
   for(int i=0;i<NTetra;i++){
-    if(tets[i*4]==-1)
-      continue;
-    
-    vtkSmartPointer<vtkIdList> idlist = vtkSmartPointer<vtkIdList>::New();
-    for(int j=0;j<4;j++)
-      idlist->InsertNextId(tets[i*4+j]);
-    ug_tets->InsertNextCell(10, idlist);
+    if(tets[i*4]!=-1)
+      live.push_back(i);
   }
-  
-  vtkSmartPointer<vtkXMLUnstructuredGridWriter> tet_writer = vtkSmartPointer<vtkXMLUnstructuredGridWriter>::New();
-  tet_writer->SetFileName(std::string(filename+".vtu").c_str());
-#if VTK_MAJOR_VERSION < 6
-  tet_writer->SetInput(ug_tets);
-#else
-  tet_writer->SetInputData(ug_tets);
-#endif
-  tet_writer->Write();
+  int NLive = live.size();
+
+  if(combined){
+    // One grid with the elements followed by the facets sharing the
+    // points. Elements have a facet id of 0 and facets a colour of -1.
+    vtkSmartPointer<vtkUnstructuredGrid> ug = create_unstructured_grid(pts, live, tets, facets);
+
+    vtkSmartPointer<vtkIntArray> vtk_facet_ids = vtkSmartPointer<vtkIntArray>::New();
+    vtk_facet_ids->SetNumberOfComponents(1);
+    vtk_facet_ids->SetName("Facet IDs");
+    int *ids = vtk_facet_ids->WritePointer(0, NLive+NFacets);
+    std::fill(ids, ids+NLive, 0);
+    std::copy(facet_ids.begin(), facet_ids.end(), ids+NLive);
+    ug->GetCellData()->AddArray(vtk_facet_ids);
+
+    if(!colour.empty()){
+      vtkSmartPointer<vtkIntArray> vtk_colour = vtkSmartPointer<vtkIntArray>::New();
+      vtk_colour->SetNumberOfComponents(1);
+      vtk_colour->SetName("Colour");
+      int *c = vtk_colour->WritePointer(0, NLive+NFacets);
+      for(int i=0;i<NLive;i++)
+        c[i] = colour[live[i]];
+      std::fill(c+NLive, c+NLive+NFacets, -1);
+      ug->GetCellData()->AddArray(vtk_colour);
+    }
+
+    write_unstructured_grid(filename+".vtu", ug);
+
+    return 0;
+  }
+
+  vtkSmartPointer<vtkUnstructuredGrid> ug_tets = create_unstructured_grid(pts, live, tets, std::vector<int>());
+
+  if(!colour.empty()){
+    vtkSmartPointer<vtkIntArray> vtk_colour = vtkSmartPointer<vtkIntArray>::New();
+    vtk_colour->SetNumberOfComponents(1);
+    vtk_colour->SetName("Colour");
+    int *c = vtk_colour->WritePointer(0, NLive);
+    for(int i=0;i<NLive;i++)
+      c[i] = colour[live[i]];
+    ug_tets->GetCellData()->AddArray(vtk_colour);
+  }
+
+  write_unstructured_grid(filename+".vtu", ug_tets);
   
   if(facets.empty())
     return 0;
 
-  // Write out facets
-  vtkSmartPointer<vtkUnstructuredGrid> ug_facets = vtkSmartPointer<vtkUnstructuredGrid>::New();
-  ug_facets->SetPoints(pts);
-  int NFacets = facet_ids.size();
-  for(int i=0;i<NFacets;i++){
-    vtkSmartPointer<vtkIdList> idlist = vtkSmartPointer<vtkIdList>::New();
-    for(int j=0;j<3;j++){
-      idlist->InsertNextId(facets[i*3+j]);
-    }
-    ug_facets->InsertNextCell(5, idlist);
-  }
+  // Write out facets, sharing the points.
+  vtkSmartPointer<vtkUnstructuredGrid> ug_facets = create_unstructured_grid(pts, std::vector<int>(), tets, facets);
 
   vtkSmartPointer<vtkIntArray> vtk_facet_ids = vtkSmartPointer<vtkIntArray>::New();
-  vtk_facet_ids->SetNumberOfTuples(NFacets);
   vtk_facet_ids->SetNumberOfComponents(1);
   vtk_facet_ids->SetName("Facet IDs");
-  for(int i=0;i<NFacets;i++){
-    vtk_facet_ids->SetValue(i, facet_ids[i]);
-  }
+  vtk_facet_ids->SetArray(facet_ids.data(), NFacets, 1);
   ug_facets->GetCellData()->AddArray(vtk_facet_ids);
   
-  vtkSmartPointer<vtkXMLUnstructuredGridWriter> tri_writer = vtkSmartPointer<vtkXMLUnstructuredGridWriter>::New();
-  tri_writer->SetFileName(std::string(filename+"_facets.vtu").c_str());
-#if VTK_MAJOR_VERSION < 6
-  tri_writer->SetInput(ug_facets);
-#else
-  tri_writer->SetInputData(ug_facets);
-#endif
-  tri_writer->Write();
+  write_unstructured_grid(filename+"_facets.vtu", ug_facets);
 
   return 0;
 }
@@ -127,39 +259,60 @@ int write_triangle_file(std::string basename,
                         std::vector<int> &tets, 
                         std::vector<int> &facets,
                         std::vector<int> &facet_ids){
-  std::string filename_node = basename+".node";
-  std::string filename_face = basename+".face";
-  std::string filename_ele = basename+".ele";
-  
+  ScopedStage stage("write_triangle");
+
   int NNodes = xyz.size()/3;
   int NTetra = tets.size()/4;
   int NFacets = facet_ids.size();
   assert(NFacets==facets.size()/3);
 
-  ofstream nodefile;
-  nodefile.open(std::string(basename+".node").c_str());
-  nodefile<<NNodes<<" "<<3<<" "<<0<<" "<<0<<std::endl;
-  nodefile<<std::setprecision(std::numeric_limits<double>::digits10+1);
-  
-  for(int i=0;i<NNodes;i++){
-    nodefile<<i+1<<" "<<xyz[i*3]<<" "<<xyz[i*3+1]<<" "<<xyz[i*3+2]<<std::endl;
-  }
+  TextWriter nodefile(basename+".node");
+  std::string header;
+  format_int(header, NNodes);
+  header += " 3 0 0\n";
+  nodefile.write(header);
+  nodefile.write_records(NNodes, [&](size_t i, std::string &buffer){
+      format_int(buffer, i+1);
+      for(int k=0;k<3;k++){
+        buffer.push_back(' ');
+        format_double(buffer, xyz[i*3+k]);
+      }
+      buffer.push_back('\n');
+    });
 
-  ofstream elefile;
-  elefile.open(std::string(basename+".ele").c_str());
-  elefile<<NTetra<<" "<<4<<" "<<1<<std::endl;
+  TextWriter elefile(basename+".ele");
+  header.clear();
+  format_int(header, NTetra);
+  header += " 4 1\n";
+  elefile.write(header);
+  elefile.write_records(NTetra, [&](size_t i, std::string &buffer){
+      format_int(buffer, i+1);
+      for(int k=0;k<4;k++){
+        buffer.push_back(' ');
+        format_int(buffer, tets[i*4+k]+1);
+      }
+      buffer += " 1\n";
+    });
 
-  for(int i=0;i<NTetra;i++){
-    elefile<<i+1<<" "<<tets[i*4]+1<<" "<<tets[i*4+1]+1<<" "<<tets[i*4+2]+1<<" "<<tets[i*4+3]+1<<" 1"<<std::endl;
-  }
+  TextWriter facefile(basename+".face");
+  header.clear();
+  format_int(header, NFacets);
+  header += " 1\n";
+  facefile.write(header);
+  facefile.write_records(NFacets, [&](size_t i, std::string &buffer){
+      format_int(buffer, i+1);
+      for(int k=0;k<3;k++){
+        buffer.push_back(' ');
+        format_int(buffer, facets[i*3+k]+1);
+      }
+      buffer.push_back(' ');
+      format_int(buffer, facet_ids[i]);
+      buffer.push_back('\n');
+    });
+
+  if(nodefile.close()<0 || elefile.close()<0 || facefile.close()<0)
+    return -1;
 
-  ofstream facefile;
-  facefile.open(std::string(basename+".face").c_str());
-  facefile<<NFacets<<" "<<1<<std::endl;
-  for(int i=0;i<NFacets;i++){
-    facefile<<i+1<<" "<<facets[i*3]+1<<" "<<facets[i*3+1]+1<<" "<<facets[i*3+2]+1<<" "<<facet_ids[i]<<std::endl;
-  }
-  
   return 0;
 }
 
@@ -167,36 +320,621 @@ int write_gmsh_file(std::string basename,
 		    std::vector<double> &xyz,
 		    std::vector<int> &tets, 
 		    std::vector<int> &facets,
-		    std::vector<int> &facet_ids){
+		    std::vector<int> &facet_ids,
+		    const std::vector<int> &colour){
+  ScopedStage stage("write_gmsh");
+
   
   int NNodes = xyz.size()/3;
   int NTetra = tets.size()/4;
   int NFacets = facet_ids.size();
   assert(NFacets==facets.size()/3);
 
-  ofstream file;
-  file.open(std::string(basename+".msh").c_str());
-  file<<"$MeshFormat"<<std::endl
-      <<"2.2 0 8"<<std::endl
-      <<"$EndMeshFormat"<<std::endl
-      <<"$Nodes"<<std::endl
-      <<NNodes<<std::endl;
-  file<<std::setprecision(std::numeric_limits<double>::digits10+1);
-  for(size_t i=0;i<NNodes;i++){
-    file<<i+1<<" "<<xyz[i*3]<<" "<<xyz[i*3+1]<<" "<<xyz[i*3+2]<<std::endl;
-  }
-  file<<"$EndNodes"<<std::endl
-      <<"$Elements"<<std::endl
-      <<NTetra+NFacets<<std::endl;
-  for(size_t i=0;i<NTetra;i++){
-    file<<i+1<<" 4 1 1 "<<tets[i*4]+1<<" "<<tets[i*4+1]+1<<" "<<tets[i*4+2]+1<<" "<<tets[i*4+3]+1<<std::endl;
-  }
-  for(size_t i=0;i<NFacets;i++){
-    file<<i+NTetra+1<<" 2 1 "<<facet_ids[i]<<" "<<facets[i*3]+1<<" "<<facets[i*3+1]+1<<" "<<facets[i*3+2]+1<<std::endl;
-  }
-  file<<"$EndElements"<<std::endl;
+  TextWriter file(basename+".msh");
+  std::string text("$MeshFormat\n2.2 0 8\n$EndMeshFormat\n$Nodes\n");
+  format_int(text, NNodes);
+  text.push_back('\n');
+  file.write(text);
+  file.write_records(NNodes, [&](size_t i, std::string &buffer){
+      format_int(buffer, i+1);
+      for(int k=0;k<3;k++){
+        buffer.push_back(' ');
+        format_double(buffer, xyz[i*3+k]);
+      }
+      buffer.push_back('\n');
+    });
+
+  text = "$EndNodes\n$Elements\n";
+  format_int(text, NTetra+NFacets);
+  text.push_back('\n');
+  file.write(text);
+  file.write_records(NTetra, [&](size_t i, std::string &buffer){
+      format_int(buffer, i+1);
+      if(colour.empty()){
+        buffer += " 4 1 1";
+      }else{
+        buffer += " 4 2 1 ";
+        format_int(buffer, colour[i]+1);
+      }
+      for(int k=0;k<4;k++){
+        buffer.push_back(' ');
+        format_int(buffer, tets[i*4+k]+1);
+      }
+      buffer.push_back('\n');
+    });
+  file.write_records(NFacets, [&](size_t i, std::string &buffer){
+      format_int(buffer, i+NTetra+1);
+      buffer += " 2 1 ";
+      format_int(buffer, facet_ids[i]);
+      for(int k=0;k<3;k++){
+        buffer.push_back(' ');
+        format_int(buffer, facets[i*3+k]+1);
+      }
+      buffer.push_back('\n');
+    });
+  file.write("$EndElements\n");
+
+  return file.close();
+}
+
+// A binary GMSH file mapped into memory, with the offsets of the first
+// node, tetrahedron and facet record.
+struct GmshBinaryFile{
+  int fd;
+  char *buffer;
+  size_t file_size;
+  size_t node_size, tet_size, facet_size;
+  size_t nodes_offset, tets_offset, facets_offset;
+};
+
+// Create filename at its final size for NNodes nodes, NTetra tetrahedra
+// with tet_tags tags and NFacets facets, map it and write everything but
+// the node and element records.
+static int open_gmsh_binary_file(std::string filename, long NNodes, long NTetra, int tet_tags, long NFacets,
+                                 GmshBinaryFile &file){
+  std::ostringstream header, nodes_begin, nodes_end, elements_end;
+  header<<"$MeshFormat\n2.2 1 8\n";
+  nodes_begin<<"\n$EndMeshFormat\n$Nodes\n"<<NNodes<<"\n";
+  nodes_end<<"\n$EndNodes\n$Elements\n"<<NTetra+NFacets<<"\n";
+  elements_end<<"\n$EndElements\n";
+
+  // Element block headers: type, number of elements, number of tags.
+  size_t block_size = 3*sizeof(int);
+  file.node_size = sizeof(int)+3*sizeof(double);
+  file.tet_size = (1+tet_tags+4)*sizeof(int);
+  file.facet_size = (1+1+3)*sizeof(int);
+
+  size_t one_offset = header.str().size();
+  file.nodes_offset = one_offset+sizeof(int)+nodes_begin.str().size();
+  size_t tets_block = file.nodes_offset+NNodes*file.node_size+nodes_end.str().size();
+  size_t facets_block = tets_block+(NTetra>0?block_size+NTetra*file.tet_size:0);
+  size_t end_offset = facets_block+(NFacets>0?block_size+NFacets*file.facet_size:0);
+  file.tets_offset = tets_block+block_size;
+  file.facets_offset = facets_block+block_size;
+  file.file_size = end_offset+elements_end.str().size();
+
+  file.fd = open(filename.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if(file.fd<0){
+    std::cerr<<"ERROR: Cannot write file: "<<filename<<std::endl;
+    return -1;
+  }
+  if(ftruncate(file.fd, file.file_size)<0){
+    std::cerr<<"ERROR: Cannot resize file: "<<filename<<std::endl;
+    close(file.fd);
+    return -1;
+  }
+  file.buffer = (char *)mmap(NULL, file.file_size, PROT_READ|PROT_WRITE, MAP_SHARED, file.fd, 0);
+  if(file.buffer==MAP_FAILED){
+    std::cerr<<"ERROR: Cannot map file: "<<filename<<std::endl;
+    close(file.fd);
+    return -1;
+  }
+
+  int one = 1;
+  memcpy(file.buffer, header.str().c_str(), header.str().size());
+  memcpy(file.buffer+one_offset, &one, sizeof(int));
+  memcpy(file.buffer+one_offset+sizeof(int), nodes_begin.str().c_str(), nodes_begin.str().size());
+  memcpy(file.buffer+tets_block-nodes_end.str().size(), nodes_end.str().c_str(), nodes_end.str().size());
+  memcpy(file.buffer+end_offset, elements_end.str().c_str(), elements_end.str().size());
+  if(NTetra>0){
+    int block[] = {4, (int)NTetra, tet_tags};
+    memcpy(file.buffer+tets_block, block, block_size);
+  }
+  if(NFacets>0){
+    int block[] = {2, (int)NFacets, 1};
+    memcpy(file.buffer+facets_block, block, block_size);
+  }
+
+  return 0;
+}
+
+static int close_gmsh_binary_file(std::string filename, GmshBinaryFile &file){
+  int ierr = munmap(file.buffer, file.file_size);
+  ierr |= close(file.fd);
+  if(ierr){
+    std::cerr<<"ERROR: Failed to write file: "<<filename<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+int write_gmsh_binary_file(std::string basename,
+                           const std::vector<double> &xyz,
+                           const std::vector<int> &tets,
+                           const std::vector<int> &facets,
+                           const std::vector<int> &facet_ids,
+                           const std::vector<int> &colour){
+  ScopedStage stage("write_gmsh_binary");
+
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  int NFacets = facet_ids.size();
+  assert(NFacets==facets.size()/3);
+
+  int tet_tags = colour.empty()?1:2;
+  std::string filename = basename+".msh";
+  GmshBinaryFile file;
+  if(open_gmsh_binary_file(filename, NNodes, NTetra, tet_tags, NFacets, file)<0)
+    return -1;
+
+#pragma omp parallel
+  {
+    ThreadSpan span("write_gmsh_binary");
+#pragma omp for nowait
+    for(int i=0;i<NNodes;i++){
+      char *p = file.buffer+file.nodes_offset+i*file.node_size;
+      int id = i+1;
+      memcpy(p, &id, sizeof(int));
+      memcpy(p+sizeof(int), &(xyz[i*3]), 3*sizeof(double));
+    }
+
+#pragma omp for nowait
+    for(int i=0;i<NTetra;i++){
+      int record[7], k=0;
+      record[k++] = i+1;
+      record[k++] = 1;
+      if(!colour.empty())
+        record[k++] = colour[i]+1;
+      for(int j=0;j<4;j++)
+        record[k++] = tets[i*4+j]+1;
+      memcpy(file.buffer+file.tets_offset+i*file.tet_size, record, file.tet_size);
+    }
+
+#pragma omp for nowait
+    for(int i=0;i<NFacets;i++){
+      int record[] = {NTetra+i+1, facet_ids[i], facets[i*3]+1, facets[i*3+1]+1, facets[i*3+2]+1};
+      memcpy(file.buffer+file.facets_offset+i*file.facet_size, record, file.facet_size);
+    }
+  }
+
+  return close_gmsh_binary_file(filename, file);
+}
+
+// Number of live elements before each block of TRIM_BLOCK elements.
+static const int TRIM_BLOCK = 1024;
+// Element i is live if keep[i] is set or, if keep is empty, if it is not
+// masked.
+static inline bool live_element(const std::vector<int> &tets, const std::vector<char> &keep, long i){
+  return keep.empty()?tets[i*4]!=-1:keep[i]!=0;
+}
+
+static void live_element_offsets(const std::vector<int> &tets, const std::vector<char> &keep, std::vector<long> &offsets){
+  long NTetra = tets.size()/4;
+  long nblocks = (NTetra+TRIM_BLOCK-1)/TRIM_BLOCK;
+  offsets.assign(nblocks+1, 0);
+#pragma omp parallel
+  {
+    ThreadSpan span("count elements");
+#pragma omp for nowait
+    for(long b=0;b<nblocks;b++){
+      long end = std::min(NTetra, (b+1)*TRIM_BLOCK);
+      for(long i=b*TRIM_BLOCK;i<end;i++){
+        if(live_element(tets, keep, i))
+          offsets[b+1]++;
+      }
+    }
+  }
+  for(long b=0;b<nblocks;b++)
+    offsets[b+1] += offsets[b];
+}
+
+int write_trimmed_gmsh_file(std::string basename,
+                            const std::vector<double> &xyz,
+                            const std::vector<int> &tets,
+                            const std::vector<int> &renumbering,
+                            const std::vector<int> &facets,
+                            const std::vector<int> &facet_ids,
+                            bool binary){
+  return write_trimmed_gmsh_file(basename, xyz, tets, std::vector<char>(), renumbering, facets, facet_ids, binary);
+}
+
+int write_trimmed_gmsh_file(std::string basename,
+                            const std::vector<double> &xyz,
+                            const std::vector<int> &tets,
+                            const std::vector<char> &keep,
+                            const std::vector<int> &renumbering,
+                            const std::vector<int> &facets,
+                            const std::vector<int> &facet_ids,
+                            bool binary){
+  ScopedStage stage("write_trimmed_gmsh");
+
+  long NNodes_in = renumbering.size();
+  long NTetra_in = tets.size()/4;
+  long NFacets = facet_ids.size();
+  assert(NFacets==facets.size()/3);
+
+  long NNodes = 0;
+  for(long i=0;i<NNodes_in;i++)
+    NNodes = std::max(NNodes, (long)renumbering[i]+1);
+
+  std::vector<long> block_offsets;
+  live_element_offsets(tets, keep, block_offsets);
+  long nblocks = block_offsets.size()-1;
+  long NTetra = block_offsets[nblocks];
+
+  if(!binary){
+    TextWriter file(basename+".msh");
+    std::string text("$MeshFormat\n2.2 0 8\n$EndMeshFormat\n$Nodes\n");
+    format_int(text, NNodes);
+    text.push_back('\n');
+    file.write(text);
+    file.write_records(NNodes_in, [&](size_t i, std::string &buffer){
+        if(renumbering[i]<0)
+          return;
+        format_int(buffer, renumbering[i]+1);
+        for(int k=0;k<3;k++){
+          buffer.push_back(' ');
+          format_double(buffer, xyz[i*3+k]);
+        }
+        buffer.push_back('\n');
+      });
+
+    text = "$EndNodes\n$Elements\n";
+    format_int(text, NTetra+NFacets);
+    text.push_back('\n');
+    file.write(text);
+    // Each record is a block of elements, so that the element numbers
+    // follow from block_offsets.
+    file.write_records(nblocks, [&](size_t b, std::string &buffer){
+        long id = block_offsets[b];
+        long end = std::min(NTetra_in, (long)(b+1)*TRIM_BLOCK);
+        for(long i=b*TRIM_BLOCK;i<end;i++){
+          if(!live_element(tets, keep, i))
+            continue;
+          format_int(buffer, ++id);
+          buffer += " 4 1 1";
+          for(int k=0;k<4;k++){
+            buffer.push_back(' ');
+            format_int(buffer, renumbering[tets[i*4+k]]+1);
+          }
+          buffer.push_back('\n');
+        }
+      });
+    file.write_records(NFacets, [&](size_t i, std::string &buffer){
+        format_int(buffer, i+NTetra+1);
+        buffer += " 2 1 ";
+        format_int(buffer, facet_ids[i]);
+        for(int k=0;k<3;k++){
+          buffer.push_back(' ');
+          format_int(buffer, facets[i*3+k]+1);
+        }
+        buffer.push_back('\n');
+      });
+    file.write("$EndElements\n");
+
+    return file.close();
+  }
+
+  std::string filename = basename+".msh";
+  GmshBinaryFile file;
+  if(open_gmsh_binary_file(filename, NNodes, NTetra, 1, NFacets, file)<0)
+    return -1;
+
+#pragma omp parallel
+  {
+    ThreadSpan span("write_trimmed_gmsh");
+#pragma omp for nowait
+    for(long i=0;i<NNodes_in;i++){
+      int id = renumbering[i];
+      if(id<0)
+        continue;
+      char *p = file.buffer+file.nodes_offset+id*file.node_size;
+      id++;
+      memcpy(p, &id, sizeof(int));
+      memcpy(p+sizeof(int), &(xyz[i*3]), 3*sizeof(double));
+    }
+
+#pragma omp for nowait
+    for(long b=0;b<nblocks;b++){
+      long id = block_offsets[b];
+      long end = std::min(NTetra_in, (b+1)*TRIM_BLOCK);
+      for(long i=b*TRIM_BLOCK;i<end;i++){
+        if(!live_element(tets, keep, i))
+          continue;
+        int record[] = {(int)id+1, 1, renumbering[tets[i*4]]+1, renumbering[tets[i*4+1]]+1,
+                        renumbering[tets[i*4+2]]+1, renumbering[tets[i*4+3]]+1};
+        memcpy(file.buffer+file.tets_offset+id*file.tet_size, record, file.tet_size);
+        id++;
+      }
+    }
+
+#pragma omp for nowait
+    for(long i=0;i<NFacets;i++){
+      int record[] = {(int)(NTetra+i+1), facet_ids[i], facets[i*3]+1, facets[i*3+1]+1, facets[i*3+2]+1};
+      memcpy(file.buffer+file.facets_offset+i*file.facet_size, record, file.facet_size);
+    }
+  }
+
+  return close_gmsh_binary_file(filename, file);
+}
+
+int write_interface_file(std::string basename,
+                         const std::vector<int> &interface,
+                         const std::vector<int> renumbering[2]){
+  ScopedStage stage("write_interface");
+
+  size_t NFacets = interface.size()/3;
+
+  TextWriter file(basename+"_interface.txt");
+  std::string text;
+  format_int(text, NFacets);
+  text.push_back('\n');
+  file.write(text);
+  file.write_records(NFacets, [&](size_t i, std::string &buffer){
+      for(int p=0;p<2;p++){
+        for(int k=0;k<3;k++){
+          if(p+k)
+            buffer.push_back(' ');
+          format_int(buffer, renumbering[p][interface[i*3+k]]+1);
+        }
+      }
+      buffer.push_back('\n');
+    });
+
+  return file.close();
+}
+
+#ifdef HAVE_HDF5
+// Write a (chunked and optionally compressed) two dimensional dataset,
+// creating any missing groups on the way.
+static int write_dataset(hid_t file, const char *name, hid_t filetype, hid_t memtype,
+                         hsize_t rows, hsize_t cols, const void *data, int compression){
+  hsize_t dims[] = {rows, cols};
+  hid_t space = H5Screate_simple(cols>1?2:1, dims, NULL);
+
+  hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(lcpl, 1);
+
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  if(rows>0){
+    hsize_t chunk[] = {std::min(rows, (hsize_t)65536), cols};
+    H5Pset_chunk(dcpl, cols>1?2:1, chunk);
+    if(compression>0){
+      H5Pset_shuffle(dcpl);
+      H5Pset_deflate(dcpl, compression);
+    }
+  }
+
+  hid_t dset = H5Dcreate2(file, name, filetype, space, lcpl, dcpl, H5P_DEFAULT);
+  herr_t ierr = dset<0?-1:H5Dwrite(dset, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+
+  if(dset>=0)
+    H5Dclose(dset);
+  H5Pclose(dcpl);
+  H5Pclose(lcpl);
+  H5Sclose(space);
+
+  return ierr<0?-1:0;
+}
+#endif
+
+int write_xdmf_file(std::string basename,
+                    const std::vector<double> &xyz,
+                    const std::vector<int> &tets,
+                    const std::vector<int> &facets,
+                    const std::vector<int> &facet_ids,
+                    int compression){
+  ScopedStage stage("write_xdmf");
+
+#ifdef HAVE_HDF5
+  int NNodes = xyz.size()/3;
+  int NTetra = tets.size()/4;
+  int NFacets = facet_ids.size();
+  assert(NFacets==facets.size()/3);
+
+  // Skip masked elements.
+  std::vector<int> live_tets;
+  live_tets.reserve(tets.size());
+  for(int i=0;i<NTetra;i++){
+    if(tets[i*4]!=-1)
+      live_tets.insert(live_tets.end(), tets.begin()+i*4, tets.begin()+i*4+4);
+  }
+  int NLive = live_tets.size()/4;
+
+  std::string h5_filename = basename+".h5";
+  hid_t file = H5Fcreate(h5_filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if(file<0){
+    std::cerr<<"ERROR: Cannot write file: "<<h5_filename<<std::endl;
+    return -1;
+  }
+
+  int ierr = 0;
+  ierr |= write_dataset(file, "/Mesh/geometry", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, NNodes, 3, xyz.data(), compression);
+  ierr |= write_dataset(file, "/Mesh/topology", H5T_STD_I32LE, H5T_NATIVE_INT, NLive, 4, live_tets.data(), compression);
+  ierr |= write_dataset(file, "/MeshTags/facet_tags/topology", H5T_STD_I32LE, H5T_NATIVE_INT, NFacets, 3, facets.data(), compression);
+  ierr |= write_dataset(file, "/MeshTags/facet_tags/values", H5T_STD_I32LE, H5T_NATIVE_INT, NFacets, 1, facet_ids.data(), compression);
+  if(H5Fclose(file)<0)
+    ierr = -1;
+
+  if(ierr){
+    std::cerr<<"ERROR: Failed to write file: "<<h5_filename<<std::endl;
+    return -1;
+  }
+
+  // The XDMF files refer to the HDF5 file relative to their own location.
+  std::string h5_name = h5_filename.substr(h5_filename.find_last_of('/')+1);
+
+  std::ostringstream geometry;
+  geometry<<"      <Geometry GeometryType=\"XYZ\">\n"
+          <<"        <DataItem Dimensions=\""<<NNodes<<" 3\" NumberType=\"Float\" Precision=\"8\" Format=\"HDF\">"
+          <<h5_name<<":/Mesh/geometry</DataItem>\n"
+          <<"      </Geometry>\n";
+
+  ofstream xdmf;
+  xdmf.open(std::string(basename+".xdmf").c_str());
+  xdmf<<"<?xml version=\"1.0\"?>\n"
+      <<"<!DOCTYPE Xdmf SYSTEM \"Xdmf.dtd\" []>\n"
+      <<"<Xdmf Version=\"3.0\">\n"
+      <<"  <Domain>\n"
+      <<"    <Grid Name=\"mesh\" GridType=\"Uniform\">\n"
+      <<"      <Topology TopologyType=\"Tetrahedron\" NumberOfElements=\""<<NLive<<"\" NodesPerElement=\"4\">\n"
+      <<"        <DataItem Dimensions=\""<<NLive<<" 4\" NumberType=\"Int\" Precision=\"4\" Format=\"HDF\">"
+      <<h5_name<<":/Mesh/topology</DataItem>\n"
+      <<"      </Topology>\n"
+      <<geometry.str()
+      <<"    </Grid>\n"
+      <<"  </Domain>\n"
+      <<"</Xdmf>\n";
+  xdmf.close();
+
+  ofstream facet_xdmf;
+  facet_xdmf.open(std::string(basename+"_facets.xdmf").c_str());
+  facet_xdmf<<"<?xml version=\"1.0\"?>\n"
+            <<"<!DOCTYPE Xdmf SYSTEM \"Xdmf.dtd\" []>\n"
+            <<"<Xdmf Version=\"3.0\">\n"
+            <<"  <Domain>\n"
+            <<"    <Grid Name=\"facet_tags\" GridType=\"Uniform\">\n"
+            <<"      <Topology TopologyType=\"Triangle\" NumberOfElements=\""<<NFacets<<"\" NodesPerElement=\"3\">\n"
+            <<"        <DataItem Dimensions=\""<<NFacets<<" 3\" NumberType=\"Int\" Precision=\"4\" Format=\"HDF\">"
+            <<h5_name<<":/MeshTags/facet_tags/topology</DataItem>\n"
+            <<"      </Topology>\n"
+            <<geometry.str()
+            <<"      <Attribute Name=\"facet_tags\" AttributeType=\"Scalar\" Center=\"Cell\">\n"
+            <<"        <DataItem Dimensions=\""<<NFacets<<"\" NumberType=\"Int\" Precision=\"4\" Format=\"HDF\">"
+            <<h5_name<<":/MeshTags/facet_tags/values</DataItem>\n"
+            <<"      </Attribute>\n"
+            <<"    </Grid>\n"
+            <<"  </Domain>\n"
+            <<"</Xdmf>\n";
+  facet_xdmf.close();
+
+  if(!xdmf.good() || !facet_xdmf.good()){
+    std::cerr<<"ERROR: Failed to write file: "<<basename+".xdmf"<<std::endl;
+    return -1;
+  }
+
+  return 0;
+#else
+  std::cerr<<"ERROR: poreflow was built without HDF5 so XDMF output is not available."<<std::endl;
+  return -1;
+#endif
+}
+
+int write_binary_mesh_file(std::string filename,
+                           const std::vector<double> &xyz,
+                           const std::vector<int> &tets,
+                           const std::vector<int> &facets,
+                           const std::vector<int> &facet_ids,
+                           double resolution){
+  ScopedStage stage("write_pfm");
+
+  const unsigned int byte_order = 0x01020304;
+  if(*(const unsigned char *)&byte_order!=0x04){
+    std::cerr<<"ERROR: The native binary mesh format is only written on little endian machines."<<std::endl;
+    return -1;
+  }
+
+  int64_t NNodes = xyz.size()/3;
+  int64_t NTetra = tets.size()/4;
+  int64_t NFacets = facet_ids.size();
+  assert(NFacets==facets.size()/3);
+
+  // Skip masked elements.
+  int64_t NLive = 0;
+  for(int64_t i=0;i<NTetra;i++){
+    if(tets[i*4]!=-1)
+      NLive++;
+  }
+
+  uint64_t offsets[4];
+  uint64_t sizes[] = {NNodes*3*sizeof(double), NLive*4*sizeof(int), NFacets*3*sizeof(int), NFacets*sizeof(int)};
+  uint64_t end = PFM_HEADER_SIZE;
+  for(int i=0;i<4;i++){
+    offsets[i] = end;
+    end = ((offsets[i]+sizes[i]+PFM_ALIGNMENT-1)/PFM_ALIGNMENT)*PFM_ALIGNMENT;
+  }
+
+  char header[PFM_HEADER_SIZE];
+  memset(header, 0, PFM_HEADER_SIZE);
+  memcpy(header, "PFMESH\0\0", 8);
+  uint32_t version = 1;
+  memcpy(header+8, &version, 4);
+  memcpy(header+12, &byte_order, 4);
+  memcpy(header+16, &NNodes, 8);
+  memcpy(header+24, &NLive, 8);
+  memcpy(header+32, &NFacets, 8);
+  memcpy(header+40, &resolution, 8);
+  memcpy(header+48, "<f8", 3);
+  memcpy(header+52, "<i4", 3);
+  memcpy(header+56, offsets, sizeof(offsets));
+
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  if(!file.good()){
+    std::cerr<<"ERROR: Cannot write file: "<<filename<<std::endl;
+    return -1;
+  }
+
+  const char padding[PFM_ALIGNMENT] = {0};
+  file.write(header, PFM_HEADER_SIZE);
+  file.write((const char *)xyz.data(), sizes[0]);
+  file.write(padding, offsets[1]-offsets[0]-sizes[0]);
+  if(NLive==NTetra){
+    file.write((const char *)tets.data(), sizes[1]);
+  }else{
+    for(int64_t i=0;i<NTetra;i++){
+      if(tets[i*4]!=-1)
+        file.write((const char *)&(tets[i*4]), 4*sizeof(int));
+    }
+  }
+  file.write(padding, offsets[2]-offsets[1]-sizes[1]);
+  file.write((const char *)facets.data(), sizes[2]);
+  file.write(padding, offsets[3]-offsets[2]-sizes[2]);
+  file.write((const char *)facet_ids.data(), sizes[3]);
+  file.write(padding, end-offsets[3]-sizes[3]);
   file.close();
 
+  if(!file.good()){
+    std::cerr<<"ERROR: Failed to write file: "<<filename<<std::endl;
+    return -1;
+  }
+
   return 0;
 }
 
+int write_colour_file(std::string basename,
+                      const std::vector<int> &offsets,
+                      const std::vector<int> &elements){
+  ScopedStage stage("write_colour");
+
+  ofstream file;
+  file.open(std::string(basename+".colour").c_str());
+  if(!file.good()){
+    std::cerr<<"ERROR: Cannot write file: "<<basename+".colour"<<std::endl;
+    return -1;
+  }
+
+  int ncolours = offsets.size()-1;
+  file<<ncolours<<" "<<elements.size()<<std::endl;
+  for(int i=0;i<=ncolours;i++)
+    file<<offsets[i]<<(i<ncolours?" ":"\n");
+  for(size_t i=0;i<elements.size();i++)
+    file<<elements[i]<<(i+1<elements.size()?" ":"\n");
+  file.close();
+  if(file.fail()){
+    std::cerr<<"ERROR: Failed to write file: "<<basename+".colour"<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}